@@ -0,0 +1,110 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __SyntheticRoom_h_
+#define __SyntheticRoom_h_
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+
+#include "scan/DataPointContainer.h"
+
+namespace hectorslam {
+
+/**
+ * Range along a ray in a 20m x 14m room centered at the origin, with four round pillars.
+ */
+inline float castSyntheticRay(float originX, float originY, float angle)
+{
+  float dirX = std::cos(angle);
+  float dirY = std::sin(angle);
+  float range = 30.0f;
+
+  if (dirX > 1e-6f){
+    range = std::min(range, (10.0f - originX) / dirX);
+  }else if (dirX < -1e-6f){
+    range = std::min(range, (-10.0f - originX) / dirX);
+  }
+
+  if (dirY > 1e-6f){
+    range = std::min(range, (7.0f - originY) / dirY);
+  }else if (dirY < -1e-6f){
+    range = std::min(range, (-7.0f - originY) / dirY);
+  }
+
+  const float pillarX[4] = { 3.0f, -4.0f, 5.0f, -2.0f };
+  const float pillarY[4] = { 2.0f, -3.0f, -4.0f, 4.0f };
+  const float pillarRadiusSqr = 0.25f;
+
+  for (int i = 0; i < 4; ++i){
+    float toPillarX = pillarX[i] - originX;
+    float toPillarY = pillarY[i] - originY;
+    float along = toPillarX * dirX + toPillarY * dirY;
+    float distSqr = toPillarX * toPillarX + toPillarY * toPillarY - along * along;
+
+    if ((along > 0.0f) && (distSqr < pillarRadiusSqr)){
+      range = std::min(range, along - std::sqrt(pillarRadiusSqr - distSqr));
+    }
+  }
+
+  return range;
+}
+
+/**
+ * Pose of the robot moving through the synthetic room at time t (seconds).
+ */
+inline Eigen::Vector3f syntheticPose(float t)
+{
+  return Eigen::Vector3f(3.0f * std::sin(t * 0.3f), 2.0f * std::sin(t * 0.2f), 0.4f * std::sin(t * 0.25f));
+}
+
+/**
+ * Fills dataContainer with a full 360 degree scan of numBeams beams taken at pose, in map cell units.
+ */
+inline void syntheticScan(const Eigen::Vector3f& pose, int numBeams, float scaleToMap, DataContainer& dataContainer)
+{
+  dataContainer.clear();
+  dataContainer.setOrigo(Eigen::Vector2f::Zero());
+
+  float angleIncrement = static_cast<float>(2.0 * M_PI / numBeams);
+
+  for (int i = 0; i < numBeams; ++i){
+    float angle = static_cast<float>(-M_PI) + i * angleIncrement;
+    float range = castSyntheticRay(pose.x(), pose.y(), angle + pose.z());
+
+    if (range < 29.9f){
+      dataContainer.add(Eigen::Vector2f(std::cos(angle), std::sin(angle)) * (range * scaleToMap));
+    }
+  }
+}
+
+}
+
+#endif
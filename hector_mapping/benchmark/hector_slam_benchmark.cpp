@@ -0,0 +1,142 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+/**
+ * Google Benchmark microbenchmarks of the hot hector_slam_lib kernels at several map sizes and scan densities. All
+ * maps cover the same 51.2m square, so larger maps have finer cells. Arguments are map size (cells) and beams per
+ * scan.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <Eigen/Core>
+
+#include "map/GridMap.h"
+#include "map/OccGridMapUtilConfig.h"
+#include "matcher/ScanMatcher.h"
+#include "scan/DataPointContainer.h"
+
+#include "SyntheticRoom.h"
+
+namespace {
+
+typedef hectorslam::OccGridMapUtilConfig<hectorslam::GridMap> MapUtil;
+
+/**
+ * Map of the synthetic room built from scans along the first seconds of the synthetic trajectory, plus a scan taken
+ * at the end of it.
+ */
+class MapFixture
+{
+public:
+  MapFixture(int mapSize, int numBeams)
+    : gridMap(51.2f / mapSize, Eigen::Vector2i(mapSize, mapSize), Eigen::Vector2f(25.6f, 25.6f))
+    , gridMapUtil(&gridMap)
+    , dataContainer(numBeams)
+  {
+    for (int i = 0; i < 40; ++i){
+      Eigen::Vector3f pose(hectorslam::syntheticPose(i * 0.25f));
+      hectorslam::syntheticScan(pose, numBeams, gridMap.getScaleToMap(), dataContainer);
+      gridMap.updateByScan(dataContainer, pose);
+    }
+
+    gridMapUtil.resetCachedData();
+
+    scanPoseWorld = hectorslam::syntheticPose(10.0f);
+    scanPoseMap = gridMap.getMapCoordsPose(scanPoseWorld);
+    hectorslam::syntheticScan(scanPoseWorld, numBeams, gridMap.getScaleToMap(), dataContainer);
+  }
+
+  hectorslam::GridMap gridMap;
+  MapUtil gridMapUtil;
+  hectorslam::DataContainer dataContainer;
+  Eigen::Vector3f scanPoseWorld;
+  Eigen::Vector3f scanPoseMap;
+};
+
+void BM_MatchData(benchmark::State& state)
+{
+  MapFixture fixture(state.range(0), state.range(1));
+  hectorslam::ScanMatcher<MapUtil> scanMatcher;
+  Eigen::Vector3f hint(fixture.scanPoseWorld + Eigen::Vector3f(0.05f, -0.05f, 0.02f));
+  Eigen::Matrix3f covMatrix;
+
+  for (auto _ : state){
+    benchmark::DoNotOptimize(scanMatcher.matchData(hint, fixture.gridMapUtil, fixture.dataContainer, covMatrix, 20));
+  }
+
+  state.SetItemsProcessed(state.iterations() * fixture.dataContainer.getSize());
+}
+
+void BM_UpdateByScan(benchmark::State& state)
+{
+  MapFixture fixture(state.range(0), state.range(1));
+
+  for (auto _ : state){
+    fixture.gridMap.updateByScan(fixture.dataContainer, fixture.scanPoseWorld);
+  }
+
+  state.SetItemsProcessed(state.iterations() * fixture.dataContainer.getSize());
+}
+
+void BM_GetCompleteHessianDerivs(benchmark::State& state)
+{
+  MapFixture fixture(state.range(0), state.range(1));
+  Eigen::Matrix3f H;
+  Eigen::Vector3f dTr;
+
+  for (auto _ : state){
+    fixture.gridMapUtil.getCompleteHessianDerivs(fixture.scanPoseMap, fixture.dataContainer, H, dTr);
+    benchmark::DoNotOptimize(H);
+    benchmark::DoNotOptimize(dTr);
+  }
+
+  state.SetItemsProcessed(state.iterations() * fixture.dataContainer.getSize());
+}
+
+void mapSizesAndScanDensities(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->ArgNames({ "map_size", "beams" });
+
+  const int mapSizes[3] = { 256, 1024, 2048 };
+  const int numBeams[3] = { 360, 1080, 2160 };
+
+  for (int i = 0; i < 3; ++i){
+    for (int j = 0; j < 3; ++j){
+      benchmark->Args({ mapSizes[i], numBeams[j] });
+    }
+  }
+}
+
+}
+
+BENCHMARK(BM_MatchData)->Apply(mapSizesAndScanDensities);
+BENCHMARK(BM_UpdateByScan)->Apply(mapSizesAndScanDensities);
+BENCHMARK(BM_GetCompleteHessianDerivs)->Apply(mapSizesAndScanDensities);
+
+BENCHMARK_MAIN();
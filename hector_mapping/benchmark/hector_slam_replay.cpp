@@ -0,0 +1,615 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+/**
+ * ROS-free replay of a recorded scan sequence through HectorSlamProcessor, for measuring changes to hector_slam_lib.
+ *
+ * Scan logs are CSV files with one scan per line: stamp,angle_min,angle_increment,range_0,...,range_n-1 (ranges in
+ * meters, lines starting with # are skipped). Reference trajectories have one pose per line: stamp,x,y,yaw. Both
+ * can also be generated from a simulated room with --synthetic, and written out with --write-scans and
+ * --write-reference.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <Eigen/Core>
+
+#include "slam_main/HectorSlamProcessor.h"
+
+#include "SyntheticRoom.h"
+
+struct ScanRecord
+{
+  double stamp;
+  float angleMin;
+  float angleIncrement;
+  std::vector<float> ranges;
+};
+
+struct PoseRecord
+{
+  double stamp;
+  Eigen::Vector3f pose;
+};
+
+struct ReplayOptions
+{
+  ReplayOptions()
+    : syntheticScans(0)
+    , syntheticBeams(1080)
+    , mapResolution(0.05f)
+    , mapSize(1024)
+    , mapStartX(0.5f)
+    , mapStartY(0.5f)
+    , mapLevels(3)
+    , updateFactorFree(0.4f)
+    , updateFactorOccupied(0.9f)
+    , mapUpdateDistanceThresh(0.4f)
+    , mapUpdateAngleThresh(0.9f)
+    , laserMinDist(0.4f)
+    , laserMaxDist(30.0f)
+    , mapUpdateThreads(1)
+    , useProbabilityPlane(false)
+    , maxDrift(-1.0f)
+  {}
+
+  std::string scanFile;
+  std::string referenceFile;
+  std::string writeScanFile;
+  std::string writeReferenceFile;
+  int syntheticScans;
+  int syntheticBeams;
+  float mapResolution;
+  int mapSize;
+  float mapStartX;
+  float mapStartY;
+  int mapLevels;
+  float updateFactorFree;
+  float updateFactorOccupied;
+  float mapUpdateDistanceThresh;
+  float mapUpdateAngleThresh;
+  float laserMinDist;
+  float laserMaxDist;
+  int mapUpdateThreads;
+  bool useProbabilityPlane;
+  float maxDrift;
+};
+
+/**
+ * Runs the stages of HectorSlamProcessor::update() one by one to time them separately.
+ */
+class TimedSlamProcessor : public hectorslam::HectorSlamProcessor
+{
+public:
+  TimedSlamProcessor(float mapResolution, int mapSizeX, int mapSizeY, const Eigen::Vector2f& startCoords, int multi_res_size)
+    : HectorSlamProcessor(mapResolution, mapSizeX, mapSizeY, startCoords, multi_res_size)
+  {}
+
+  /**
+   * @return True if the map has been updated, the stage times (seconds) are only valid then
+   */
+  bool timedUpdate(const hectorslam::DataContainer& dataContainer, double& matchTime, double& mapUpdateTime, double& cacheResetTime)
+  {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    bool updateMap = matchScan(dataContainer, lastScanMatchPose);
+
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    matchTime = std::chrono::duration<double>(t1 - t0).count();
+
+    if (!updateMap){
+      return false;
+    }
+
+    mapRep->updateByScan(dataContainer, lastScanMatchPose);
+    mapRep->updateMapSnapshots();
+
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    mapRep->onMapUpdated();
+
+    std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+
+    mapUpdateTime = std::chrono::duration<double>(t2 - t1).count();
+    cacheResetTime = std::chrono::duration<double>(t3 - t2).count();
+    return true;
+  }
+};
+
+static bool readCsvLine(std::istream& stream, std::vector<double>& values)
+{
+  std::string line;
+
+  while (std::getline(stream, line)){
+    if (line.empty() || (line[0] == '#')){
+      continue;
+    }
+
+    values.clear();
+
+    const char* curr = line.c_str();
+    char* end = 0;
+
+    while (*curr){
+      double value = std::strtod(curr, &end);
+
+      if (end == curr){
+        break;
+      }
+
+      values.push_back(value);
+      curr = end;
+
+      while ((*curr == ',') || (*curr == ' ') || (*curr == '\t') || (*curr == '\r')){
+        ++curr;
+      }
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+static bool readScans(const std::string& fileName, std::vector<ScanRecord>& scans)
+{
+  std::ifstream file(fileName.c_str());
+
+  if (!file){
+    std::cerr << "Cannot open scan log " << fileName << "\n";
+    return false;
+  }
+
+  std::vector<double> values;
+
+  while (readCsvLine(file, values)){
+    if (values.size() < 4){
+      std::cerr << "Skipping scan line with less than one range in " << fileName << "\n";
+      continue;
+    }
+
+    ScanRecord scan;
+    scan.stamp = values[0];
+    scan.angleMin = static_cast<float>(values[1]);
+    scan.angleIncrement = static_cast<float>(values[2]);
+    scan.ranges.assign(values.begin() + 3, values.end());
+    scans.push_back(scan);
+  }
+
+  return true;
+}
+
+static bool readReference(const std::string& fileName, std::vector<PoseRecord>& poses)
+{
+  std::ifstream file(fileName.c_str());
+
+  if (!file){
+    std::cerr << "Cannot open reference trajectory " << fileName << "\n";
+    return false;
+  }
+
+  std::vector<double> values;
+
+  while (readCsvLine(file, values)){
+    if (values.size() != 4){
+      std::cerr << "Skipping reference line without 4 values in " << fileName << "\n";
+      continue;
+    }
+
+    PoseRecord pose;
+    pose.stamp = values[0];
+    pose.pose = Eigen::Vector3f(values[1], values[2], values[3]);
+    poses.push_back(pose);
+  }
+
+  return true;
+}
+
+static bool writeScans(const std::string& fileName, const std::vector<ScanRecord>& scans)
+{
+  std::ofstream file(fileName.c_str());
+  file.precision(9);
+  file << "# stamp,angle_min,angle_increment,ranges...\n";
+
+  for (size_t i = 0; i < scans.size(); ++i){
+    const ScanRecord& scan = scans[i];
+    file << scan.stamp << "," << scan.angleMin << "," << scan.angleIncrement;
+
+    for (size_t j = 0; j < scan.ranges.size(); ++j){
+      file << "," << scan.ranges[j];
+    }
+
+    file << "\n";
+  }
+
+  return static_cast<bool>(file);
+}
+
+static bool writeReference(const std::string& fileName, const std::vector<PoseRecord>& poses)
+{
+  std::ofstream file(fileName.c_str());
+  file.precision(9);
+  file << "# stamp,x,y,yaw\n";
+
+  for (size_t i = 0; i < poses.size(); ++i){
+    file << poses[i].stamp << "," << poses[i].pose.x() << "," << poses[i].pose.y() << "," << poses[i].pose.z() << "\n";
+  }
+
+  return static_cast<bool>(file);
+}
+
+static void generateSynthetic(int numScans, int numBeams, std::vector<ScanRecord>& scans, std::vector<PoseRecord>& poses)
+{
+  const double scanPeriod = 0.025;
+
+  for (int i = 0; i < numScans; ++i){
+    float t = static_cast<float>(i * scanPeriod);
+
+    PoseRecord pose;
+    pose.stamp = i * scanPeriod;
+    pose.pose = hectorslam::syntheticPose(t);
+
+    ScanRecord scan;
+    scan.stamp = pose.stamp;
+    scan.angleMin = static_cast<float>(-M_PI);
+    scan.angleIncrement = static_cast<float>(2.0 * M_PI / numBeams);
+    scan.ranges.resize(numBeams);
+
+    for (int j = 0; j < numBeams; ++j){
+      scan.ranges[j] = hectorslam::castSyntheticRay(pose.pose.x(), pose.pose.y(), scan.angleMin + j * scan.angleIncrement + pose.pose.z());
+    }
+
+    scans.push_back(scan);
+    poses.push_back(pose);
+  }
+}
+
+/**
+ * Same conversion as HectorMappingRos::rosLaserScanToDataContainer().
+ */
+static void scanToDataContainer(const ScanRecord& scan, float minRange, float maxRange, float scaleToMap, hectorslam::DataContainer& dataContainer)
+{
+  dataContainer.clear();
+  dataContainer.setOrigo(Eigen::Vector2f::Zero());
+
+  float angle = scan.angleMin;
+  size_t size = scan.ranges.size();
+
+  for (size_t i = 0; i < size; ++i){
+    float dist = scan.ranges[i];
+
+    if ((dist > minRange) && (dist < maxRange)){
+      dist *= scaleToMap;
+      dataContainer.add(Eigen::Vector2f(std::cos(angle) * dist, std::sin(angle) * dist));
+    }
+
+    angle += scan.angleIncrement;
+  }
+}
+
+/**
+ * Reference pose at stamp, linearly interpolated. Returns false outside the reference trajectory.
+ */
+static bool interpolateReference(const std::vector<PoseRecord>& poses, double stamp, Eigen::Vector3f& pose)
+{
+  if (poses.empty() || (stamp < poses.front().stamp) || (stamp > poses.back().stamp)){
+    return false;
+  }
+
+  size_t upper = 0;
+
+  while ((upper < poses.size() - 1) && (poses[upper].stamp < stamp)){
+    ++upper;
+  }
+
+  if ((upper == 0) || (poses[upper].stamp == stamp)){
+    pose = poses[upper].pose;
+    return true;
+  }
+
+  const PoseRecord& a = poses[upper - 1];
+  const PoseRecord& b = poses[upper];
+  float factor = static_cast<float>((stamp - a.stamp) / (b.stamp - a.stamp));
+
+  pose.head<2>() = a.pose.head<2>() + (b.pose.head<2>() - a.pose.head<2>()) * factor;
+  pose.z() = util::normalize_angle(a.pose.z() + util::normalize_angle(b.pose.z() - a.pose.z()) * factor);
+  return true;
+}
+
+/**
+ * Expresses pose relative to origin, SLAM starts at the origin of the map frame.
+ */
+static Eigen::Vector3f relativePose(const Eigen::Vector3f& origin, const Eigen::Vector3f& pose)
+{
+  float cosOrigin = std::cos(origin.z());
+  float sinOrigin = std::sin(origin.z());
+  Eigen::Vector2f diff(pose.head<2>() - origin.head<2>());
+
+  return Eigen::Vector3f(cosOrigin * diff.x() + sinOrigin * diff.y(),
+                         -sinOrigin * diff.x() + cosOrigin * diff.y(),
+                         util::normalize_angle(pose.z() - origin.z()));
+}
+
+static void printPercentiles(const char* name, std::vector<double> times)
+{
+  if (times.empty()){
+    printf("%-12s      n/a\n", name);
+    return;
+  }
+
+  std::sort(times.begin(), times.end());
+
+  double sum = 0.0;
+
+  for (size_t i = 0; i < times.size(); ++i){
+    sum += times[i];
+  }
+
+  size_t last = times.size() - 1;
+
+  printf("%-12s %8zu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, times.size(),
+         sum / times.size() * 1e3,
+         times[static_cast<size_t>(last * 0.5)] * 1e3,
+         times[static_cast<size_t>(last * 0.9)] * 1e3,
+         times[static_cast<size_t>(last * 0.99)] * 1e3,
+         times[last] * 1e3);
+}
+
+static void printUsage(const char* program)
+{
+  std::cerr << "usage: " << program << " (--scans FILE | --synthetic NUM_SCANS) [options]\n"
+            << "  --reference FILE          reference trajectory (stamp,x,y,yaw) to check pose drift against\n"
+            << "  --max-drift METERS        fail if the position error exceeds this\n"
+            << "  --write-scans FILE        write the replayed scans as scan log\n"
+            << "  --write-reference FILE    write the synthetic reference trajectory\n"
+            << "  --synthetic-beams NUM     beams per synthetic scan (1080)\n"
+            << "  --map-resolution M       (0.05)    --map-size CELLS (1024)\n"
+            << "  --map-start-x FACTOR     (0.5)     --map-start-y FACTOR (0.5)\n"
+            << "  --map-levels NUM         (3)       --map-update-threads NUM (1)\n"
+            << "  --update-factor-free P   (0.4)     --update-factor-occupied P (0.9)\n"
+            << "  --map-update-distance-thresh M (0.4)  --map-update-angle-thresh RAD (0.9)\n"
+            << "  --laser-min-dist M       (0.4)     --laser-max-dist M (30)\n"
+            << "  --use-probability-plane\n";
+}
+
+static bool parseOptions(int argc, char** argv, ReplayOptions& options)
+{
+  for (int i = 1; i < argc; ++i){
+    std::string arg(argv[i]);
+
+    if (arg == "--use-probability-plane"){
+      options.useProbabilityPlane = true;
+      continue;
+    }
+
+    if (i + 1 >= argc){
+      std::cerr << "Missing value for " << arg << "\n";
+      return false;
+    }
+
+    const char* value = argv[++i];
+
+    if (arg == "--scans"){
+      options.scanFile = value;
+    }else if (arg == "--reference"){
+      options.referenceFile = value;
+    }else if (arg == "--write-scans"){
+      options.writeScanFile = value;
+    }else if (arg == "--write-reference"){
+      options.writeReferenceFile = value;
+    }else if (arg == "--synthetic"){
+      options.syntheticScans = std::atoi(value);
+    }else if (arg == "--synthetic-beams"){
+      options.syntheticBeams = std::atoi(value);
+    }else if (arg == "--max-drift"){
+      options.maxDrift = std::atof(value);
+    }else if (arg == "--map-resolution"){
+      options.mapResolution = std::atof(value);
+    }else if (arg == "--map-size"){
+      options.mapSize = std::atoi(value);
+    }else if (arg == "--map-start-x"){
+      options.mapStartX = std::atof(value);
+    }else if (arg == "--map-start-y"){
+      options.mapStartY = std::atof(value);
+    }else if (arg == "--map-levels"){
+      options.mapLevels = std::atoi(value);
+    }else if (arg == "--map-update-threads"){
+      options.mapUpdateThreads = std::atoi(value);
+    }else if (arg == "--update-factor-free"){
+      options.updateFactorFree = std::atof(value);
+    }else if (arg == "--update-factor-occupied"){
+      options.updateFactorOccupied = std::atof(value);
+    }else if (arg == "--map-update-distance-thresh"){
+      options.mapUpdateDistanceThresh = std::atof(value);
+    }else if (arg == "--map-update-angle-thresh"){
+      options.mapUpdateAngleThresh = std::atof(value);
+    }else if (arg == "--laser-min-dist"){
+      options.laserMinDist = std::atof(value);
+    }else if (arg == "--laser-max-dist"){
+      options.laserMaxDist = std::atof(value);
+    }else{
+      std::cerr << "Unknown option " << arg << "\n";
+      return false;
+    }
+  }
+
+  if (options.scanFile.empty() == (options.syntheticScans <= 0)){
+    std::cerr << "Exactly one of --scans and --synthetic is required\n";
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  ReplayOptions options;
+
+  if (!parseOptions(argc, argv, options)){
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  std::vector<ScanRecord> scans;
+  std::vector<PoseRecord> reference;
+
+  if (options.syntheticScans > 0){
+    generateSynthetic(options.syntheticScans, options.syntheticBeams, scans, reference);
+  }else if (!readScans(options.scanFile, scans)){
+    return 1;
+  }
+
+  if (!options.referenceFile.empty()){
+    reference.clear();
+
+    if (!readReference(options.referenceFile, reference)){
+      return 1;
+    }
+  }
+
+  if (!options.writeScanFile.empty() && !writeScans(options.writeScanFile, scans)){
+    std::cerr << "Cannot write scan log " << options.writeScanFile << "\n";
+    return 1;
+  }
+
+  if (!options.writeReferenceFile.empty() && !writeReference(options.writeReferenceFile, reference)){
+    std::cerr << "Cannot write reference trajectory " << options.writeReferenceFile << "\n";
+    return 1;
+  }
+
+  if (scans.empty()){
+    std::cerr << "No scans to replay\n";
+    return 1;
+  }
+
+  TimedSlamProcessor slamProcessor(options.mapResolution, options.mapSize, options.mapSize,
+                                   Eigen::Vector2f(options.mapStartX, options.mapStartY), options.mapLevels);
+  slamProcessor.setUpdateFactorFree(options.updateFactorFree);
+  slamProcessor.setUpdateFactorOccupied(options.updateFactorOccupied);
+  slamProcessor.setMapUpdateMinDistDiff(options.mapUpdateDistanceThresh);
+  slamProcessor.setMapUpdateMinAngleDiff(options.mapUpdateAngleThresh);
+  slamProcessor.setUseProbabilityPlane(options.useProbabilityPlane);
+  slamProcessor.setMapUpdateThreads(options.mapUpdateThreads, 1);
+
+  //same cutoff as the node, which drops ranges within 0.1m of range_max
+  float maxRange = options.laserMaxDist - 0.1f;
+
+  hectorslam::DataContainer dataContainer;
+
+  std::vector<double> matchTimes;
+  std::vector<double> mapUpdateTimes;
+  std::vector<double> cacheResetTimes;
+  std::vector<double> scanTimes;
+  matchTimes.reserve(scans.size());
+  scanTimes.reserve(scans.size());
+
+  Eigen::Vector3f referenceOrigin;
+  bool haveReferenceOrigin = !reference.empty() && interpolateReference(reference, scans.front().stamp, referenceOrigin);
+  int numDriftSamples = 0;
+  double sumPositionError = 0.0;
+  double maxPositionError = 0.0;
+  double maxYawError = 0.0;
+  double finalPositionError = 0.0;
+
+  std::chrono::steady_clock::time_point replayStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < scans.size(); ++i){
+    std::chrono::steady_clock::time_point scanStart = std::chrono::steady_clock::now();
+
+    scanToDataContainer(scans[i], options.laserMinDist, maxRange, slamProcessor.getScaleToMap(), dataContainer);
+
+    double matchTime, mapUpdateTime, cacheResetTime;
+
+    if (slamProcessor.timedUpdate(dataContainer, matchTime, mapUpdateTime, cacheResetTime)){
+      mapUpdateTimes.push_back(mapUpdateTime);
+      cacheResetTimes.push_back(cacheResetTime);
+    }
+
+    matchTimes.push_back(matchTime);
+    scanTimes.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - scanStart).count());
+
+    Eigen::Vector3f referencePose;
+
+    if (haveReferenceOrigin && interpolateReference(reference, scans[i].stamp, referencePose)){
+      Eigen::Vector3f expected(relativePose(referenceOrigin, referencePose));
+      const Eigen::Vector3f& estimate = slamProcessor.getLastScanMatchPose();
+
+      double positionError = (estimate.head<2>() - expected.head<2>()).norm();
+      double yawError = std::abs(util::normalize_angle(estimate.z() - expected.z()));
+
+      sumPositionError += positionError;
+      maxPositionError = std::max(maxPositionError, positionError);
+      maxYawError = std::max(maxYawError, yawError);
+      finalPositionError = positionError;
+      ++numDriftSamples;
+    }
+  }
+
+  double replayTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  const Eigen::Vector3f& finalPose = slamProcessor.getLastScanMatchPose();
+
+  printf("scans %zu  map updates %zu  replay %.3f s  throughput %.1f scans/s  peak rss %ld KB\n",
+         scans.size(), mapUpdateTimes.size(), replayTime, scans.size() / replayTime, usage.ru_maxrss);
+  printf("%-12s %8s %9s %9s %9s %9s %9s\n", "stage [ms]", "n", "mean", "p50", "p90", "p99", "max");
+  printPercentiles("match", matchTimes);
+  printPercentiles("map update", mapUpdateTimes);
+  printPercentiles("cache reset", cacheResetTimes);
+  printPercentiles("total", scanTimes);
+  printf("final pose %f %f %f\n", finalPose.x(), finalPose.y(), finalPose.z());
+
+  if (numDriftSamples > 0){
+    printf("drift vs reference (%d poses): mean %.4f m  max %.4f m  final %.4f m  max yaw %.4f rad\n",
+           numDriftSamples, sumPositionError / numDriftSamples, maxPositionError, finalPositionError, maxYawError);
+
+    if ((options.maxDrift >= 0.0f) && (maxPositionError > options.maxDrift)){
+      std::cerr << "Position error " << maxPositionError << " m exceeds --max-drift " << options.maxDrift << " m\n";
+      return 3;
+    }
+  }else if (!options.referenceFile.empty()){
+    std::cerr << "Reference trajectory does not overlap the scans\n";
+    return 1;
+  }
+
+  return 0;
+}
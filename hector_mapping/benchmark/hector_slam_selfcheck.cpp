@@ -0,0 +1,231 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+/**
+ * ROS-free consistency checks of the map update variants that must reproduce the plain update exactly, for every cell
+ * layout: scans traced in bands of rows (concurrently on a worker pool) against single updates, and coarse maps
+ * pooled incrementally from the box of each update against pooling the whole finest map again. Exits with a non-zero
+ * status if any check fails.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "map/GridMap.h"
+#include "scan/DataPointContainer.h"
+#include "util/WorkerPool.h"
+
+#include "SyntheticRoom.h"
+
+namespace {
+
+using hectorslam::DataContainer;
+using hectorslam::GridMapLayoutRowMajor;
+using hectorslam::GridMapLayoutSparse;
+using hectorslam::GridMapLayoutTiled;
+using hectorslam::OccGridMapBase;
+
+const int mapSize = 512;
+const float cellLength = 0.05f;
+const int numScans = 60;
+const int numBeams = 720;
+
+/**
+ * Scan of the synthetic room, every third one taken by two sensors at different origins.
+ */
+void makeScan(int scanIndex, std::mt19937& rng, float scaleToMap, DataContainer& dataContainer, Eigen::Vector3f& pose)
+{
+  pose = hectorslam::syntheticPose(scanIndex * 0.25f);
+  hectorslam::syntheticScan(pose, numBeams, scaleToMap, dataContainer);
+
+  if (scanIndex % 3 == 2){
+    std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+    Eigen::Vector2f origo(offset(rng) * scaleToMap, offset(rng) * scaleToMap);
+
+    dataContainer.addOrigo(origo);
+
+    for (int i = 0; i < numBeams / 4; ++i){
+      float angle = static_cast<float>(i) * 0.02f;
+      dataContainer.add(origo + Eigen::Vector2f(std::cos(angle), std::sin(angle)) * (2.0f * scaleToMap));
+    }
+  }
+}
+
+template<typename MapType>
+int countCellMismatches(const MapType& map, const MapType& reference, bool compareUpdateIndices)
+{
+  int mismatches = 0;
+
+  for (int y = 0; y < map.getSizeY(); ++y){
+    for (int x = 0; x < map.getSizeX(); ++x){
+      if ((map.getGridProbabilityMap(x, y) != reference.getGridProbabilityMap(x, y)) ||
+          (compareUpdateIndices && (map.getCell(x, y).updateIndex != reference.getCell(x, y).updateIndex))){
+        ++mismatches;
+      }
+    }
+  }
+
+  if (map.hasProbabilityPlane() && reference.hasProbabilityPlane()){
+    for (int i = 0; i < map.getNumStorageCells(); ++i){
+      if (map.getProbabilityPlane()[i].probability != reference.getProbabilityPlane()[i].probability){
+        ++mismatches;
+      }
+    }
+  }
+
+  return mismatches;
+}
+
+/**
+ * Traces every scan into one map with updateByScan() and into another in bands of rows on a worker pool, the bands of
+ * odd scans in reverse order. Both maps and their last update bounds have to be identical after every scan.
+ */
+template<typename MapType>
+bool checkBandedUpdates(const char* layoutName)
+{
+  MapType single(cellLength, Eigen::Vector2i(mapSize, mapSize), Eigen::Vector2f(12.8f, 12.8f));
+  MapType banded(cellLength, Eigen::Vector2i(mapSize, mapSize), Eigen::Vector2f(12.8f, 12.8f));
+
+  single.setProbabilityPlaneEnabled(true);
+  banded.setProbabilityPlaneEnabled(true);
+
+  hectorslam::WorkerPool workers(4);
+  std::vector<int> bandRows;
+  std::mt19937 rng(7);
+  DataContainer dataContainer(numBeams);
+  Eigen::Vector3f pose;
+
+  for (int scan = 0; scan < numScans; ++scan){
+    makeScan(scan, rng, single.getScaleToMap(), dataContainer, pose);
+
+    single.updateByScan(dataContainer, pose);
+
+    banded.getScanUpdateBands(dataContainer, pose, 2 + scan % 7, bandRows);
+    banded.beginScanUpdate(dataContainer, pose);
+
+    int numBands = static_cast<int>(bandRows.size()) - 1;
+    bool reverse = (scan % 2) != 0;
+
+    workers.run(numBands, [&](int task){
+      int band = reverse ? (numBands - 1 - task) : task;
+      banded.updateByScanRows(dataContainer, pose, bandRows[band], bandRows[band + 1]);
+    });
+
+    banded.finishScanUpdate();
+
+    Eigen::Vector2i singleMin, singleMax, bandedMin, bandedMax;
+    bool singleChanged = single.getLastUpdateBounds(singleMin, singleMax);
+    bool bandedChanged = banded.getLastUpdateBounds(bandedMin, bandedMax);
+
+    int mismatches = countCellMismatches(banded, single, true);
+
+    if ((singleChanged != bandedChanged) || (singleChanged && ((singleMin != bandedMin) || (singleMax != bandedMax))) ||
+        (mismatches != 0)){
+      std::printf("FAIL banded updates, %s layout: scan %d, %d bands, %d mismatching cells\n", layoutName, scan, numBands, mismatches);
+      return false;
+    }
+  }
+
+  std::printf("ok   banded updates, %s layout\n", layoutName);
+  return true;
+}
+
+/**
+ * Keeps two coarser levels up to date by pooling the box of each update of the next finer one, and compares them to
+ * levels pooled from the whole finest map at the end.
+ */
+template<typename MapType>
+bool checkPooledLevels(const char* layoutName)
+{
+  MapType fine(cellLength, Eigen::Vector2i(mapSize, mapSize), Eigen::Vector2f(12.8f, 12.8f));
+  MapType pooled1(cellLength * 2.0f, Eigen::Vector2i(mapSize / 2, mapSize / 2), Eigen::Vector2f(12.8f, 12.8f));
+  MapType pooled2(cellLength * 4.0f, Eigen::Vector2i(mapSize / 4, mapSize / 4), Eigen::Vector2f(12.8f, 12.8f));
+
+  std::mt19937 rng(11);
+  DataContainer dataContainer(numBeams);
+  Eigen::Vector3f pose;
+  Eigen::Vector2i changedMin, changedMax;
+
+  for (int scan = 0; scan < numScans; ++scan){
+    makeScan(scan, rng, fine.getScaleToMap(), dataContainer, pose);
+
+    fine.updateByScan(dataContainer, pose);
+
+    if (fine.getLastUpdateBounds(changedMin, changedMax)){
+      pooled1.updateByPooling(fine, changedMin, changedMax);
+    }
+
+    if (pooled1.getLastUpdateBounds(changedMin, changedMax)){
+      pooled2.updateByPooling(pooled1, changedMin, changedMax);
+    }
+  }
+
+  MapType repooled1(cellLength * 2.0f, Eigen::Vector2i(mapSize / 2, mapSize / 2), Eigen::Vector2f(12.8f, 12.8f));
+  MapType repooled2(cellLength * 4.0f, Eigen::Vector2i(mapSize / 4, mapSize / 4), Eigen::Vector2f(12.8f, 12.8f));
+
+  repooled1.updateByPooling(fine);
+  repooled2.updateByPooling(repooled1);
+
+  //update markers of pooled levels follow their own update sequence, only the cell values have to match
+  int mismatches1 = countCellMismatches(pooled1, repooled1, false);
+  int mismatches2 = countCellMismatches(pooled2, repooled2, false);
+
+  if ((mismatches1 != 0) || (mismatches2 != 0)){
+    std::printf("FAIL pooled levels, %s layout: %d and %d mismatching cells\n", layoutName, mismatches1, mismatches2);
+    return false;
+  }
+
+  std::printf("ok   pooled levels, %s layout\n", layoutName);
+  return true;
+}
+
+template<typename MapType>
+bool checkLayout(const char* layoutName)
+{
+  bool banded = checkBandedUpdates<MapType>(layoutName);
+  bool pooled = checkPooledLevels<MapType>(layoutName);
+  return banded && pooled;
+}
+
+}
+
+int main(int, char**)
+{
+  bool ok = true;
+
+  ok = checkLayout<OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutRowMajor> >("row-major") && ok;
+  ok = checkLayout<OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutTiled<5> > >("tiled") && ok;
+  ok = checkLayout<OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutTiled<5, true> > >("tiled Morton") && ok;
+  ok = checkLayout<OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutSparse<6> > >("sparse") && ok;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -31,6 +31,7 @@
 
 #include "OccGridMapBase.h"
 #include "GridMapLogOdds.h"
+#include "GridMapQuantizedLogOdds.h"
 #include "GridMapReflectanceCount.h"
 #include "GridMapSimpleCount.h"
 
@@ -40,6 +41,17 @@ typedef OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions> GridMap;
 //typedef OccGridMapBase<SimpleCountCell, GridMapSimpleCountFunctions> GridMap;
 //typedef OccGridMapBase<ReflectanceCell, GridMapReflectanceFunctions> GridMap;
 
+//Compact fixed point log odds cells (4 and 2 bytes instead of 8), see GridMapQuantizedLogOdds.h
+//typedef OccGridMapBase<LogOddsCell16, GridMapLogOddsFunctions16> GridMap;
+//typedef OccGridMapBase<LogOddsCell8, GridMapLogOddsFunctions8> GridMap;
+
+//Blocked cell layouts (32x32 cell tiles, row-major or Morton ordered inside the tile) for large maps
+//typedef OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutTiled<5> > GridMap;
+//typedef OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutTiled<5, true> > GridMap;
+
+//Sparse map allocating 64x64 cell chunks on first write, allows choosing a large map_size for unknown environments
+//typedef OccGridMapBase<LogOddsCell, GridMapLogOddsFunctions, GridMapLayoutSparse<6> > GridMap;
+
 }
 
 #endif
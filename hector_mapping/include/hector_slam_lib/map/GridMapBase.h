@@ -33,19 +33,27 @@
 #include <Eigen/LU>
 
 #include "MapDimensionProperties.h"
+#include "GridMapLayout.h"
 
 namespace hectorslam {
 
 /**
  * GridMapBase provides basic grid map functionality (creates grid , provides transformation from/to world coordinates).
  * It serves as the base class for different map representations that may extend it's functionality.
+ * The ConcreteCellLayout (see GridMapLayout.h) determines how cells are arranged in memory and which cell storage
+ * (see GridMapStorage.h) holds them. Indices passed to getCell(int) are always linear row-major indices,
+ * "storage indices" are positions in the cell storage itself.
  */
-template<typename ConcreteCellType>
+template<typename ConcreteCellType, typename ConcreteCellLayout = GridMapLayoutRowMajor>
 class GridMapBase
 {
 
 public:
 
+  typedef ConcreteCellType CellType;
+  typedef ConcreteCellLayout CellLayout;
+  typedef typename ConcreteCellLayout::template CellStorage<ConcreteCellType>::type ConcreteCellStorage;
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   /**
@@ -72,15 +80,13 @@ public:
   }
 
   /**
-   * Resets the grid cell values by using the resetGridCell() function.
+   * Resets the grid cell values by using the resetGridCell() function. Depending on the storage, cells are only reset
+   * lazily when written to again, so clearing does not touch the whole map.
    */
   void clear()
   {
-    int size = this->getSizeX() * this->getSizeY();
-
-    for (int i = 0; i < size; ++i) {
-      this->mapArray[i].resetGridCell();
-    }
+    mapArray.resetCells();
+    resetUpdateIndex = lastUpdateIndex;
 
     //this->mapArray[0].set(1.0f);
     //this->mapArray[size-1].set(1.0f);
@@ -93,8 +99,8 @@ public:
    * Constructor, creates grid representation and transformations.
    */
   GridMapBase(float mapResolution, const Eigen::Vector2i& size, const Eigen::Vector2f& offset)
-    : mapArray(0)
-    , lastUpdateIndex(-1)
+    : lastUpdateIndex(-1)
+    , resetUpdateIndex(-1)
   {
     Eigen::Vector2i newMapDimensions (size);
 
@@ -119,43 +125,67 @@ public:
    */
   void allocateArray(const Eigen::Vector2i& newMapDims)
   {
-    int sizeX = newMapDims.x();
-    int sizeY = newMapDims.y();
+    cellLayout.setDimensions(newMapDims);
 
-    mapArray = new ConcreteCellType [sizeX*sizeY];
+    mapArray.allocate(cellLayout.getNumStorageCells());
 
     mapDimensionProperties.setMapCellDims(newMapDims);
   }
 
   void deleteArray()
   {
-    if (mapArray != 0){
+    if (mapArray.isAllocated()){
 
-      delete[] mapArray;
+      mapArray.release();
 
-      mapArray = 0;
       mapDimensionProperties.setMapCellDims(Eigen::Vector2i(-1,-1));
     }
   }
 
   ConcreteCellType& getCell(int x, int y)
   {
-    return mapArray[y * sizeX + x];
+    return mapArray[cellLayout.getIndex(x, y)];
   }
 
   const ConcreteCellType& getCell(int x, int y) const
   {
-    return mapArray[y * sizeX + x];
+    return mapArray[cellLayout.getIndex(x, y)];
   }
 
   ConcreteCellType& getCell(int index)
   {
-    return mapArray[index];
+    return mapArray[cellLayout.getIndexFromLinear(index)];
   }
 
   const ConcreteCellType& getCell(int index) const
   {
-    return mapArray[index];
+    return mapArray[cellLayout.getIndexFromLinear(index)];
+  }
+
+  ConcreteCellType& getStorageCell(int storageIndex)
+  {
+    return mapArray[storageIndex];
+  }
+
+  const ConcreteCellType& getStorageCell(int storageIndex) const
+  {
+    return mapArray[storageIndex];
+  }
+
+  int getStorageIndex(int x, int y) const { return cellLayout.getIndex(x, y); };
+  int getNumStorageCells() const { return cellLayout.getNumStorageCells(); };
+  Eigen::Vector2i getStorageDimensions() const { return cellLayout.getStorageDimensions(); };
+  const ConcreteCellLayout& getCellLayout() const { return cellLayout; };
+  const ConcreteCellStorage& getCellStorage() const { return mapArray; };
+
+  /**
+   * Returns the bounding box (inclusive, in map cells) of the part of the map that is backed by memory. This is the
+   * whole map for dense cell storages and the area of the chunks written so far for sparse ones.
+   * @return False if no cells are allocated
+   */
+  bool getAllocatedBounds(Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    return cellLayout.getAllocatedBounds(mapArray, minCell, maxCell);
   }
 
   void setMapGridSize(const Eigen::Vector2i& newMapDims)
@@ -194,12 +224,7 @@ public:
     this->scaleToMap = other.scaleToMap;
 
     //@todo potential resize
-    int sizeX = this->getSizeX();
-    int sizeY = this->getSizeY();
-
-    size_t concreteCellSize = sizeof(ConcreteCellType);
-
-    memcpy(this->mapArray, other.mapArray, sizeX*sizeY*concreteCellSize);
+    this->mapArray.copyFrom(other.mapArray);
 
     return *this;
   }
@@ -328,6 +353,12 @@ public:
   void setUpdated() { lastUpdateIndex++; };
   int getUpdateIndex() const { return lastUpdateIndex; };
 
+  /**
+   * False until the map is updated after construction or the last reset. The update index keeps counting across
+   * resets, so it cannot tell an empty map.
+   */
+  bool hasUpdates() const { return lastUpdateIndex != resetUpdateIndex; };
+
   /**
     * Returns the rectangle ([xMin,yMin],[xMax,xMax]) containing non-default cell values
     */
@@ -384,7 +415,8 @@ public:
 
 protected:
 
-  ConcreteCellType *mapArray;    ///< Map representation used with plain pointer array.
+  ConcreteCellStorage mapArray;  ///< Cell storage selected by the cell layout.
+  ConcreteCellLayout cellLayout; ///< Arrangement of the cells in mapArray.
 
   float scaleToMap;              ///< Scaling factor from world to map.
 
@@ -397,6 +429,7 @@ protected:
 
 private:
   int lastUpdateIndex;
+  int resetUpdateIndex;   ///< Update index at the last reset
 };
 
 }
@@ -31,6 +31,8 @@
 
 #include <Eigen/Core>
 
+#include <cstdlib>
+
 class CachedMapElement
 {
 public:
@@ -40,6 +42,9 @@ public:
 
 /**
  * Caches filtered grid map accesses in a two dimensional array of the same size as the map.
+ * The array is zero initialized by calloc and cache index 0 is never valid, so the operating system only has to
+ * back the pages of the array that actually get accessed. This keeps the resident size proportional to the explored
+ * area when used with a sparse map.
  */
 class GridMapCacheArray
 {
@@ -52,7 +57,7 @@ public:
     : cacheArray(0)
     , arrayDimensions(-1,-1)
   {
-    currCacheIndex = 0;
+    currCacheIndex = 1;
   }
 
   /**
@@ -110,6 +115,19 @@ public:
     setArraySize(newDimensions);
   }
 
+  /**
+   * Frees the cache array, it is created again by the next call to setMapSize().
+   */
+  void releaseCache()
+  {
+    if (cacheArray != 0) {
+      deleteCacheArray();
+      cacheArray = 0;
+    }
+
+    arrayDimensions = Eigen::Vector2i(-1,-1);
+  }
+
 protected:
 
   /**
@@ -125,11 +143,7 @@ protected:
 
     int size = sizeX * sizeY;
 
-    cacheArray = new CachedMapElement [size];
-
-    for (int x = 0; x < size; ++x) {
-      cacheArray[x].index = -1;
-    }
+    cacheArray = static_cast<CachedMapElement*>(calloc(size, sizeof(CachedMapElement)));
   }
 
   /**
@@ -137,7 +151,7 @@ protected:
    */
   void deleteCacheArray()
   {
-    delete[] cacheArray;
+    free(cacheArray);
   }
 
   /**
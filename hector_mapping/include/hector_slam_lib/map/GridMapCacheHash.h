@@ -0,0 +1,223 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapCacheHash_h_
+#define __GridMapCacheHash_h_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+/**
+ * Caches filtered grid map accesses in a fixed size open addressing hash table with linear probing. Entries are
+ * tagged with the cache epoch they were written in, so resetting the cache only increments the epoch. Memory does
+ * not depend on the map size; once the table is filled to its maximum load, further values are not cached.
+ */
+class GridMapCacheHash
+{
+public:
+
+  /**
+   * Constructor
+   * @param capacityLog2 The table holds 2^capacityLog2 entries
+   */
+  GridMapCacheHash(int capacityLog2 = 14)
+    : hashTable(0)
+    , capacityLog2(0)
+    , capacityMask(0)
+    , maxNumEntries(0)
+    , numEntries(0)
+    , currCacheEpoch(1)
+  {
+    setCapacity(capacityLog2);
+  }
+
+  /**
+   * Destructor
+   */
+  ~GridMapCacheHash()
+  {
+    free(hashTable);
+  }
+
+  /**
+   * Resets/deletes the cached data
+   */
+  void resetCache()
+  {
+    //entries of all earlier epochs are invalid, epoch 0 marks never used entries
+    if (currCacheEpoch == std::numeric_limits<int>::max()) {
+      clearTable();
+    } else {
+      currCacheEpoch++;
+    }
+
+    numEntries = 0;
+  }
+
+  /**
+   * Checks wether cached data for index is available. If this is the case, writes data into val.
+   * @param index The storage index of the cell
+   * @param val Reference to a float the data is written to if available
+   * @return Indicates if cached data is available
+   */
+  bool containsCachedData(int index, float& val) const
+  {
+    unsigned int slot = getSlot(index);
+
+    //entries are never removed within an epoch, so the first unused slot ends the probe sequence
+    while (hashTable[slot].epoch == currCacheEpoch) {
+      if (hashTable[slot].index == index) {
+        val = hashTable[slot].val;
+        return true;
+      }
+
+      slot = (slot + 1) & capacityMask;
+    }
+
+    return false;
+  }
+
+  /**
+   * Caches float value val for index, if the table is not full yet. Must only be called for indices that are not
+   * cached already.
+   * @param index The storage index of the cell
+   * @param val The value to be cached for index
+   */
+  void cacheData(int index, float val)
+  {
+    if (numEntries >= maxNumEntries) {
+      return;
+    }
+
+    unsigned int slot = getSlot(index);
+
+    while (hashTable[slot].epoch == currCacheEpoch) {
+      slot = (slot + 1) & capacityMask;
+    }
+
+    HashElement& elem (hashTable[slot]);
+    elem.index = index;
+    elem.epoch = currCacheEpoch;
+    elem.val = val;
+
+    numEntries++;
+  }
+
+  /**
+   * The table size does not depend on the map size.
+   */
+  void setMapSize(const Eigen::Vector2i& /*newDimensions*/)
+  {}
+
+  /**
+   * Sets the number of table entries to 2^capacityLog2, invalidating all cached data. The table is filled to at
+   * most 3/4 to keep probe sequences short. If the table cannot be allocated, the capacity is halved until it can.
+   * Throws std::bad_alloc if not even the smallest table can be allocated.
+   */
+  void setCapacity(int capacityLogTwo)
+  {
+    capacityLogTwo = std::min(std::max(capacityLogTwo, 1), 30);
+
+    if (capacityLogTwo == capacityLog2) {
+      return;
+    }
+
+    free(hashTable);
+    hashTable = 0;
+
+    for (; !hashTable && (capacityLogTwo >= 1); --capacityLogTwo) {
+      hashTable = static_cast<HashElement*>(malloc((static_cast<size_t>(1) << capacityLogTwo) * sizeof(HashElement)));
+    }
+
+    if (!hashTable) {
+      capacityLog2 = 0;
+      throw std::bad_alloc();
+    }
+
+    capacityLog2 = capacityLogTwo + 1;
+    capacityMask = (1u << capacityLog2) - 1;
+    maxNumEntries = static_cast<int>((static_cast<size_t>(capacityMask) + 1) / 4 * 3);
+
+    clearTable();
+  }
+
+  /**
+   * Frees the table, it is allocated again by the next call to setCapacity().
+   */
+  void releaseCache()
+  {
+    free(hashTable);
+    hashTable = 0;
+    capacityLog2 = 0;
+  }
+
+protected:
+
+  class HashElement
+  {
+  public:
+    int index;
+    int epoch;
+    float val;
+  };
+
+  /**
+   * Fibonacci hashing, spreads the neighboring indices accessed by bilinear filtering over the table.
+   */
+  unsigned int getSlot(int index) const
+  {
+    return (static_cast<unsigned int>(index) * 2654435769u) >> (32 - capacityLog2);
+  }
+
+  void clearTable()
+  {
+    for (unsigned int i = 0; i <= capacityMask; ++i) {
+      hashTable[i].epoch = 0;
+    }
+
+    currCacheEpoch = 1;
+    numEntries = 0;
+  }
+
+protected:
+
+  HashElement* hashTable;     ///< Table used for caching data.
+  int capacityLog2;           ///< Log2 of the number of table entries
+  unsigned int capacityMask;  ///< Number of table entries - 1
+  int maxNumEntries;          ///< Maximum number of entries per epoch
+  int numEntries;             ///< Number of entries written in the current epoch
+  int currCacheEpoch;         ///< The cache epoch value
+
+};
+
+
+#endif
@@ -0,0 +1,119 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapCacheSelectable_h_
+#define __GridMapCacheSelectable_h_
+
+#include "GridMapCacheArray.h"
+#include "GridMapCacheHash.h"
+
+/**
+ * Cache that can be switched between GridMapCacheArray and GridMapCacheHash at runtime. Only the selected cache
+ * holds memory. The array cache is the default unless SLAM_USE_HASH_CACHING is defined.
+ */
+class GridMapCacheSelectable
+{
+public:
+
+  GridMapCacheSelectable()
+#ifdef SLAM_USE_HASH_CACHING
+    : useHashCache(true)
+#else
+    : useHashCache(false)
+#endif
+    , mapDimensions(-1,-1)
+  {
+    if (!useHashCache) {
+      hashCache.releaseCache();
+    }
+  }
+
+  void resetCache()
+  {
+    if (useHashCache) {
+      hashCache.resetCache();
+    } else {
+      arrayCache.resetCache();
+    }
+  }
+
+  bool containsCachedData(int index, float& val)
+  {
+    return useHashCache ? hashCache.containsCachedData(index, val) : arrayCache.containsCachedData(index, val);
+  }
+
+  void cacheData(int index, float val)
+  {
+    if (useHashCache) {
+      hashCache.cacheData(index, val);
+    } else {
+      arrayCache.cacheData(index, val);
+    }
+  }
+
+  void setMapSize(const Eigen::Vector2i& newDimensions)
+  {
+    mapDimensions = newDimensions;
+
+    if (!useHashCache) {
+      arrayCache.setMapSize(newDimensions);
+    }
+  }
+
+  /**
+   * Selects the hash cache (with 2^capacityLog2 entries) or the array cache. Switching invalidates all cached data.
+   */
+  void setUseHashCache(bool enabled, int capacityLog2 = 14)
+  {
+    if (enabled) {
+      arrayCache.releaseCache();
+      hashCache.setCapacity(capacityLog2);
+      hashCache.resetCache();
+    } else if (useHashCache) {
+      hashCache.releaseCache();
+
+      if (mapDimensions.x() >= 0) {
+        arrayCache.setMapSize(mapDimensions);
+      }
+    }
+
+    useHashCache = enabled;
+  }
+
+  bool getUseHashCache() const { return useHashCache; };
+
+protected:
+
+  bool useHashCache;
+  Eigen::Vector2i mapDimensions;
+
+  GridMapCacheArray arrayCache;
+  GridMapCacheHash hashCache;
+};
+
+#endif
@@ -0,0 +1,376 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapFile_h_
+#define __GridMapFile_h_
+
+#include <Eigen/Core>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MapDimensionProperties.h"
+
+namespace hectorslam {
+
+/**
+ * On-disk layout of a saved map stack. The file starts with a GridMapFileHeader, followed by one GridMapFileLevel per
+ * map level and the cells of every level in row-major order, each level starting at a multiple of 64 bytes. Cells
+ * are stored as raw bytes in native byte order, loading requires the same cell type. The version is increased
+ * whenever the layout changes.
+ */
+struct GridMapFileHeader
+{
+  enum { Version = 1 };
+
+  char magic[8];     ///< "HSLAMMAP"
+  uint32_t version;
+  uint32_t cellSize; ///< sizeof the cell type
+  uint32_t numLevels;
+  float pose[3];     ///< Last robot pose in world coordinates (x, y, yaw)
+};
+
+struct GridMapFileLevel
+{
+  float cellLength;
+  float topLeftOffset[2];
+  int32_t sizeX;
+  int32_t sizeY;
+  uint32_t reserved;
+  uint64_t cellDataOffset; ///< Offset of the first cell from the beginning of the file
+};
+
+/**
+ * Collects copies of map levels and the robot pose and writes them to a map file. Copying is fast, so it can happen
+ * while holding the map locks, the slow part of writing the file does not need access to the maps any more.
+ */
+class GridMapFileWriter
+{
+public:
+
+  GridMapFileWriter()
+    : pose(Eigen::Vector3f::Zero())
+    , cellSize(0)
+  {}
+
+  /**
+   * Appends a copy of map as the next level. All levels need to have the same cell type. Update markers are
+   * replaced by those of the prior cell, they have no meaning outside of the running map.
+   */
+  template<typename ConcreteGridMap>
+  void addLevel(const ConcreteGridMap& map)
+  {
+    typedef typename ConcreteGridMap::CellType CellType;
+
+    cellSize = sizeof(CellType);
+
+    const MapDimensionProperties& dimProperties (map.getMapDimProperties());
+
+    GridMapFileLevel level;
+    std::memset(&level, 0, sizeof(level));
+    level.cellLength = dimProperties.getCellLength();
+    level.topLeftOffset[0] = dimProperties.getTopLeftOffset().x();
+    level.topLeftOffset[1] = dimProperties.getTopLeftOffset().y();
+    level.sizeX = map.getSizeX();
+    level.sizeY = map.getSizeY();
+    levels.push_back(level);
+
+    CellType priorCell;
+    priorCell.resetGridCell();
+
+    int numCells = level.sizeX * level.sizeY;
+
+    cellData.push_back(std::vector<char>(static_cast<size_t>(numCells) * sizeof(CellType)));
+    CellType* cells = reinterpret_cast<CellType*>(cellData.back().data());
+
+    for (int i = 0; i < numCells; ++i) {
+      cells[i] = map.getCell(i);
+      cells[i].updateIndex = priorCell.updateIndex;
+    }
+  }
+
+  void setPose(const Eigen::Vector3f& poseIn) { pose = poseIn; };
+
+  int getNumLevels() const { return static_cast<int>(levels.size()); };
+
+  /**
+   * Writes the file. The data goes to a temporary file first, which then replaces fileName, so a crash while saving
+   * never leaves a truncated map behind.
+   * @return False if the file could not be written
+   */
+  bool write(const std::string& fileName) const
+  {
+    GridMapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "HSLAMMAP", sizeof(header.magic));
+    header.version = GridMapFileHeader::Version;
+    header.cellSize = static_cast<uint32_t>(cellSize);
+    header.numLevels = static_cast<uint32_t>(levels.size());
+    header.pose[0] = pose.x();
+    header.pose[1] = pose.y();
+    header.pose[2] = pose.z();
+
+    std::vector<GridMapFileLevel> fileLevels (levels);
+    uint64_t offset = alignOffset(sizeof(header) + fileLevels.size() * sizeof(GridMapFileLevel));
+
+    for (size_t i = 0; i < fileLevels.size(); ++i) {
+      fileLevels[i].cellDataOffset = offset;
+      offset = alignOffset(offset + cellData[i].size());
+    }
+
+    std::string tempFileName (fileName + ".tmp");
+    FILE* file = std::fopen(tempFileName.c_str(), "wb");
+
+    if (!file) {
+      return false;
+    }
+
+    bool ok = (std::fwrite(&header, sizeof(header), 1, file) == 1);
+
+    if (!fileLevels.empty()) {
+      ok = ok && (std::fwrite(fileLevels.data(), sizeof(GridMapFileLevel), fileLevels.size(), file) == fileLevels.size());
+    }
+
+    for (size_t i = 0; ok && (i < fileLevels.size()); ++i) {
+      ok = (std::fseek(file, static_cast<long>(fileLevels[i].cellDataOffset), SEEK_SET) == 0) &&
+           (std::fwrite(cellData[i].data(), 1, cellData[i].size(), file) == cellData[i].size());
+    }
+
+    ok = (std::fflush(file) == 0) && ok;
+    ok = ok && (fsync(fileno(file)) == 0);
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || (std::rename(tempFileName.c_str(), fileName.c_str()) != 0)) {
+      std::remove(tempFileName.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+protected:
+
+  static uint64_t alignOffset(uint64_t offset)
+  {
+    return (offset + 63) & ~static_cast<uint64_t>(63);
+  }
+
+  std::vector<GridMapFileLevel> levels;
+  std::vector<std::vector<char> > cellData;
+  Eigen::Vector3f pose;
+  size_t cellSize;
+};
+
+/**
+ * Reads a map file written by GridMapFileWriter. The file is memory mapped and validated on open, readLevel() then
+ * compares every cell of a level against the prior and copies the known ones into the map's own storage.
+ */
+class GridMapFileReader
+{
+public:
+
+  GridMapFileReader()
+    : data(0)
+    , dataSize(0)
+  {}
+
+  ~GridMapFileReader()
+  {
+    close();
+  }
+
+  GridMapFileReader(const GridMapFileReader&) = delete;
+  GridMapFileReader& operator=(const GridMapFileReader&) = delete;
+
+  /**
+   * Maps the file and validates its header and level table.
+   * @return False if the file does not exist or is not a valid map file of the current version
+   */
+  bool open(const std::string& fileName)
+  {
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat fileStat;
+
+    if ((fstat(fd, &fileStat) == 0) && (fileStat.st_size >= static_cast<off_t>(sizeof(GridMapFileHeader)))) {
+      void* mapped = mmap(0, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (mapped != MAP_FAILED) {
+        data = static_cast<const char*>(mapped);
+        dataSize = static_cast<size_t>(fileStat.st_size);
+      }
+    }
+
+    ::close(fd);
+
+    if (!data || !isValid()) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void close()
+  {
+    if (data) {
+      munmap(const_cast<char*>(data), dataSize);
+      data = 0;
+      dataSize = 0;
+    }
+  }
+
+  bool isOpen() const { return data != 0; };
+
+  int getNumLevels() const { return static_cast<int>(getHeader().numLevels); };
+  int getCellSize() const { return static_cast<int>(getHeader().cellSize); };
+
+  Eigen::Vector3f getPose() const
+  {
+    const GridMapFileHeader& header (getHeader());
+    return Eigen::Vector3f(header.pose[0], header.pose[1], header.pose[2]);
+  }
+
+  MapDimensionProperties getLevelDimProperties(int level) const
+  {
+    const GridMapFileLevel& fileLevel (getLevel(level));
+    return MapDimensionProperties(Eigen::Vector2f(fileLevel.topLeftOffset[0], fileLevel.topLeftOffset[1]),
+                                  Eigen::Vector2i(fileLevel.sizeX, fileLevel.sizeY), fileLevel.cellLength);
+  }
+
+  /**
+   * Whether the given level can be loaded into map: it needs the same cell type, dimensions and transformation.
+   */
+  template<typename ConcreteGridMap>
+  bool fitsLevel(int level, const ConcreteGridMap& map) const
+  {
+    if ((level < 0) || (level >= getNumLevels()) || (sizeof(typename ConcreteGridMap::CellType) != getHeader().cellSize)) {
+      return false;
+    }
+
+    const GridMapFileLevel& fileLevel (getLevel(level));
+    const MapDimensionProperties& dimProperties (map.getMapDimProperties());
+
+    float offsetTolerance = 1e-3f * fileLevel.cellLength;
+
+    return (map.getSizeX() == fileLevel.sizeX) && (map.getSizeY() == fileLevel.sizeY) &&
+           (std::fabs(dimProperties.getCellLength() - fileLevel.cellLength) <= 1e-6f * fileLevel.cellLength) &&
+           (std::fabs(dimProperties.getTopLeftOffset().x() - fileLevel.topLeftOffset[0]) <= offsetTolerance) &&
+           (std::fabs(dimProperties.getTopLeftOffset().y() - fileLevel.topLeftOffset[1]) <= offsetTolerance);
+  }
+
+  /**
+   * Replaces the cells of map with those of the given level, see fitsLevel(). Cells still at the prior are not
+   * written, so sparse maps only allocate the chunks that hold known cells.
+   * @return False if the level does not fit map, which stays untouched then
+   */
+  template<typename ConcreteGridMap>
+  bool readLevel(int level, ConcreteGridMap& map) const
+  {
+    typedef typename ConcreteGridMap::CellType CellType;
+
+    if (!fitsLevel(level, map)) {
+      return false;
+    }
+
+    const GridMapFileLevel& fileLevel (getLevel(level));
+
+    map.reset();
+
+    CellType priorCell;
+    std::memset(&priorCell, 0, sizeof(priorCell));
+    priorCell.resetGridCell();
+
+    const char* cells = data + fileLevel.cellDataOffset;
+    int numCells = fileLevel.sizeX * fileLevel.sizeY;
+
+    for (int i = 0; i < numCells; ++i, cells += sizeof(CellType)) {
+      if (std::memcmp(cells, &priorCell, sizeof(CellType)) != 0) {
+        std::memcpy(&map.getCell(i), cells, sizeof(CellType));
+      }
+    }
+
+    map.onCellsReplaced();
+    return true;
+  }
+
+protected:
+
+  const GridMapFileHeader& getHeader() const { return *reinterpret_cast<const GridMapFileHeader*>(data); };
+
+  const GridMapFileLevel& getLevel(int level) const
+  {
+    return reinterpret_cast<const GridMapFileLevel*>(data + sizeof(GridMapFileHeader))[level];
+  }
+
+  bool isValid() const
+  {
+    const GridMapFileHeader& header (getHeader());
+
+    if ((std::memcmp(header.magic, "HSLAMMAP", sizeof(header.magic)) != 0) ||
+        (header.version != GridMapFileHeader::Version) || (header.cellSize == 0) ||
+        (dataSize < sizeof(GridMapFileHeader) + static_cast<uint64_t>(header.numLevels) * sizeof(GridMapFileLevel))) {
+      return false;
+    }
+
+    for (int i = 0; i < static_cast<int>(header.numLevels); ++i) {
+      const GridMapFileLevel& level (getLevel(i));
+
+      if ((level.sizeX <= 0) || (level.sizeY <= 0) || !(level.cellLength > 0.0f) ||
+          (level.cellDataOffset % 64 != 0) || (level.cellDataOffset > dataSize) ||
+          (static_cast<uint64_t>(level.sizeX) * static_cast<uint64_t>(level.sizeY) * header.cellSize >
+           dataSize - level.cellDataOffset)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  const char* data;
+  size_t dataSize;
+};
+
+}
+
+#endif
@@ -0,0 +1,278 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapLayout_h_
+#define __GridMapLayout_h_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+
+#include "GridMapStorage.h"
+
+namespace hectorslam {
+
+/**
+ * Cell layouts map 2D grid coordinates to positions in the cell array of GridMapBase. Besides (x,y) lookups, every
+ * layout supports conversion from the linear row-major index used by the index based map API (getCell(int),
+ * isOccupied(int), ...) and returns the storage indices of a 2x2 neighborhood for bilinear interpolation. The nested
+ * CellStorage template selects the container holding the cells (see GridMapStorage.h). Bands of RowAlignment rows
+ * never share storage blocks, so they can be written concurrently.
+ */
+
+/**
+ * Plain row-major layout, storage indices are identical to linear indices.
+ */
+class GridMapLayoutRowMajor
+{
+public:
+
+  enum { IsLinear = 1 };
+  enum { RowAlignment = 1 };
+
+  template<typename ConcreteCellType>
+  struct CellStorage { typedef GridMapDenseStorage<ConcreteCellType> type; };
+
+  GridMapLayoutRowMajor()
+    : sizeX(0)
+    , sizeY(0)
+  {}
+
+  void setDimensions(const Eigen::Vector2i& dims)
+  {
+    sizeX = dims.x();
+    sizeY = dims.y();
+  }
+
+  Eigen::Vector2i getStorageDimensions() const { return Eigen::Vector2i(sizeX, sizeY); };
+  int getNumStorageCells() const { return sizeX * sizeY; };
+
+  int getIndex(int x, int y) const
+  {
+    return y * sizeX + x;
+  }
+
+  int getIndexFromLinear(int linearIndex) const
+  {
+    return linearIndex;
+  }
+
+  /**
+   * Number of cells of a row starting at column x whose storage indices are consecutive.
+   */
+  int getRunLength(int x) const
+  {
+    return sizeX - x;
+  }
+
+  /**
+   * Writes the storage indices of (x,y), (x+1,y), (x,y+1) and (x+1,y+1) to indices.
+   */
+  void getNeighborhoodIndices(int x, int y, int* indices) const
+  {
+    indices[0] = y * sizeX + x;
+    indices[1] = indices[0] + 1;
+    indices[2] = indices[0] + sizeX;
+    indices[3] = indices[2] + 1;
+  }
+
+  /**
+   * Writes the bounding box (inclusive, in map cells) of the part of the map backed by memory to minCell and maxCell.
+   * @return False if no part of the map is allocated
+   */
+  template<typename ConcreteCellStorage>
+  bool getAllocatedBounds(const ConcreteCellStorage& storage, Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    minCell = Eigen::Vector2i::Zero();
+    maxCell = Eigen::Vector2i(sizeX - 1, sizeY - 1);
+    return storage.isAllocated();
+  }
+
+protected:
+  int sizeX;
+  int sizeY;
+};
+
+/**
+ * Blocked layout storing the map as square tiles of 2^TileSizeLog2 cells edge length, so that cells that are close
+ * in both x and y share cache lines and pages. Tiles are stored row-major; inside a tile cells are either row-major
+ * or, with MortonOrder set, in Z-order. The storage is padded to full tiles.
+ */
+template<int TileSizeLog2, bool MortonOrder = false>
+class GridMapLayoutTiled
+{
+public:
+
+  enum { IsLinear = 0 };
+  enum { TileSize = 1 << TileSizeLog2 };
+  enum { TileMask = TileSize - 1 };
+  enum { TileCells = TileSize * TileSize };
+  enum { RowAlignment = TileSize };
+
+  template<typename ConcreteCellType>
+  struct CellStorage { typedef GridMapDenseStorage<ConcreteCellType> type; };
+
+  GridMapLayoutTiled()
+    : sizeX(0)
+    , sizeY(0)
+    , tilesX(0)
+    , tilesY(0)
+  {}
+
+  void setDimensions(const Eigen::Vector2i& dims)
+  {
+    sizeX = dims.x();
+    sizeY = dims.y();
+    tilesX = (dims.x() + TileMask) >> TileSizeLog2;
+    tilesY = (dims.y() + TileMask) >> TileSizeLog2;
+  }
+
+  Eigen::Vector2i getStorageDimensions() const { return Eigen::Vector2i(tilesX << TileSizeLog2, tilesY << TileSizeLog2); };
+  int getNumStorageCells() const { return tilesX * tilesY * TileCells; };
+
+  int getIndex(int x, int y) const
+  {
+    int tileIndex = (y >> TileSizeLog2) * tilesX + (x >> TileSizeLog2);
+    return (tileIndex << (2 * TileSizeLog2)) + getIndexInTile(x & TileMask, y & TileMask);
+  }
+
+  int getIndexFromLinear(int linearIndex) const
+  {
+    return getIndex(linearIndex % sizeX, linearIndex / sizeX);
+  }
+
+  int getRunLength(int x) const
+  {
+    if (MortonOrder) {
+      return 1;
+    }
+
+    return std::min(TileSize - (x & TileMask), sizeX - x);
+  }
+
+  void getNeighborhoodIndices(int x, int y, int* indices) const
+  {
+    indices[0] = getIndex(x, y);
+
+    //common case: the 2x2 neighborhood lies inside one row-major tile
+    if (!MortonOrder && ((x & TileMask) != TileMask) && ((y & TileMask) != TileMask)) {
+      indices[1] = indices[0] + 1;
+      indices[2] = indices[0] + TileSize;
+      indices[3] = indices[2] + 1;
+    } else {
+      indices[1] = getIndex(x + 1, y);
+      indices[2] = getIndex(x, y + 1);
+      indices[3] = getIndex(x + 1, y + 1);
+    }
+  }
+
+  template<typename ConcreteCellStorage>
+  bool getAllocatedBounds(const ConcreteCellStorage& storage, Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    minCell = Eigen::Vector2i::Zero();
+    maxCell = Eigen::Vector2i(sizeX - 1, sizeY - 1);
+    return storage.isAllocated();
+  }
+
+protected:
+
+  static int getIndexInTile(int tileX, int tileY)
+  {
+    if (MortonOrder) {
+      return spreadBits(tileX) | (spreadBits(tileY) << 1);
+    } else {
+      return (tileY << TileSizeLog2) + tileX;
+    }
+  }
+
+  /**
+   * Inserts a zero bit between each of the lower 16 bits of val.
+   */
+  static int spreadBits(int val)
+  {
+    val = (val | (val << 8)) & 0x00FF00FF;
+    val = (val | (val << 4)) & 0x0F0F0F0F;
+    val = (val | (val << 2)) & 0x33333333;
+    val = (val | (val << 1)) & 0x55555555;
+    return val;
+  }
+
+  int sizeX;
+  int sizeY;
+  int tilesX;
+  int tilesY;
+};
+
+/**
+ * Sparse layout for large maps that are mostly unexplored. Cells are arranged in row-major tiles of 2^ChunkSizeLog2
+ * cells edge length like in GridMapLayoutTiled, but every tile is a separately allocated chunk of a
+ * GridMapChunkedStorage that only gets allocated once a cell inside of it is written. The up front cost per map is
+ * one pointer per tile, so the map size can be chosen generously.
+ */
+template<int ChunkSizeLog2 = 6>
+class GridMapLayoutSparse
+  : public GridMapLayoutTiled<ChunkSizeLog2>
+{
+public:
+
+  template<typename ConcreteCellType>
+  struct CellStorage { typedef GridMapChunkedStorage<ConcreteCellType, 2 * ChunkSizeLog2> type; };
+
+  /**
+   * Bounds of all allocated chunks, clipped to the map dimensions.
+   */
+  template<typename ConcreteCellStorage>
+  bool getAllocatedBounds(const ConcreteCellStorage& storage, Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    Eigen::Vector2i minChunk (this->tilesX, this->tilesY);
+    Eigen::Vector2i maxChunk (-1, -1);
+
+    int numChunks = storage.getNumChunks();
+
+    for (int i = 0; i < numChunks; ++i) {
+      if (storage.isChunkAllocated(i)) {
+        Eigen::Vector2i chunk (i % this->tilesX, i / this->tilesX);
+        minChunk = minChunk.cwiseMin(chunk);
+        maxChunk = maxChunk.cwiseMax(chunk);
+      }
+    }
+
+    if (maxChunk.x() < 0) {
+      return false;
+    }
+
+    minCell = minChunk * static_cast<int>(this->TileSize);
+    maxCell = ((maxChunk.array() + 1) * static_cast<int>(this->TileSize) - 1).matrix()
+                .cwiseMin(Eigen::Vector2i(this->sizeX - 1, this->sizeY - 1));
+    return true;
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,287 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapLikelihoodField_h_
+#define __GridMapLikelihoodField_h_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace hectorslam {
+
+/**
+ * Cell of the likelihood field. Unexplored and free space far from obstacles has likelihood 0.
+ */
+class LikelihoodFieldCell
+{
+public:
+
+  void resetGridCell()
+  {
+    likelihood = 0.0f;
+  }
+
+  float likelihood;
+};
+
+/**
+ * Gaussian likelihood field of an occupancy grid map: every cell holds exp(-d^2 / (2 sigma^2)), d being the distance
+ * (in cells) to the nearest occupied cell, truncated to zero beyond 3 sigma. Scan matching against the field instead
+ * of the occupancy probabilities has a wider and smoother basin of convergence.
+ * The field is indexed by storage index like the map. It is refreshed incrementally from the bounding box of the
+ * cells changed by the map updates since the last refresh, as only cells within the truncation radius of it can
+ * change. When the field is refreshed less often than the map is updated, addMapUpdate() has to collect the bounds of
+ * every update in between.
+ */
+template<typename ConcreteOccGridMap>
+class GridMapLikelihoodField
+{
+public:
+
+  typedef typename ConcreteOccGridMap::CellLayout::template CellStorage<LikelihoodFieldCell>::type LikelihoodFieldStorage;
+
+  GridMapLikelihoodField(float sigma = 1.0f)
+    : fieldStorageSize(-1)
+    , mapUpdateIndex(-1)
+    , valid(false)
+  {
+    clearChangedBounds();
+    setSigma(sigma);
+  }
+
+  /**
+   * Sets the standard deviation of the Gaussian in cells, invalidating the field.
+   */
+  void setSigma(float sigma)
+  {
+    radius = std::max(static_cast<int>(std::ceil(3.0f * sigma)), 1);
+
+    int maxSqrDist = radius * radius;
+    likelihoodBySqrDist.resize(maxSqrDist + 1);
+
+    for (int i = 0; i <= maxSqrDist; ++i) {
+      likelihoodBySqrDist[i] = std::exp(-static_cast<float>(i) / (2.0f * sigma * sigma));
+    }
+
+    invalidate();
+  }
+
+  /**
+   * Makes the next call to update() recompute the whole field, e.g. after the map has been reset.
+   */
+  void invalidate()
+  {
+    valid = false;
+  }
+
+  /**
+   * Adds the cells changed by the last update of map to the box refreshed by the next update(). Has to be called
+   * after every map update that is not directly followed by update(), otherwise the field is recomputed completely.
+   */
+  void addMapUpdate(const ConcreteOccGridMap& map)
+  {
+    if (!valid || (map.getUpdateIndex() == mapUpdateIndex)) {
+      return;
+    }
+
+    //a map update has been missed, its changed cells are unknown
+    if ((map.getUpdateIndex() != mapUpdateIndex + 1) || (fieldStorageSize != map.getNumStorageCells())) {
+      invalidate();
+      return;
+    }
+
+    Eigen::Vector2i minCell, maxCell;
+
+    if (map.getLastUpdateBounds(minCell, maxCell)) {
+      changedMin = changedMin.cwiseMin(minCell);
+      changedMax = changedMax.cwiseMax(maxCell);
+    }
+
+    mapUpdateIndex = map.getUpdateIndex();
+  }
+
+  /**
+   * Brings the field up to date with the map. Recomputes only around the cells changed since the last call (see
+   * addMapUpdate()), and the whole field after invalidate() or if a map update has been missed.
+   */
+  void update(const ConcreteOccGridMap& map)
+  {
+    int numStorageCells = map.getNumStorageCells();
+
+    if (fieldStorageSize != numStorageCells) {
+      invalidate();
+    }
+
+    addMapUpdate(map);
+
+    Eigen::Vector2i minCell, maxCell;
+
+    if (valid) {
+      if ((changedMin.array() <= changedMax.array()).all()) {
+        minCell = changedMin.array() - radius;
+        maxCell = changedMax.array() + radius;
+        updateRegion(map, minCell, maxCell);
+        clearChangedBounds();
+      }
+
+      return;
+    }
+
+    if (fieldStorageSize != numStorageCells) {
+      field.release();
+      field.allocate(numStorageCells);
+      fieldStorageSize = numStorageCells;
+    }
+
+    field.resetCells();
+
+    if (map.getAllocatedBounds(minCell, maxCell)) {
+      minCell.array() -= radius;
+      maxCell.array() += radius;
+      updateRegion(map, minCell, maxCell);
+    }
+
+    mapUpdateIndex = map.getUpdateIndex();
+    clearChangedBounds();
+    valid = true;
+  }
+
+  /**
+   * Returns the field, indexed by storage index of the map. Only valid after update().
+   */
+  const LikelihoodFieldStorage& getField() const { return field; };
+
+protected:
+
+  void clearChangedBounds()
+  {
+    changedMin = Eigen::Vector2i(std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+    changedMax = Eigen::Vector2i(-1, -1);
+  }
+
+  /**
+   * Recomputes the field in the inclusive cell box [minCell, maxCell] with a separable truncated distance transform:
+   * horizontal distances to the nearest occupied cell per row first, then the minimum of dy^2 + dx^2 over the column
+   * neighborhood.
+   */
+  void updateRegion(const ConcreteOccGridMap& map, Eigen::Vector2i minCell, Eigen::Vector2i maxCell)
+  {
+    minCell = minCell.cwiseMax(Eigen::Vector2i::Zero());
+    maxCell = maxCell.cwiseMin(map.getMapDimensions() - Eigen::Vector2i::Ones());
+
+    if ((minCell.array() > maxCell.array()).any()) {
+      return;
+    }
+
+    int width = maxCell.x() - minCell.x() + 1;
+
+    //rows needed for the vertical pass
+    int rowBegin = std::max(minCell.y() - radius, 0);
+    int rowEnd = std::min(maxCell.y() + radius + 1, map.getSizeY());
+
+    //columns read for the horizontal pass
+    int colBegin = std::max(minCell.x() - radius, 0);
+    int colEnd = std::min(maxCell.x() + radius + 1, map.getSizeX());
+
+    int noObstacle = radius + 1;
+
+    rowDists.resize(static_cast<size_t>(rowEnd - rowBegin) * width);
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+      int* dists = &rowDists[static_cast<size_t>(y - rowBegin) * width];
+
+      //distance to the nearest occupied cell on the left, then on the right
+      int dist = noObstacle;
+
+      for (int x = colBegin; x <= maxCell.x(); ++x) {
+        dist = map.isOccupied(x, y) ? 0 : std::min(dist + 1, noObstacle);
+
+        if (x >= minCell.x()) {
+          dists[x - minCell.x()] = dist;
+        }
+      }
+
+      dist = noObstacle;
+
+      for (int x = colEnd - 1; x >= minCell.x(); --x) {
+        dist = map.isOccupied(x, y) ? 0 : std::min(dist + 1, noObstacle);
+
+        if (x <= maxCell.x()) {
+          int& rowDist (dists[x - minCell.x()]);
+          rowDist = std::min(rowDist, dist);
+        }
+      }
+    }
+
+    int maxSqrDist = radius * radius;
+    const LikelihoodFieldStorage& constField (field);
+
+    for (int y = minCell.y(); y <= maxCell.y(); ++y) {
+      int dyBegin = std::max(y - radius, rowBegin) - y;
+      int dyEnd = std::min(y + radius + 1, rowEnd) - y;
+
+      for (int x = minCell.x(); x <= maxCell.x(); ++x) {
+        int sqrDist = maxSqrDist + 1;
+
+        for (int dy = dyBegin; dy < dyEnd; ++dy) {
+          int rowDist = rowDists[static_cast<size_t>(y + dy - rowBegin) * width + (x - minCell.x())];
+          sqrDist = std::min(sqrDist, dy * dy + rowDist * rowDist);
+        }
+
+        float likelihood = (sqrDist <= maxSqrDist) ? likelihoodBySqrDist[sqrDist] : 0.0f;
+
+        //compare through the const storage first, so sparse fields only allocate near obstacles
+        int storageIndex = map.getStorageIndex(x, y);
+
+        if (constField[storageIndex].likelihood != likelihood) {
+          field[storageIndex].likelihood = likelihood;
+        }
+      }
+    }
+  }
+
+  LikelihoodFieldStorage field;
+  int fieldStorageSize;
+
+  int radius;                              ///< Truncation radius in cells
+  std::vector<float> likelihoodBySqrDist;  ///< Field value by squared distance in cells up to radius^2
+  std::vector<int> rowDists;               ///< Scratch buffer of the horizontal pass
+
+  int mapUpdateIndex;                      ///< Update index of the last map update in the field or the changed box
+  Eigen::Vector2i changedMin;              ///< Inclusive box of the cells changed since the field was last refreshed
+  Eigen::Vector2i changedMax;
+  bool valid;
+};
+
+}
+
+#endif
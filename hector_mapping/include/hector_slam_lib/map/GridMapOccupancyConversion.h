@@ -0,0 +1,235 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapOccupancyConversion_h_
+#define __GridMapOccupancyConversion_h_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+#include "GridMapLogOdds.h"
+#include "OccGridMapUtilSimd.h"
+#include "../util/WorkerPool.h"
+
+namespace hectorslam {
+
+/**
+ * Converts runs of cells to occupancy values as used by nav_msgs/OccupancyGrid: -1 unknown, 0 free, 100 occupied.
+ * The generic version works for every cell type, specializations use vector instructions.
+ */
+template<typename ConcreteCellType>
+struct OccupancyConversion
+{
+  static void convert(const ConcreteCellType* cells, int numCells, int8_t* dst)
+  {
+    for (int i = 0; i < numCells; ++i) {
+      dst[i] = cells[i].isFree() ? 0 : (cells[i].isOccupied() ? 100 : -1);
+    }
+  }
+};
+
+#if defined(SLAM_SIMD_AVX2)
+
+namespace simd {
+
+/**
+ * Converts 8 log odds cells per step and returns the number of cells converted. Log odds values and update indices
+ * are interleaved in memory, the values of two loads are gathered by a shuffle.
+ */
+__attribute__((target("avx2")))
+inline int convertLogOddsCellsAvx2(const LogOddsCell* cells, int numCells, int8_t* dst)
+{
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256i unknownVal = _mm256_set1_epi32(-1);
+  const __m256i freeInc = _mm256_set1_epi32(1);
+  const __m256i occupiedInc = _mm256_set1_epi32(101);
+
+  const float* values = &cells[0].logOddsVal;
+
+  int i = 0;
+
+  for (; i + 8 <= numCells; i += 8) {
+    __m256 a = _mm256_loadu_ps(values + 2 * i);
+    __m256 b = _mm256_loadu_ps(values + 2 * i + 8);
+
+    //Shuffle yields cells 0 1 4 5 2 3 6 7, the permute restores the order
+    __m256 v = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+
+    __m256i isFree = _mm256_castps_si256(_mm256_cmp_ps(v, zero, _CMP_LT_OQ));
+    __m256i isOccupied = _mm256_castps_si256(_mm256_cmp_ps(v, zero, _CMP_GT_OQ));
+
+    __m256i result = _mm256_add_epi32(unknownVal, _mm256_add_epi32(_mm256_and_si256(isFree, freeInc),
+                                                                   _mm256_and_si256(isOccupied, occupiedInc)));
+
+    __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi16(words, words));
+  }
+
+  return i;
+}
+
+}
+
+#elif defined(SLAM_SIMD_NEON)
+
+namespace simd {
+
+/**
+ * Converts 8 log odds cells per step and returns the number of cells converted. The de-interleaving loads separate
+ * log odds values from update indices.
+ */
+inline int convertLogOddsCellsNeon(const LogOddsCell* cells, int numCells, int8_t* dst)
+{
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const int32x4_t unknownVal = vdupq_n_s32(-1);
+  const uint32x4_t freeInc = vdupq_n_u32(1);
+  const uint32x4_t occupiedInc = vdupq_n_u32(101);
+
+  const float* values = &cells[0].logOddsVal;
+
+  int i = 0;
+
+  for (; i + 8 <= numCells; i += 8) {
+    int16x4_t halves[2];
+
+    for (int h = 0; h < 2; ++h) {
+      float32x4_t v = vld2q_f32(values + 2 * (i + 4 * h)).val[0];
+
+      uint32x4_t inc = vorrq_u32(vandq_u32(vcltq_f32(v, zero), freeInc), vandq_u32(vcgtq_f32(v, zero), occupiedInc));
+      halves[h] = vmovn_s32(vaddq_s32(unknownVal, vreinterpretq_s32_u32(inc)));
+    }
+
+    vst1_s8(dst + i, vmovn_s16(vcombine_s16(halves[0], halves[1])));
+  }
+
+  return i;
+}
+
+}
+
+#endif
+
+template<>
+struct OccupancyConversion<LogOddsCell>
+{
+  static void convert(const LogOddsCell* cells, int numCells, int8_t* dst)
+  {
+    static_assert(sizeof(LogOddsCell) == 2 * sizeof(float) && offsetof(LogOddsCell, logOddsVal) == 0,
+                  "vector kernels expect log odds values interleaved with update indices");
+
+    int done = 0;
+
+#if defined(SLAM_SIMD_AVX2)
+    static const bool useAvx2 = __builtin_cpu_supports("avx2");
+
+    if (useAvx2) {
+      done = simd::convertLogOddsCellsAvx2(cells, numCells, dst);
+    }
+#elif defined(SLAM_SIMD_NEON)
+    done = simd::convertLogOddsCellsNeon(cells, numCells, dst);
+#endif
+
+    for (int i = done; i < numCells; ++i) {
+      dst[i] = cells[i].isFree() ? 0 : (cells[i].isOccupied() ? 100 : -1);
+    }
+  }
+};
+
+/**
+ * Converts the inclusive cell box [minCell, maxCell] of map to occupancy values, rows of dst being dstStride bytes
+ * apart. Cells are visited in runs that are consecutive in storage, so tiled and sparse layouts convert as fast as
+ * row-major ones. With graded set, known cells get their occupancy probability in percent instead of 0 or 100.
+ * Bands of rows are converted in parallel if workers is given.
+ */
+template<typename ConcreteGridMap>
+void convertToOccupancy(const ConcreteGridMap& map, const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell,
+                        int8_t* dst, int dstStride, bool graded = false, WorkerPool* workers = 0)
+{
+  typedef typename ConcreteGridMap::CellType CellType;
+
+  enum { BandRows = 64 };
+
+  int numRows = maxCell.y() - minCell.y() + 1;
+
+  if ((numRows <= 0) || (maxCell.x() < minCell.x())) {
+    return;
+  }
+
+  int numBands = (numRows + BandRows - 1) / BandRows;
+
+  const typename ConcreteGridMap::CellLayout& layout (map.getCellLayout());
+  const typename ConcreteGridMap::ConcreteCellStorage& storage (map.getCellStorage());
+
+  auto convertBand = [&](int band)
+  {
+    int yEnd = std::min(minCell.y() + (band + 1) * static_cast<int>(BandRows), maxCell.y() + 1);
+
+    for (int y = minCell.y() + band * static_cast<int>(BandRows); y < yEnd; ++y) {
+      int8_t* dstRow = dst + static_cast<ptrdiff_t>(y - minCell.y()) * dstStride - minCell.x();
+
+      for (int x = minCell.x(); x <= maxCell.x(); ) {
+        int storageIndex = map.getStorageIndex(x, y);
+        int runLength = std::min(std::min(layout.getRunLength(x), storage.getNumContiguousCells(storageIndex)),
+                                 maxCell.x() - x + 1);
+        const CellType* cells = storage.getCells(storageIndex);
+
+        if (cells == 0) {
+          //Unallocated chunk or block not written since the last reset, all cells read as the unknown cell
+          OccupancyConversion<CellType>::convert(&storage[storageIndex], 1, dstRow + x);
+          std::fill(dstRow + x + 1, dstRow + x + runLength, dstRow[x]);
+        } else if (graded) {
+          for (int i = 0; i < runLength; ++i) {
+            dstRow[x + i] = (cells[i].isFree() || cells[i].isOccupied())
+                ? static_cast<int8_t>(lrintf(100.0f * map.getGridProbabilityStorage(storageIndex + i))) : -1;
+          }
+        } else {
+          OccupancyConversion<CellType>::convert(cells, runLength, dstRow + x);
+        }
+
+        x += runLength;
+      }
+    }
+  };
+
+  if (workers && (workers->getNumThreads() > 1) && (numBands > 1)) {
+    workers->run(numBands, convertBand);
+  } else {
+    for (int band = 0; band < numBands; ++band) {
+      convertBand(band);
+    }
+  }
+}
+
+}
+
+#endif
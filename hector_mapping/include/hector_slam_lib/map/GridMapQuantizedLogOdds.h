@@ -0,0 +1,214 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapQuantizedLogOdds_h_
+#define __GridMapQuantizedLogOdds_h_
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include <stdint.h>
+
+/**
+ * Compact log odds cell storing the log odds value as saturating fixed point number with FractionBits fractional
+ * bits. The update marker uses a small integer type, OccGridMapBase resets the markers of all cells when their
+ * range is used up.
+ */
+template<typename LogOddsType, typename UpdateIndexType, int FractionBitsIn>
+class QuantizedLogOddsCell
+{
+public:
+
+  enum { FractionBits = FractionBitsIn };
+
+  typedef LogOddsType ValueType;
+
+  /**
+   * Sets the cell value to val.
+   * @param val The log odds value.
+   */
+  void set(float val)
+  {
+    float scaled = val * static_cast<float>(1 << FractionBits);
+    scaled = std::min(std::max(scaled, static_cast<float>(std::numeric_limits<LogOddsType>::min())),
+                      static_cast<float>(std::numeric_limits<LogOddsType>::max()));
+    logOddsVal = static_cast<LogOddsType>(lrintf(scaled));
+  }
+
+  /**
+   * Returns the value of the cell.
+   * @return The log odds value.
+   */
+  float getValue() const
+  {
+    return static_cast<float>(logOddsVal) * (1.0f / static_cast<float>(1 << FractionBits));
+  }
+
+  /**
+   * Returns wether the cell is occupied.
+   * @return Cell is occupied
+   */
+  bool isOccupied() const
+  {
+    return logOddsVal > 0;
+  }
+
+  bool isFree() const
+  {
+    return logOddsVal < 0;
+  }
+
+  /**
+   * Reset Cell to prior probability.
+   */
+  void resetGridCell()
+  {
+    logOddsVal = 0;
+    updateIndex = 0;
+  }
+
+public:
+
+  LogOddsType logOddsVal;      ///< Fixed point log odds representation of occupancy probability.
+  UpdateIndexType updateIndex;
+};
+
+/**
+ * 4 byte cell, log odds in [-512,512) with a resolution of 1/64.
+ */
+typedef QuantizedLogOddsCell<int16_t, uint16_t, 6> LogOddsCell16;
+
+/**
+ * 2 byte cell, log odds in [-8,8) with a resolution of 1/16. Update markers wrap every 85 scans.
+ */
+typedef QuantizedLogOddsCell<int8_t, uint8_t, 4> LogOddsCell8;
+
+/**
+ * Update functions for QuantizedLogOddsCell. Updates saturate at the limits of the value type instead of growing
+ * without bound like the float log odds, so reverting a free update of a saturated cell is not exact. Probabilities
+ * are read from a lookup table covering log odds in [-LutLimit,LutLimit], values outside are clamped (the probability
+ * differs from 0 or 1 by less than 1e-5 there).
+ */
+template<typename ConcreteCellType>
+class GridMapQuantizedLogOddsFunctions
+{
+public:
+
+  typedef typename ConcreteCellType::ValueType ValueType;
+
+  enum { FractionBits = ConcreteCellType::FractionBits };
+  enum { ValueMin = std::numeric_limits<ValueType>::min() };
+  enum { ValueMax = std::numeric_limits<ValueType>::max() };
+  enum { LutLimit = (ValueMax < (12 << FractionBits)) ? ValueMax : (12 << FractionBits) };
+
+  /**
+   * Constructor, sets parameters like free and occupied log odds ratios and fills the probability lookup table.
+   */
+  GridMapQuantizedLogOddsFunctions()
+    : probabilityLut(2 * LutLimit + 1)
+  {
+    this->setUpdateFreeFactor(0.4f);
+    this->setUpdateOccupiedFactor(0.6f);
+
+    for (int i = -LutLimit; i <= LutLimit; ++i) {
+      float odds = exp(static_cast<float>(i) / static_cast<float>(1 << FractionBits));
+      probabilityLut[i + LutLimit] = odds / (odds + 1.0f);
+    }
+  }
+
+  /**
+   * Update cell as occupied
+   * @param cell The cell.
+   */
+  void updateSetOccupied(ConcreteCellType& cell) const
+  {
+    cell.logOddsVal = saturate(static_cast<int>(cell.logOddsVal) + logOddsOccupied);
+  }
+
+  /**
+   * Update cell as free
+   * @param cell The cell.
+   */
+  void updateSetFree(ConcreteCellType& cell) const
+  {
+    cell.logOddsVal = saturate(static_cast<int>(cell.logOddsVal) + logOddsFree);
+  }
+
+  void updateUnsetFree(ConcreteCellType& cell) const
+  {
+    cell.logOddsVal = saturate(static_cast<int>(cell.logOddsVal) - logOddsFree);
+  }
+
+  /**
+   * Get the probability value represented by the grid cell.
+   * @param cell The cell.
+   * @return The probability
+   */
+  float getGridProbability(const ConcreteCellType& cell) const
+  {
+    int val = std::min(std::max(static_cast<int>(cell.logOddsVal), -static_cast<int>(LutLimit)), static_cast<int>(LutLimit));
+    return probabilityLut[val + LutLimit];
+  }
+
+  void setUpdateFreeFactor(float factor)
+  {
+    logOddsFree = std::min(probToQuantizedLogOdds(factor), -1);
+  }
+
+  void setUpdateOccupiedFactor(float factor)
+  {
+    logOddsOccupied = std::max(probToQuantizedLogOdds(factor), 1);
+  }
+
+protected:
+
+  static ValueType saturate(int val)
+  {
+    return static_cast<ValueType>(std::min(std::max(val, static_cast<int>(ValueMin)), static_cast<int>(ValueMax)));
+  }
+
+  /**
+   * Rounded fixed point log odds for prob. Updates are forced to be at least one step so they are never lost.
+   */
+  static int probToQuantizedLogOdds(float prob)
+  {
+    float odds = prob / (1.0f - prob);
+    return static_cast<int>(lrintf(log(odds) * static_cast<float>(1 << FractionBits)));
+  }
+
+  int logOddsOccupied; ///< Fixed point log odds used for updating cells as occupied
+  int logOddsFree;     ///< Fixed point log odds used for updating cells as free
+
+  std::vector<float> probabilityLut; ///< Cell probability for log odds values in [-LutLimit,LutLimit]
+};
+
+typedef GridMapQuantizedLogOddsFunctions<LogOddsCell16> GridMapLogOddsFunctions16;
+typedef GridMapQuantizedLogOddsFunctions<LogOddsCell8> GridMapLogOddsFunctions8;
+
+#endif
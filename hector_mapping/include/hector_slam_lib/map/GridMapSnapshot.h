@@ -0,0 +1,232 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapSnapshot_h_
+#define __GridMapSnapshot_h_
+
+#include <Eigen/Core>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "GridMapOccupancyConversion.h"
+
+namespace hectorslam {
+
+/**
+ * Immutable copy of the cell states of a grid map (-1 unknown, 0 free, 100 occupied), split into square tiles.
+ * Snapshots taken one after another share all tiles that did not change in between, so comparing tile pointers
+ * tells which parts of the map changed. Tiles with only unknown cells are not stored.
+ */
+class GridMapSnapshot
+{
+public:
+
+  typedef std::vector<int8_t> Tile;
+
+  enum { TileSizeLog2 = 6, TileSize = 1 << TileSizeLog2 };
+
+  GridMapSnapshot(const Eigen::Vector2i& sizeIn)
+    : size(sizeIn)
+    , numTiles((sizeIn.array() + (static_cast<int>(TileSize) - 1)) / static_cast<int>(TileSize))
+    , tiles(numTiles.x() * numTiles.y())
+    , updateIndex(-1)
+    , allocatedMin(0, 0)
+    , allocatedMax(-1, -1)
+  {}
+
+  int8_t getCell(int x, int y) const
+  {
+    const std::shared_ptr<const Tile>& tile (getTile(x >> TileSizeLog2, y >> TileSizeLog2));
+    return tile ? (*tile)[((y & (TileSize - 1)) << TileSizeLog2) + (x & (TileSize - 1))] : -1;
+  }
+
+  /**
+   * Copies the inclusive cell box [minCell, maxCell] to dst, rows being dstStride apart.
+   */
+  void copyRegion(const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell, int8_t* dst, int dstStride) const
+  {
+    for (int y = minCell.y(); y <= maxCell.y(); ++y) {
+      int8_t* dstRow = dst + (y - minCell.y()) * dstStride;
+      int x = minCell.x();
+
+      //copy in runs of cells lying in the same tile
+      while (x <= maxCell.x()) {
+        int runEnd = std::min((x | (TileSize - 1)) + 1, maxCell.x() + 1);
+        const std::shared_ptr<const Tile>& tile (getTile(x >> TileSizeLog2, y >> TileSizeLog2));
+
+        if (tile) {
+          const int8_t* src = &(*tile)[((y & (TileSize - 1)) << TileSizeLog2) + (x & (TileSize - 1))];
+          std::copy(src, src + (runEnd - x), dstRow + (x - minCell.x()));
+        } else {
+          std::fill(dstRow + (x - minCell.x()), dstRow + (runEnd - minCell.x()), static_cast<int8_t>(-1));
+        }
+
+        x = runEnd;
+      }
+    }
+  }
+
+  const std::shared_ptr<const Tile>& getTile(int tileX, int tileY) const { return tiles[tileY * numTiles.x() + tileX]; };
+
+  const Eigen::Vector2i& getSize() const { return size; };
+  const Eigen::Vector2i& getNumTiles() const { return numTiles; };
+
+  /**
+   * Update index of the map when the snapshot was taken.
+   */
+  int getUpdateIndex() const { return updateIndex; };
+
+  /**
+   * Allocated bounds of the map when the snapshot was taken, see GridMapBase::getAllocatedBounds().
+   */
+  bool getAllocatedBounds(Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    minCell = allocatedMin;
+    maxCell = allocatedMax;
+    return (minCell.array() <= maxCell.array()).all();
+  }
+
+protected:
+
+  Eigen::Vector2i size;
+  Eigen::Vector2i numTiles;
+  std::vector<std::shared_ptr<const Tile> > tiles;
+  int updateIndex;
+  Eigen::Vector2i allocatedMin;
+  Eigen::Vector2i allocatedMax;
+
+  friend class GridMapSnapshotBuffer;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/**
+ * Holds the latest snapshot of a map. The thread updating the map takes a new snapshot after each update, only
+ * copying the changed tiles, and publishes it atomically. Readers get the latest snapshot without locking the map
+ * and can keep using it as long as they like.
+ */
+class GridMapSnapshotBuffer
+{
+public:
+
+  /**
+   * If graded is set, the snapshots contain graded occupancy values like convertToOccupancy() with graded set,
+   * otherwise only free, occupied and unknown cells.
+   */
+  GridMapSnapshotBuffer(bool gradedIn = false)
+    : graded(gradedIn)
+  {}
+
+  bool isGraded() const { return graded; }
+
+  /**
+   * Takes a new snapshot of map, reusing the tiles of the previous snapshot outside of the inclusive cell box
+   * [minCell, maxCell]. Has to be called with the map locked against writers.
+   */
+  template<typename ConcreteGridMap>
+  void update(const ConcreteGridMap& map, const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell)
+  {
+    std::shared_ptr<const GridMapSnapshot> previous (getSnapshot());
+
+    std::shared_ptr<GridMapSnapshot> snapshot;
+    Eigen::Vector2i minTile, maxTile;
+
+    if (previous && (previous->getSize() == map.getMapDimensions())) {
+      snapshot = std::make_shared<GridMapSnapshot>(*previous);
+      minTile = (minCell.array().max(0) / static_cast<int>(GridMapSnapshot::TileSize)).matrix();
+      maxTile = (maxCell.array().min(map.getMapDimensions().array() - 1) / static_cast<int>(GridMapSnapshot::TileSize)).matrix();
+    } else {
+      snapshot = std::make_shared<GridMapSnapshot>(map.getMapDimensions());
+      minTile = Eigen::Vector2i(0, 0);
+      maxTile = snapshot->getNumTiles() - Eigen::Vector2i::Ones();
+    }
+
+    for (int tileY = minTile.y(); tileY <= maxTile.y(); ++tileY) {
+      for (int tileX = minTile.x(); tileX <= maxTile.x(); ++tileX) {
+        snapshot->tiles[tileY * snapshot->numTiles.x() + tileX] = takeTile(map, tileX, tileY);
+      }
+    }
+
+    snapshot->updateIndex = map.getUpdateIndex();
+
+    if (!map.getAllocatedBounds(snapshot->allocatedMin, snapshot->allocatedMax)) {
+      snapshot->allocatedMax = snapshot->allocatedMin - Eigen::Vector2i::Ones();
+    }
+
+    std::atomic_store(&latestSnapshot, std::shared_ptr<const GridMapSnapshot>(snapshot));
+  }
+
+  /**
+   * Takes a snapshot of the whole map.
+   */
+  template<typename ConcreteGridMap>
+  void rebuild(const ConcreteGridMap& map)
+  {
+    std::atomic_store(&latestSnapshot, std::shared_ptr<const GridMapSnapshot>());
+    update(map, Eigen::Vector2i(0, 0), map.getMapDimensions() - Eigen::Vector2i::Ones());
+  }
+
+  /**
+   * Latest snapshot, empty before the first update. Can be called from any thread.
+   */
+  std::shared_ptr<const GridMapSnapshot> getSnapshot() const
+  {
+    return std::atomic_load(&latestSnapshot);
+  }
+
+protected:
+
+  template<typename ConcreteGridMap>
+  std::shared_ptr<const GridMapSnapshot::Tile> takeTile(const ConcreteGridMap& map, int tileX, int tileY) const
+  {
+    int beginX = tileX << GridMapSnapshot::TileSizeLog2;
+    int beginY = tileY << GridMapSnapshot::TileSizeLog2;
+    int endX = std::min(beginX + static_cast<int>(GridMapSnapshot::TileSize), map.getSizeX());
+    int endY = std::min(beginY + static_cast<int>(GridMapSnapshot::TileSize), map.getSizeY());
+
+    std::shared_ptr<GridMapSnapshot::Tile> tile (std::make_shared<GridMapSnapshot::Tile>(GridMapSnapshot::TileSize * GridMapSnapshot::TileSize, -1));
+
+    convertToOccupancy(map, Eigen::Vector2i(beginX, beginY), Eigen::Vector2i(endX - 1, endY - 1), tile->data(),
+                       GridMapSnapshot::TileSize, graded);
+
+    bool known = std::any_of(tile->begin(), tile->end(), [](int8_t cell) { return cell != -1; });
+
+    return known ? tile : std::shared_ptr<const GridMapSnapshot::Tile>();
+  }
+
+  std::shared_ptr<const GridMapSnapshot> latestSnapshot;
+  bool graded;
+};
+
+}
+
+#endif
@@ -0,0 +1,403 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __GridMapStorage_h_
+#define __GridMapStorage_h_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+namespace hectorslam {
+
+/**
+ * Cell storages own the cells of a GridMapBase and are addressed by the storage indices computed by the cell layout
+ * (see GridMapLayout.h). Every layout selects its storage via the nested CellStorage template.
+ */
+
+/**
+ * Single contiguous cell array covering the whole map, allocated up front. The array is split into blocks of
+ * 2^BlockCellsLog2 cells, each tagged with the generation of the storage it was last reset in. Resetting only starts
+ * a new generation: cells of blocks from an older generation read as reset cells, and a block is reset when it is
+ * first written to again. This makes resetting a map constant time, and blocks that are never written after a
+ * reset are never touched. Different blocks can be reset concurrently.
+ */
+template<typename ConcreteCellType, int BlockCellsLog2 = 12>
+class GridMapDenseStorage
+{
+public:
+
+  enum { BlockCells = 1 << BlockCellsLog2 };
+  enum { BlockMask = BlockCells - 1 };
+
+  GridMapDenseStorage()
+    : cells(0)
+    , numCells(0)
+    , blockGenerations(0)
+    , numBlocks(0)
+    , generation(1)
+  {
+    unknownCell.resetGridCell();
+  }
+
+  ~GridMapDenseStorage()
+  {
+    release();
+  }
+
+  void allocate(int numCellsIn)
+  {
+    cells = new ConcreteCellType [numCellsIn];
+    numCells = numCellsIn;
+
+    numBlocks = (numCellsIn + BlockMask) >> BlockCellsLog2;
+    blockGenerations = new std::atomic<uint32_t> [numBlocks];
+    generation = 1;
+
+    for (int i = 0; i < numBlocks; ++i) {
+      blockGenerations[i].store(staleGeneration, std::memory_order_relaxed);
+    }
+  }
+
+  void release()
+  {
+    delete[] cells;
+    cells = 0;
+    numCells = 0;
+
+    delete[] blockGenerations;
+    blockGenerations = 0;
+    numBlocks = 0;
+  }
+
+  bool isAllocated() const { return cells != 0; };
+
+  int getNumCells() const { return numCells; };
+
+  /**
+   * Resets all cells by starting a new generation, the cells of each block are reset by the resetGridCell()
+   * function when the block is written to the next time. Must not be called concurrently to other accesses.
+   */
+  void resetCells()
+  {
+    if (generation < maxGeneration) {
+      ++generation;
+      return;
+    }
+
+    //generation counter wraps around, make all blocks stale explicitly
+    for (int i = 0; i < numBlocks; ++i) {
+      blockGenerations[i].store(staleGeneration, std::memory_order_relaxed);
+    }
+
+    generation = 1;
+  }
+
+  /**
+   * Copies the cell values of other, which has to be of the same size.
+   */
+  void copyFrom(const GridMapDenseStorage& other)
+  {
+    memcpy(cells, other.cells, numCells * sizeof(ConcreteCellType));
+
+    for (int i = 0; i < numBlocks; ++i) {
+      blockGenerations[i].store(other.isBlockCurrent(i) ? generation : staleGeneration, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Calls functor for every cell of the blocks written since the last reset.
+   */
+  template<typename CellFunctor>
+  void forEachCell(CellFunctor functor)
+  {
+    for (int i = 0; i < numBlocks; ++i) {
+      if (isBlockCurrent(i)) {
+        int blockEnd = std::min((i + 1) << BlockCellsLog2, numCells);
+
+        for (int j = i << BlockCellsLog2; j < blockEnd; ++j) {
+          functor(cells[j]);
+        }
+      }
+    }
+  }
+
+  ConcreteCellType& operator[](int storageIndex)
+  {
+    int block = storageIndex >> BlockCellsLog2;
+
+    if (!isBlockCurrent(block)) {
+      resetBlock(block);
+    }
+
+    return cells[storageIndex];
+  }
+
+  const ConcreteCellType& operator[](int storageIndex) const
+  {
+    return isBlockCurrent(storageIndex >> BlockCellsLog2) ? cells[storageIndex] : unknownCell;
+  }
+
+  /**
+   * Pointer to the cells from storageIndex on, consecutive in memory for getNumContiguousCells(storageIndex) cells.
+   * Null if not allocated or if the block has not been written since the last reset, all its cells are unknown then.
+   */
+  const ConcreteCellType* getCells(int storageIndex) const
+  {
+    return (cells && isBlockCurrent(storageIndex >> BlockCellsLog2)) ? (cells + storageIndex) : 0;
+  }
+
+  /**
+   * Number of cells from storageIndex to the end of its block.
+   */
+  int getNumContiguousCells(int storageIndex) const
+  {
+    return std::min(BlockCells - (storageIndex & BlockMask), numCells - storageIndex);
+  }
+
+protected:
+
+  enum : uint32_t
+  {
+    staleGeneration = 0,                ///< Older than every generation.
+    resettingGeneration = 0xFFFFFFFFu,  ///< Block is being reset by another thread.
+    maxGeneration = 0xFFFFFFFEu
+  };
+
+  bool isBlockCurrent(int block) const
+  {
+    return blockGenerations[block].load(std::memory_order_acquire) == generation;
+  }
+
+  /**
+   * Resets the cells of a block from an older generation. If another thread resets it concurrently, waits for it.
+   */
+  void resetBlock(int block)
+  {
+    std::atomic<uint32_t>& blockGeneration (blockGenerations[block]);
+    uint32_t currBlockGeneration = blockGeneration.load(std::memory_order_acquire);
+
+    while (currBlockGeneration != generation) {
+      if (currBlockGeneration == resettingGeneration) {
+        std::this_thread::yield();
+        currBlockGeneration = blockGeneration.load(std::memory_order_acquire);
+      } else if (blockGeneration.compare_exchange_weak(currBlockGeneration, resettingGeneration, std::memory_order_acquire)) {
+        int blockEnd = std::min((block + 1) << BlockCellsLog2, numCells);
+
+        for (int i = block << BlockCellsLog2; i < blockEnd; ++i) {
+          cells[i].resetGridCell();
+        }
+
+        blockGeneration.store(generation, std::memory_order_release);
+        return;
+      }
+    }
+  }
+
+  ConcreteCellType* cells;
+  int numCells;
+
+  std::atomic<uint32_t>* blockGenerations;  ///< Generation each block was last reset in.
+  int numBlocks;
+  uint32_t generation;                      ///< Current generation, blocks of other generations read as reset.
+
+  ConcreteCellType unknownCell;             ///< Returned for reads from blocks of older generations.
+
+private:
+  GridMapDenseStorage(const GridMapDenseStorage&);
+  GridMapDenseStorage& operator=(const GridMapDenseStorage&);
+};
+
+/**
+ * Sparse storage splitting the storage index range into chunks of 2^ChunkCellsLog2 cells. Only a directory with one
+ * pointer per chunk is allocated up front, chunks themselves are allocated (and reset) on first write access. Read
+ * access to a chunk that does not exist yet returns a reset cell, so unexplored parts of the map cost no memory.
+ * Different chunks can be allocated concurrently.
+ */
+template<typename ConcreteCellType, int ChunkCellsLog2>
+class GridMapChunkedStorage
+{
+public:
+
+  enum { ChunkCells = 1 << ChunkCellsLog2 };
+  enum { ChunkMask = ChunkCells - 1 };
+
+  GridMapChunkedStorage()
+    : chunks(0)
+    , numCells(0)
+    , numChunks(0)
+    , numAllocatedChunks(0)
+  {
+    unknownCell.resetGridCell();
+  }
+
+  ~GridMapChunkedStorage()
+  {
+    release();
+  }
+
+  void allocate(int numCellsIn)
+  {
+    numCells = numCellsIn;
+    numChunks = (numCellsIn + ChunkMask) >> ChunkCellsLog2;
+    chunks = new ConcreteCellType* [numChunks]();
+    numAllocatedChunks = 0;
+  }
+
+  void release()
+  {
+    releaseChunks();
+    delete[] chunks;
+    chunks = 0;
+    numCells = 0;
+    numChunks = 0;
+  }
+
+  bool isAllocated() const { return chunks != 0; };
+
+  int getNumCells() const { return numCells; };
+
+  /**
+   * Resetting drops all chunks, they get reallocated when written to again.
+   */
+  void resetCells()
+  {
+    releaseChunks();
+  }
+
+  void copyFrom(const GridMapChunkedStorage& other)
+  {
+    releaseChunks();
+
+    for (int i = 0; i < numChunks; ++i) {
+      if (other.chunks[i] != 0) {
+        chunks[i] = new ConcreteCellType [ChunkCells];
+        memcpy(chunks[i], other.chunks[i], ChunkCells * sizeof(ConcreteCellType));
+        ++numAllocatedChunks;
+      }
+    }
+  }
+
+  /**
+   * Calls functor for every cell of the allocated chunks.
+   */
+  template<typename CellFunctor>
+  void forEachCell(CellFunctor functor)
+  {
+    for (int i = 0; i < numChunks; ++i) {
+      ConcreteCellType* chunk = chunks[i];
+
+      if (chunk != 0) {
+        for (int j = 0; j < ChunkCells; ++j) {
+          functor(chunk[j]);
+        }
+      }
+    }
+  }
+
+  ConcreteCellType& operator[](int storageIndex)
+  {
+    ConcreteCellType*& chunk (chunks[storageIndex >> ChunkCellsLog2]);
+
+    if (chunk == 0) {
+      chunk = allocateChunk();
+    }
+
+    return chunk[storageIndex & ChunkMask];
+  }
+
+  const ConcreteCellType& operator[](int storageIndex) const
+  {
+    const ConcreteCellType* chunk (chunks[storageIndex >> ChunkCellsLog2]);
+
+    return (chunk != 0) ? chunk[storageIndex & ChunkMask] : unknownCell;
+  }
+
+  /**
+   * Pointer to the cells from storageIndex on, consecutive in memory for getNumContiguousCells(storageIndex) cells.
+   * Null if the chunk has not been allocated, all its cells are unknown then.
+   */
+  const ConcreteCellType* getCells(int storageIndex) const
+  {
+    const ConcreteCellType* chunk (chunks[storageIndex >> ChunkCellsLog2]);
+
+    return (chunk != 0) ? (chunk + (storageIndex & ChunkMask)) : 0;
+  }
+
+  /**
+   * Number of cells from storageIndex to the end of its chunk.
+   */
+  int getNumContiguousCells(int storageIndex) const
+  {
+    return ChunkCells - (storageIndex & ChunkMask);
+  }
+
+  int getNumChunks() const { return numChunks; };
+  int getNumAllocatedChunks() const { return numAllocatedChunks; };
+  bool isChunkAllocated(int chunkIndex) const { return chunks[chunkIndex] != 0; };
+
+protected:
+
+  ConcreteCellType* allocateChunk()
+  {
+    ConcreteCellType* chunk = new ConcreteCellType [ChunkCells];
+
+    for (int i = 0; i < ChunkCells; ++i) {
+      chunk[i].resetGridCell();
+    }
+
+    ++numAllocatedChunks;
+    return chunk;
+  }
+
+  void releaseChunks()
+  {
+    for (int i = 0; i < numChunks; ++i) {
+      delete[] chunks[i];
+      chunks[i] = 0;
+    }
+    numAllocatedChunks = 0;
+  }
+
+  ConcreteCellType** chunks;     ///< Chunk directory, null entries are chunks that have not been written yet.
+  int numCells;
+  int numChunks;
+  std::atomic<int> numAllocatedChunks;
+
+  ConcreteCellType unknownCell;  ///< Returned for reads from unallocated chunks.
+
+private:
+  GridMapChunkedStorage(const GridMapChunkedStorage&);
+  GridMapChunkedStorage& operator=(const GridMapChunkedStorage&);
+};
+
+}
+
+#endif
@@ -86,6 +86,7 @@ public:
   const Eigen::Vector2i& getMapDimensions() const { return mapDimensions; };
   int getSizeX() const { return mapDimensions[0]; };
   int getSizeY() const { return mapDimensions[1]; };
+  const Eigen::Vector2f& getMapLimitsf() const { return mapLimitsf; };
   float getCellLength() const { return cellLength; };
 
 protected:
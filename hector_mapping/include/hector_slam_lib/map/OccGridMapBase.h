@@ -36,39 +36,196 @@
 
 #include <Eigen/Geometry>
 
+#include <limits>
+#include <vector>
+
 namespace hectorslam {
 
-template<typename ConcreteCellType, typename ConcreteGridFunctions>
+/**
+ * Cell of the optional probability plane of OccGridMapBase. All cell types use 0.5 as prior probability.
+ */
+class ProbabilityPlaneCell
+{
+public:
+
+  void resetGridCell()
+  {
+    probability = 0.5f;
+  }
+
+  float probability;
+};
+
+/**
+ * Occupancy grid map, updated by ray tracing scans into the grid. Optionally maintains a probability plane that holds
+ * getGridProbability() of every cell, updated whenever a cell changes. Scan matching can read the plane directly
+ * instead of evaluating and caching the probabilities lazily.
+ */
+template<typename ConcreteCellType, typename ConcreteGridFunctions, typename ConcreteCellLayout = GridMapLayoutRowMajor>
 class OccGridMapBase
-  : public GridMapBase<ConcreteCellType>
+  : public GridMapBase<ConcreteCellType, ConcreteCellLayout>
 {
 
 public:
 
+  typedef decltype(ConcreteCellType::updateIndex) UpdateIndexType;
+  typedef typename ConcreteCellLayout::template CellStorage<ProbabilityPlaneCell>::type ProbabilityPlaneStorage;
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
   OccGridMapBase(float mapResolution, const Eigen::Vector2i& size, const Eigen::Vector2f& offset)
-    : GridMapBase<ConcreteCellType>(mapResolution, size, offset)
+    : GridMapBase<ConcreteCellType, ConcreteCellLayout>(mapResolution, size, offset)
     , currUpdateIndex(0)
     , currMarkOccIndex(-1)
     , currMarkFreeIndex(-1)
+    , lastUpdateMin(0, 0)
+    , lastUpdateMax(-1, -1)
+    , dirtyMin(0, 0)
+    , dirtyMax(this->getMapDimensions().array() - 1)
+    , probabilityPlaneEnabled(false)
   {}
 
   virtual ~OccGridMapBase() {}
 
+  virtual void reset()
+  {
+    GridMapBase<ConcreteCellType, ConcreteCellLayout>::reset();
+
+    dirtyMin = Eigen::Vector2i(0, 0);
+    dirtyMax = this->getMapDimensions().array() - 1;
+
+    //map dimensions might have changed, otherwise resetting keeps the plane
+    if (probabilityPlaneEnabled) {
+      if (probabilityPlane.getNumCells() != this->getNumStorageCells()) {
+        probabilityPlane.release();
+        probabilityPlane.allocate(this->getNumStorageCells());
+      }
+
+      probabilityPlane.resetCells();
+    }
+  }
+
+  /**
+   * Enables or disables maintaining the probability plane. When enabling, the plane is initialized from the cells.
+   */
+  void setProbabilityPlaneEnabled(bool enabled)
+  {
+    if (enabled == probabilityPlaneEnabled) {
+      return;
+    }
+
+    probabilityPlane.release();
+    probabilityPlaneEnabled = enabled;
+
+    if (enabled) {
+      probabilityPlane.allocate(this->getNumStorageCells());
+      probabilityPlane.resetCells();
+
+      const ProbabilityPlaneStorage& constPlane (probabilityPlane);
+      int numStorageCells = this->getNumStorageCells();
+
+      //only write non-prior values so sparse planes stay sparse
+      for (int i = 0; i < numStorageCells; ++i) {
+        float probability = getGridProbabilityStorage(i);
+
+        if (probability != constPlane[i].probability) {
+          probabilityPlane[i].probability = probability;
+        }
+      }
+    }
+  }
+
+  bool hasProbabilityPlane() const { return probabilityPlaneEnabled; };
+
+  /**
+   * Has to be called after cells have been written directly through getCell(), e.g. when loading a saved map.
+   * Restarts the update markers, rebuilds the probability plane and marks the whole map as changed.
+   */
+  void onCellsReplaced()
+  {
+    resetUpdateIndices();
+
+    if (probabilityPlaneEnabled) {
+      setProbabilityPlaneEnabled(false);
+      setProbabilityPlaneEnabled(true);
+    }
+
+    lastUpdateMin = Eigen::Vector2i(0, 0);
+    lastUpdateMax = this->getMapDimensions().array() - 1;
+    growDirtyBounds(lastUpdateMin, lastUpdateMax);
+
+    this->setUpdated();
+  }
+
+  /**
+   * Replaces the map contents with an occupancy grid as used by nav_msgs/OccupancyGrid (row-major, -1 unknown, 0 to
+   * 100 occupancy in percent), whose cell (0,0) has its corner at gridOriginWorld. Each cell takes the value of the
+   * grid cell covering its center, so the grid may have another resolution. Known cells are set as if numUpdates scans
+   * had observed them, as occupied from 50 percent on. A single update leaves walls too weak for reliable matching.
+   */
+  void setFromOccupancyGrid(const int8_t* gridData, int gridWidth, int gridHeight, float gridResolution, const Eigen::Vector2f& gridOriginWorld, int numUpdates = 10)
+  {
+    this->reset();
+
+    int sizeX = this->getSizeX();
+    int sizeY = this->getSizeY();
+
+    for (int y = 0; y < sizeY; ++y) {
+      for (int x = 0; x < sizeX; ++x) {
+        Eigen::Vector2f gridCoords ((this->getWorldCoords(Eigen::Vector2f(x, y)) - gridOriginWorld) / gridResolution);
+
+        int gridX = static_cast<int>(std::floor(gridCoords.x()));
+        int gridY = static_cast<int>(std::floor(gridCoords.y()));
+
+        if ((gridX < 0) || (gridY < 0) || (gridX >= gridWidth) || (gridY >= gridHeight)) {
+          continue;
+        }
+
+        int8_t occupancy = gridData[gridY * gridWidth + gridX];
+
+        if (occupancy < 0) {
+          continue;
+        }
+
+        ConcreteCellType& cell (this->getCell(x, y));
+
+        for (int i = 0; i < numUpdates; ++i) {
+          if (occupancy >= 50) {
+            concreteGridFunctions.updateSetOccupied(cell);
+          } else {
+            concreteGridFunctions.updateSetFree(cell);
+          }
+        }
+      }
+    }
+
+    onCellsReplaced();
+  }
+
+  /**
+   * Returns the probability plane, indexed by storage index. Only valid if hasProbabilityPlane() is true.
+   */
+  const ProbabilityPlaneStorage& getProbabilityPlane() const { return probabilityPlane; };
+
   void updateSetOccupied(int index)
   {
-    concreteGridFunctions.updateSetOccupied(this->getCell(index));
+    ConcreteCellType& cell (this->getCell(index));
+    concreteGridFunctions.updateSetOccupied(cell);
+    updateProbabilityPlane(this->cellLayout.getIndexFromLinear(index), cell);
   }
 
   void updateSetFree(int index)
   {
-    concreteGridFunctions.updateSetFree(this->getCell(index));
+    ConcreteCellType& cell (this->getCell(index));
+    concreteGridFunctions.updateSetFree(cell);
+    updateProbabilityPlane(this->cellLayout.getIndexFromLinear(index), cell);
   }
 
   void updateUnsetFree(int index)
   {
-    concreteGridFunctions.updateUnsetFree(this->getCell(index));
+    ConcreteCellType& cell (this->getCell(index));
+    concreteGridFunctions.updateUnsetFree(cell);
+    updateProbabilityPlane(this->cellLayout.getIndexFromLinear(index), cell);
   }
 
   float getGridProbabilityMap(int index) const
@@ -76,6 +233,16 @@ public:
     return concreteGridFunctions.getGridProbability(this->getCell(index));
   }
 
+  float getGridProbabilityMap(int xMap, int yMap) const
+  {
+    return concreteGridFunctions.getGridProbability(this->getCell(xMap, yMap));
+  }
+
+  float getGridProbabilityStorage(int storageIndex) const
+  {
+    return concreteGridFunctions.getGridProbability(this->getStorageCell(storageIndex));
+  }
+
   bool isOccupied(int xMap, int yMap) const
   {
     return (this->getCell(xMap,yMap).isOccupied());
@@ -120,8 +287,50 @@ public:
    */
   void updateByScan(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld)
   {
+    beginScanUpdate(dataContainer, robotPoseWorld);
+    updateByScanRows(dataContainer, robotPoseWorld, 0, this->getSizeY());
+    finishScanUpdate();
+  }
+
+  /**
+   * Split version of updateByScan() for updating a map concurrently: after beginScanUpdate(), updateByScanRows() can
+   * be called from several threads for disjoint row ranges, followed by finishScanUpdate(). Range bounds have to be
+   * multiples of ConcreteCellLayout::RowAlignment (or the map edges).
+   */
+  void beginScanUpdate(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld)
+  {
+    if (!getScanUpdateBounds(dataContainer, robotPoseWorld, lastUpdateMin, lastUpdateMax)) {
+      lastUpdateMin = Eigen::Vector2i(0, 0);
+      lastUpdateMax = Eigen::Vector2i(-1, -1);
+    } else {
+      growDirtyBounds(lastUpdateMin, lastUpdateMax);
+    }
+
+    //cells with small update marker types run out of update indices regularly
+    if (currUpdateIndex > static_cast<int>(std::numeric_limits<UpdateIndexType>::max()) - 3) {
+      resetUpdateIndices();
+    }
+
     currMarkFreeIndex = currUpdateIndex + 1;
     currMarkOccIndex = currUpdateIndex + 2;
+  }
+
+  void finishScanUpdate()
+  {
+    //Tell the map that it has been updated
+    this->setUpdated();
+
+    //Increase update index (used for updating grid cells only once per incoming scan)
+    currUpdateIndex += 3;
+  }
+
+  /**
+   * Ray traces the scan, only updating cells in rows [rowBegin, rowEnd). The result of updating all rows in parts is
+   * identical to a single update, as a cell that is an endpoint of any beam ends up occupied regardless of order.
+   */
+  void updateByScanRows(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld, int rowBegin, int rowEnd)
+  {
+    bool allRows = (rowBegin <= 0) && (rowEnd >= this->getSizeY());
 
     //Get pose in map coordinates from pose in world coordinates
     Eigen::Vector3f mapPose(this->getMapCoordsPose(robotPoseWorld));
@@ -130,41 +339,159 @@ public:
     Eigen::Affine2f poseTransform((Eigen::Translation2f(
                                         mapPose[0], mapPose[1]) * Eigen::Rotation2Df(mapPose[2])));
 
-    //Get start point of all laser beams in map coordinates (same for alle beams, stored in robot coords in dataContainer)
-    Eigen::Vector2f scanBeginMapf(poseTransform * dataContainer.getOrigo());
+    //Beam endpoints are stored as separate x and y arrays
+    const float* pointsX = dataContainer.getX();
+    const float* pointsY = dataContainer.getY();
+
+    //Fused scans of several sensors have one group of beams per sensor origin
+    for (int group = 0; group < dataContainer.getNumOrigos(); ++group) {
+
+      //Get start point of the laser beams of the group in map coordinates (stored in robot coords in dataContainer)
+      Eigen::Vector2f scanBeginMapf(poseTransform * dataContainer.getOrigo(group));
+
+      //Get integer vector of laser beams start point
+      Eigen::Vector2i scanBeginMapi(scanBeginMapf[0] + 0.5f, scanBeginMapf[1] + 0.5f);
+
+      int groupEnd = dataContainer.getOrigoEnd(group);
 
-    //Get integer vector of laser beams start point
-    Eigen::Vector2i scanBeginMapi(scanBeginMapf[0] + 0.5f, scanBeginMapf[1] + 0.5f);
+      //Iterate over all valid laser beams of the group
+      for (int i = dataContainer.getOrigoBegin(group); i < groupEnd; ++i) {
+
+        //Get map coordinates of current beam endpoint
+        Eigen::Vector2f scanEndMapf(poseTransform * Eigen::Vector2f(pointsX[i], pointsY[i]));
+
+        //add 0.5 to beam endpoint vector for following integer cast (to round, not truncate)
+        scanEndMapf.array() += (0.5f);
+
+        //Get integer map coordinates of current beam endpoint
+        Eigen::Vector2i scanEndMapi(scanEndMapf.cast<int>());
+
+        //Update map using a bresenham variant for drawing a line from beam start to beam endpoint in map coordinates
+        if (scanBeginMapi != scanEndMapi){
+          if (allRows){
+            updateLineBresenhami(scanBeginMapi, scanEndMapi);
+          }else{
+            updateLineBresenhamiRows(scanBeginMapi, scanEndMapi, rowBegin, rowEnd);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Bounding box (inclusive, in map cells) of the beam origins and endpoints of the scan, clipped to the map. All cells
+   * updated by the scan lie inside it.
+   * @return False if the box is empty
+   */
+  bool getScanUpdateBounds(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld, Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    Eigen::Vector3f mapPose(this->getMapCoordsPose(robotPoseWorld));
+    Eigen::Affine2f poseTransform((Eigen::Translation2f(mapPose[0], mapPose[1]) * Eigen::Rotation2Df(mapPose[2])));
+
+    Eigen::Vector2f minMapf(poseTransform * dataContainer.getOrigo());
+    Eigen::Vector2f maxMapf(minMapf);
+
+    for (int group = 1; group < dataContainer.getNumOrigos(); ++group) {
+      Eigen::Vector2f origoMapf(poseTransform * dataContainer.getOrigo(group));
+      minMapf = minMapf.cwiseMin(origoMapf);
+      maxMapf = maxMapf.cwiseMax(origoMapf);
+    }
 
-    //Get number of valid beams in current scan
     int numValidElems = dataContainer.getSize();
 
-    //std::cout << "\n maxD: " << maxDist << " num: " << numValidElems << "\n";
+    const float* pointsX = dataContainer.getX();
+    const float* pointsY = dataContainer.getY();
 
-    //Iterate over all valid laser beams
     for (int i = 0; i < numValidElems; ++i) {
+      Eigen::Vector2f pointMapf(poseTransform * Eigen::Vector2f(pointsX[i], pointsY[i]));
+      minMapf = minMapf.cwiseMin(pointMapf);
+      maxMapf = maxMapf.cwiseMax(pointMapf);
+    }
 
-      //Get map coordinates of current beam endpoint
-      Eigen::Vector2f scanEndMapf(poseTransform * (dataContainer.getVecEntry(i)));
-      //std::cout << "\ns\n" << scanEndMapf << "\n";
+    //same rounding as in updateByScanRows()
+    minCell = (minMapf.array() + 0.5f).cast<int>().max(0).matrix();
+    maxCell = (maxMapf.array() + 0.5f).cast<int>().min(this->getMapDimensions().array() - 1).matrix();
 
-      //add 0.5 to beam endpoint vector for following integer cast (to round, not truncate)
-      scanEndMapf.array() += (0.5f);
+    return (minCell.array() <= maxCell.array()).all();
+  }
 
-      //Get integer map coordinates of current beam endpoint
-      Eigen::Vector2i scanEndMapi(scanEndMapf.cast<int>());
+  /**
+   * Bounding box (inclusive, in map cells) of the cells that may have been changed by the last update of the map, by
+   * scan or by pooling. Lets users of the map refresh derived data incrementally.
+   * @return False if the last update did not change any cells
+   */
+  bool getLastUpdateBounds(Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    minCell = lastUpdateMin;
+    maxCell = lastUpdateMax;
+    return (minCell.array() <= maxCell.array()).all();
+  }
 
-      //Update map using a bresenham variant for drawing a line from beam start to beam endpoint in map coordinates
-      if (scanBeginMapi != scanEndMapi){
-        updateLineBresenhami(scanBeginMapi, scanEndMapi);
-      }
+  /**
+   * Bounding box (inclusive, in map cells) of all cells that may have changed since the last call of
+   * clearDirtyBounds(), covering the whole map after construction and reset(). Meant for a single consumer
+   * publishing the map incrementally, which has to hold the map mutex while reading and clearing it.
+   * @return False if no cells changed
+   */
+  bool getDirtyBounds(Eigen::Vector2i& minCell, Eigen::Vector2i& maxCell) const
+  {
+    minCell = dirtyMin;
+    maxCell = dirtyMax;
+    return (minCell.array() <= maxCell.array()).all();
+  }
+
+  void clearDirtyBounds()
+  {
+    dirtyMin = this->getMapDimensions();
+    dirtyMax = Eigen::Vector2i(-1, -1);
+  }
+
+  /**
+   * Row range of the map touched by updating with the given scan, for splitting the update into balanced parts.
+   */
+  void getScanUpdateRows(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld, int& rowBegin, int& rowEnd) const
+  {
+    Eigen::Vector2i minCell, maxCell;
+
+    if (getScanUpdateBounds(dataContainer, robotPoseWorld, minCell, maxCell)) {
+      rowBegin = minCell.y();
+      rowEnd = maxCell.y() + 1;
+    } else {
+      rowBegin = rowEnd = 0;
     }
+  }
 
-    //Tell the map that it has been updated
-    this->setUpdated();
+  /**
+   * Splits the rows touched by the scan into at most numBands bands that can be updated concurrently with
+   * updateByScanRows(). Band i covers rows [bandRows[i], bandRows[i+1]).
+   */
+  void getScanUpdateBands(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld, int numBands, std::vector<int>& bandRows) const
+  {
+    bandRows.clear();
 
-    //Increase update index (used for updating grid cells only once per incoming scan)
-    currUpdateIndex += 3;
+    if (numBands < 2) {
+      bandRows.push_back(0);
+      bandRows.push_back(this->getSizeY());
+      return;
+    }
+
+    int rowBegin, rowEnd;
+    getScanUpdateRows(dataContainer, robotPoseWorld, rowBegin, rowEnd);
+
+    const int rowAlignment = ConcreteCellLayout::RowAlignment;
+    int rowsPerBand = std::max((rowEnd - rowBegin + numBands - 1) / numBands, 1);
+
+    bandRows.push_back(rowBegin);
+
+    for (int band = 1; band < numBands; ++band) {
+      int row = ((rowBegin + band * rowsPerBand + rowAlignment - 1) / rowAlignment) * rowAlignment;
+
+      if ((row > bandRows.back()) && (row < rowEnd)) {
+        bandRows.push_back(row);
+      }
+    }
+
+    bandRows.push_back(std::max(rowEnd, rowBegin));
   }
 
   inline void updateLineBresenhami( const Eigen::Vector2i& beginMap, const Eigen::Vector2i& endMap, unsigned int max_length = UINT_MAX){
@@ -193,39 +520,93 @@ public:
     unsigned int abs_dx = abs(dx);
     unsigned int abs_dy = abs(dy);
 
-    int offset_dx = util::sign(dx);
-    int offset_dy = util::sign(dy) * this->sizeX;
+    if (ConcreteCellLayout::IsLinear) {
 
-    unsigned int startOffset = beginMap.y() * this->sizeX + beginMap.x();
+      int offset_dx = util::sign(dx);
+      int offset_dy = util::sign(dy) * this->sizeX;
 
-    //if x is dominant
-    if(abs_dx >= abs_dy){
-      int error_y = abs_dx / 2;
-      bresenham2D(abs_dx, abs_dy, error_y, offset_dx, offset_dy, startOffset);
-    }else{
-      //otherwise y is dominant
-      int error_x = abs_dy / 2;
-      bresenham2D(abs_dy, abs_dx, error_x, offset_dy, offset_dx, startOffset);
+      unsigned int startOffset = beginMap.y() * this->sizeX + beginMap.x();
+
+      //if x is dominant
+      if(abs_dx >= abs_dy){
+        int error_y = abs_dx / 2;
+        bresenham2D(abs_dx, abs_dy, error_y, offset_dx, offset_dy, startOffset);
+      }else{
+        //otherwise y is dominant
+        int error_x = abs_dy / 2;
+        bresenham2D(abs_dy, abs_dx, error_x, offset_dy, offset_dx, startOffset);
+      }
+
+    } else {
+
+      //blocked layouts have no constant offset between neighboring cells, step in map coordinates instead
+      if(abs_dx >= abs_dy){
+        bresenham2DCoords(x0, y0, abs_dx, abs_dy, util::sign(dx), util::sign(dy), true);
+      }else{
+        bresenham2DCoords(y0, x0, abs_dy, abs_dx, util::sign(dy), util::sign(dx), false);
+      }
     }
 
-    unsigned int endOffset = endMap.y() * this->sizeX + endMap.x();
+    unsigned int endOffset = this->getStorageIndex(endMap.x(), endMap.y());
     this->bresenhamCellOcc(endOffset);
 
   }
 
+  /**
+   * updateLineBresenhami() restricted to the cells in rows [rowBegin, rowEnd). The traversal jumps to the first
+   * step inside the row range, so rays only crossing other rows cost nothing.
+   */
+  inline void updateLineBresenhamiRows(const Eigen::Vector2i& beginMap, const Eigen::Vector2i& endMap, int rowBegin, int rowEnd)
+  {
+    int x0 = beginMap[0];
+    int y0 = beginMap[1];
+
+    if ((x0 < 0) || (x0 >= this->getSizeX()) || (y0 < 0) || (y0 >= this->getSizeY())) {
+      return;
+    }
+
+    int x1 = endMap[0];
+    int y1 = endMap[1];
+
+    if ((x1 < 0) || (x1 >= this->getSizeX()) || (y1 < 0) || (y1 >= this->getSizeY())) {
+      return;
+    }
+
+    if ((std::max(y0, y1) < rowBegin) || (std::min(y0, y1) >= rowEnd)) {
+      return;
+    }
+
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+
+    unsigned int abs_dx = abs(dx);
+    unsigned int abs_dy = abs(dy);
+
+    if(abs_dx >= abs_dy){
+      bresenham2DCoordsRows(x0, y0, abs_dx, abs_dy, util::sign(dx), util::sign(dy), true, rowBegin, rowEnd);
+    }else{
+      bresenham2DCoordsRows(y0, x0, abs_dy, abs_dx, util::sign(dy), util::sign(dx), false, rowBegin, rowEnd);
+    }
+
+    if ((y1 >= rowBegin) && (y1 < rowEnd)) {
+      this->bresenhamCellOcc(this->getStorageIndex(x1, y1));
+    }
+  }
+
   inline void bresenhamCellFree(unsigned int offset)
   {
-    ConcreteCellType& cell (this->getCell(offset));
+    ConcreteCellType& cell (this->getStorageCell(offset));
 
     if (cell.updateIndex < currMarkFreeIndex) {
       concreteGridFunctions.updateSetFree(cell);
       cell.updateIndex = currMarkFreeIndex;
+      updateProbabilityPlane(offset, cell);
     }
   }
 
   inline void bresenhamCellOcc(unsigned int offset)
   {
-    ConcreteCellType& cell (this->getCell(offset));
+    ConcreteCellType& cell (this->getStorageCell(offset));
 
     if (cell.updateIndex < currMarkOccIndex) {
 
@@ -237,6 +618,7 @@ public:
       concreteGridFunctions.updateSetOccupied(cell);
       //std::cout << " setOcc " << "\n";
       cell.updateIndex = currMarkOccIndex;
+      updateProbabilityPlane(offset, cell);
     }
   }
 
@@ -259,12 +641,208 @@ public:
     }
   }
 
+  /**
+   * Same traversal as bresenham2D, but tracking map coordinates (a is the dominant axis) and looking up the storage
+   * index of every cell through the cell layout.
+   */
+  inline void bresenham2DCoords(int a, int b, unsigned int abs_da, unsigned int abs_db, int step_a, int step_b, bool aIsX)
+  {
+    int error_b = abs_da / 2;
+
+    this->bresenhamCellFree(aIsX ? this->getStorageIndex(a, b) : this->getStorageIndex(b, a));
+
+    unsigned int end = abs_da-1;
+
+    for(unsigned int i = 0; i < end; ++i){
+      a += step_a;
+      error_b += abs_db;
+
+      if((unsigned int)error_b >= abs_da){
+        b += step_b;
+        error_b -= abs_da;
+      }
+
+      this->bresenhamCellFree(aIsX ? this->getStorageIndex(a, b) : this->getStorageIndex(b, a));
+    }
+  }
+
+  /**
+   * bresenham2DCoords() restricted to rows [rowBegin, rowEnd). After k steps the minor coordinate has advanced
+   * floor((abs_da / 2 + k * abs_db) / abs_da) times, which gives the step range inside the rows in closed form.
+   */
+  inline void bresenham2DCoordsRows(int a, int b, unsigned int abs_da, unsigned int abs_db, int step_a, int step_b, bool aIsX, int rowBegin, int rowEnd)
+  {
+    long long da = abs_da;
+    long long db = abs_db;
+    long long error0 = da / 2;
+    long long end = da - 1;
+
+    long long kBegin;
+    long long kEnd;
+
+    if (!aIsX) {
+      //rows are the dominant axis
+      long long first = (step_a > 0) ? (rowBegin - a) : (a - (rowEnd - 1));
+      long long last = (step_a > 0) ? (rowEnd - 1 - a) : (a - rowBegin);
+      kBegin = std::max(first, 0LL);
+      kEnd = std::min(last, end);
+    } else if (db == 0) {
+      if ((b < rowBegin) || (b >= rowEnd)) {
+        return;
+      }
+      kBegin = 0;
+      kEnd = end;
+    } else {
+      //rows are the minor axis, number of minor steps has to be in [nBegin, nEnd]
+      long long nBegin = (step_b > 0) ? (rowBegin - b) : (b - (rowEnd - 1));
+      long long nEnd = (step_b > 0) ? (rowEnd - 1 - b) : (b - rowBegin);
+
+      if (nEnd < 0) {
+        return;
+      }
+
+      kBegin = (nBegin <= 0) ? 0 : (nBegin * da - error0 + db - 1) / db;
+      kEnd = std::min(((nEnd + 1) * da - error0 - 1) / db, end);
+    }
+
+    if (kBegin > kEnd) {
+      return;
+    }
+
+    long long steps_b = (error0 + kBegin * db) / da;
+
+    a += static_cast<int>(kBegin) * step_a;
+    b += static_cast<int>(steps_b) * step_b;
+    int error_b = static_cast<int>(error0 + kBegin * db - steps_b * da);
+
+    this->bresenhamCellFree(aIsX ? this->getStorageIndex(a, b) : this->getStorageIndex(b, a));
+
+    for(long long k = kBegin; k < kEnd; ++k){
+      a += step_a;
+      error_b += abs_db;
+
+      if((unsigned int)error_b >= abs_da){
+        b += step_b;
+        error_b -= abs_da;
+      }
+
+      this->bresenhamCellFree(aIsX ? this->getStorageIndex(a, b) : this->getStorageIndex(b, a));
+    }
+  }
+
+  /**
+   * Sets every cell of this map covering part of the inclusive cell box [fineMin, fineMax] of fineMap, a map of twice
+   * the resolution, to the most occupied of its 2x2 child cells. Repeating this for the box of every update keeps
+   * the map equal to the pooled fineMap, as pooling unchanged children reproduces the current cell.
+   * The box of this map that was pooled becomes the last update bounds.
+   */
+  void updateByPooling(const OccGridMapBase& fineMap, const Eigen::Vector2i& fineMin, const Eigen::Vector2i& fineMax)
+  {
+    lastUpdateMin = (fineMin.array() / 2).max(0).matrix();
+    lastUpdateMax = (fineMax.array() / 2).min(this->getMapDimensions().array() - 1).matrix();
+
+    const Eigen::Vector2i& coarseMin (lastUpdateMin);
+    const Eigen::Vector2i& coarseMax (lastUpdateMax);
+
+    if ((coarseMin.array() <= coarseMax.array()).all()) {
+      growDirtyBounds(coarseMin, coarseMax);
+    }
+
+    int fineSizeX = fineMap.getSizeX();
+    int fineSizeY = fineMap.getSizeY();
+
+    for (int y = coarseMin.y(); y <= coarseMax.y(); ++y) {
+      int fineY = 2 * y;
+      int fineYEnd = std::min(fineY + 2, fineSizeY);
+
+      for (int x = coarseMin.x(); x <= coarseMax.x(); ++x) {
+        int fineX = 2 * x;
+        int fineXEnd = std::min(fineX + 2, fineSizeX);
+
+        if ((fineX >= fineXEnd) || (fineY >= fineYEnd)) {
+          continue;
+        }
+
+        const ConcreteCellType* maxChild = &fineMap.getCell(fineX, fineY);
+
+        for (int cy = fineY; cy < fineYEnd; ++cy) {
+          for (int cx = fineX; cx < fineXEnd; ++cx) {
+            const ConcreteCellType& child (fineMap.getCell(cx, cy));
+
+            if (child.getValue() > maxChild->getValue()) {
+              maxChild = &child;
+            }
+          }
+        }
+
+        //compare through the const storage first, so sparse maps only allocate where the pooled value differs
+        int storageIndex = this->getStorageIndex(x, y);
+        const GridMapBase<ConcreteCellType, ConcreteCellLayout>& constThis (*this);
+
+        if (constThis.getStorageCell(storageIndex).getValue() != maxChild->getValue()) {
+          ConcreteCellType& cell (this->getStorageCell(storageIndex));
+
+          //keep the update marker, it belongs to the update index sequence of this map
+          UpdateIndexType updateIndex = cell.updateIndex;
+          cell = *maxChild;
+          cell.updateIndex = updateIndex;
+          updateProbabilityPlane(storageIndex, cell);
+        }
+      }
+    }
+
+    this->setUpdated();
+  }
+
+  /**
+   * Pools all allocated cells of fineMap, see above.
+   */
+  void updateByPooling(const OccGridMapBase& fineMap)
+  {
+    Eigen::Vector2i fineMin, fineMax;
+
+    if (fineMap.getAllocatedBounds(fineMin, fineMax)) {
+      updateByPooling(fineMap, fineMin, fineMax);
+    }
+  }
+
 protected:
 
+  inline void updateProbabilityPlane(int storageIndex, const ConcreteCellType& cell)
+  {
+    if (probabilityPlaneEnabled) {
+      probabilityPlane[storageIndex].probability = concreteGridFunctions.getGridProbability(cell);
+    }
+  }
+
+  void growDirtyBounds(const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell)
+  {
+    dirtyMin = dirtyMin.cwiseMin(minCell);
+    dirtyMax = dirtyMax.cwiseMax(maxCell);
+  }
+
+  /**
+   * Sets the update markers of all cells back to zero and restarts the update index sequence.
+   */
+  void resetUpdateIndices()
+  {
+    this->mapArray.forEachCell([](ConcreteCellType& cell) { cell.updateIndex = 0; });
+    currUpdateIndex = 0;
+  }
+
   ConcreteGridFunctions concreteGridFunctions;
   int currUpdateIndex;
   int currMarkOccIndex;
   int currMarkFreeIndex;
+
+  Eigen::Vector2i lastUpdateMin; ///< Bounding box of the cells changed by the last update, empty if min > max.
+  Eigen::Vector2i lastUpdateMax;
+
+  Eigen::Vector2i dirtyMin; ///< Bounding box of the cells changed since clearDirtyBounds(), empty if min > max.
+  Eigen::Vector2i dirtyMax;
+
+  bool probabilityPlaneEnabled;
+  ProbabilityPlaneStorage probabilityPlane; ///< getGridProbability() of all cells, indexed by storage index.
 };
 
 
@@ -30,10 +30,14 @@
 #define __OccGridMapUtil_h_
 
 #include <cmath>
+#include <iostream>
 
 #include "../scan/DataPointContainer.h"
 #include "../util/UtilFunctions.h"
 
+#include "OccGridMapUtilSimd.h"
+#include "GridMapLikelihoodField.h"
+
 namespace hectorslam {
 
 template<typename ConcreteOccGridMap, typename ConcreteCacheMethod>
@@ -43,14 +47,41 @@ public:
 
   OccGridMapUtil(const ConcreteOccGridMap* gridMap)
     : concreteGridMap(gridMap)
+    , likelihoodField(0)
     , size(0)
   {
     mapObstacleThreshold = gridMap->getObstacleThreshold();
-    cacheMethod.setMapSize(gridMap->getMapDimensions());
+    cacheMethod.setMapSize(gridMap->getStorageDimensions());
   }
 
   ~OccGridMapUtil()
-  {}
+  {
+    delete likelihoodField;
+  }
+
+  /**
+   * Matches against the Gaussian likelihood field of the map (see GridMapLikelihoodField.h) with the given standard
+   * deviation in cells instead of the occupancy probabilities. Scores then are mean field values, endpoints in
+   * unexplored space score 0.
+   */
+  void setUseLikelihoodField(bool enabled, float sigma = 1.0f)
+  {
+    if (!enabled) {
+      delete likelihoodField;
+      likelihoodField = 0;
+      return;
+    }
+
+    if (likelihoodField) {
+      likelihoodField->setSigma(sigma);
+    } else {
+      likelihoodField = new GridMapLikelihoodField<ConcreteOccGridMap>(sigma);
+    }
+
+    likelihoodField->update(*concreteGridMap);
+  }
+
+  bool getUseLikelihoodField() const { return likelihoodField != 0; };
 
 public:
 
@@ -61,7 +92,34 @@ public:
 
   inline Eigen::Vector2f getWorldCoordsPoint(const Eigen::Vector2f& mapPoint) const { return concreteGridMap->getWorldCoords(mapPoint); };
 
+  /**
+   * Computes the Hessian H and the gradient term dTr of the scan alignment error for the given pose. Uses the vector
+   * kernel of OccGridMapUtilSimd.h if the CPU supports it, getCompleteHessianDerivsScalar otherwise.
+   */
   void getCompleteHessianDerivs(const Eigen::Vector3f& pose, const DataContainer& dataPoints, Eigen::Matrix3f& H, Eigen::Vector3f& dTr)
+  {
+    float residual;
+    getCompleteHessianDerivs(pose, dataPoints, H, dTr, residual);
+  }
+
+  /**
+   * Same as above, additionally returns the squared alignment error sum(1 - M(p))^2 at pose in residual.
+   */
+  void getCompleteHessianDerivs(const Eigen::Vector3f& pose, const DataContainer& dataPoints, Eigen::Matrix3f& H, Eigen::Vector3f& dTr, float& residual)
+  {
+#if defined(SLAM_SIMD_AVX2) || defined(SLAM_SIMD_NEON)
+    if (simd::hessianKernelWidth() > 1) {
+      getCompleteHessianDerivsSimd(pose, dataPoints, H, dTr, residual);
+      return;
+    }
+#endif
+    getCompleteHessianDerivsScalar(pose, dataPoints, H, dTr, residual);
+  }
+
+  /**
+   * Reference implementation of getCompleteHessianDerivs, processing one scan point at a time.
+   */
+  void getCompleteHessianDerivsScalar(const Eigen::Vector3f& pose, const DataContainer& dataPoints, Eigen::Matrix3f& H, Eigen::Vector3f& dTr, float& residual)
   {
     int size = dataPoints.getSize();
 
@@ -72,6 +130,7 @@ public:
 
     H = Eigen::Matrix3f::Zero();
     dTr = Eigen::Vector3f::Zero();
+    residual = 0.0f;
 
     for (int i = 0; i < size; ++i) {
 
@@ -81,6 +140,8 @@ public:
 
       float funVal = 1.0f - transformedPointData[0];
 
+      residual += funVal * funVal;
+
       dTr[0] += transformedPointData[1] * funVal;
       dTr[1] += transformedPointData[2] * funVal;
 
@@ -103,6 +164,31 @@ public:
 
   }
 
+#if defined(SLAM_SIMD_AVX2) || defined(SLAM_SIMD_NEON)
+  void getCompleteHessianDerivsSimd(const Eigen::Vector3f& pose, const DataContainer& dataPoints, Eigen::Matrix3f& H, Eigen::Vector3f& dTr, float& residual)
+  {
+    int size = dataPoints.getSize();
+
+    const Eigen::Vector2f& mapLimits (concreteGridMap->getMapDimProperties().getMapLimitsf());
+
+    simd::HessianKernelParams params;
+    params.cosRot = cos(pose[2]);
+    params.sinRot = sin(pose[2]);
+    params.transX = pose[0];
+    params.transY = pose[1];
+    params.mapLimitX = mapLimits[0];
+    params.mapLimitY = mapLimits[1];
+
+    auto gridNeighborhood = [this](int x, int y, float* values) { this->getCachedGridNeighborhood(x, y, values); };
+
+#if defined(SLAM_SIMD_AVX2)
+    simd::accumulateHessianAvx2(dataPoints.getX(), dataPoints.getY(), size, params, gridNeighborhood, H, dTr, residual);
+#else
+    simd::accumulateHessianNeon(dataPoints.getX(), dataPoints.getY(), size, params, gridNeighborhood, H, dTr, residual);
+#endif
+  }
+#endif
+
   Eigen::Matrix3f getCovarianceForPose(const Eigen::Vector3f& mapPose, const DataContainer& dataPoints)
   {
 
@@ -230,51 +316,81 @@ public:
     return (concreteGridMap->getGridProbabilityMap(index));
   }
 
-  float interpMapValue(const Eigen::Vector2f& coords)
+  /**
+   * Returns the probability of the cell at storageIndex. Reads the probability plane of the map if it maintains one,
+   * uses the cache otherwise.
+   */
+  inline float getCachedGridPoint(int storageIndex)
   {
-    //check if coords are within map limits.
-    if (concreteGridMap->pointOutOfMapBounds(coords)){
-      return 0.0f;
+    if (likelihoodField) {
+      return likelihoodField->getField()[storageIndex].likelihood;
     }
 
-    //map coords are alway positive, floor them by casting to int
-    Eigen::Vector2i indMin(coords.cast<int>());
+    if (concreteGridMap->hasProbabilityPlane()) {
+      return concreteGridMap->getProbabilityPlane()[storageIndex].probability;
+    }
 
-    //get factors for bilinear interpolation
-    Eigen::Vector2f factors(coords - indMin.cast<float>());
+    float val;
 
-    int sizeX = concreteGridMap->getSizeX();
+    if (!cacheMethod.containsCachedData(storageIndex, val)) {
+      val = concreteGridMap->getGridProbabilityStorage(storageIndex);
+      cacheMethod.cacheData(storageIndex, val);
+    }
 
-    int index = indMin[1] * sizeX + indMin[0];
+    return val;
+  }
 
-    // get grid values for the 4 grid points surrounding the current coords. Check cached data first, if not contained
-    // filter gridPoint with gaussian and store in cache.
-    if (!cacheMethod.containsCachedData(index, intensities[0])) {
-      intensities[0] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[0]);
-    }
+  /**
+   * Writes the (cached) probabilities of (x,y), (x+1,y), (x,y+1) and (x+1,y+1) to values.
+   */
+  inline void getCachedGridNeighborhood(int x, int y, float* values)
+  {
+    int indices[4];
+    concreteGridMap->getCellLayout().getNeighborhoodIndices(x, y, indices);
 
-    ++index;
+    if (likelihoodField) {
+      const typename GridMapLikelihoodField<ConcreteOccGridMap>::LikelihoodFieldStorage& field (likelihoodField->getField());
 
-    if (!cacheMethod.containsCachedData(index, intensities[1])) {
-      intensities[1] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[1]);
+      values[0] = field[indices[0]].likelihood;
+      values[1] = field[indices[1]].likelihood;
+      values[2] = field[indices[2]].likelihood;
+      values[3] = field[indices[3]].likelihood;
+      return;
     }
 
-    index += sizeX-1;
+    if (concreteGridMap->hasProbabilityPlane()) {
+      const typename ConcreteOccGridMap::ProbabilityPlaneStorage& plane (concreteGridMap->getProbabilityPlane());
 
-    if (!cacheMethod.containsCachedData(index, intensities[2])) {
-      intensities[2] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[2]);
+      values[0] = plane[indices[0]].probability;
+      values[1] = plane[indices[1]].probability;
+      values[2] = plane[indices[2]].probability;
+      values[3] = plane[indices[3]].probability;
+      return;
     }
 
-    ++index;
+    values[0] = getCachedGridPoint(indices[0]);
+    values[1] = getCachedGridPoint(indices[1]);
+    values[2] = getCachedGridPoint(indices[2]);
+    values[3] = getCachedGridPoint(indices[3]);
+  }
 
-    if (!cacheMethod.containsCachedData(index, intensities[3])) {
-      intensities[3] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[3]);
+  float interpMapValue(const Eigen::Vector2f& coords)
+  {
+    //check if coords are within map limits.
+    if (concreteGridMap->pointOutOfMapBounds(coords)){
+      return 0.0f;
     }
 
+    //map coords are alway positive, floor them by casting to int
+    Eigen::Vector2i indMin(coords.cast<int>());
+
+    //get factors for bilinear interpolation
+    Eigen::Vector2f factors(coords - indMin.cast<float>());
+
+    // get grid values for the 4 grid points surrounding the current coords. Check cached data first, if not contained
+    // filter gridPoint with gaussian and store in cache.
+    getCachedGridNeighborhood(indMin[0], indMin[1], intensities.data());
+
     float xFacInv = (1.0f - factors[0]);
     float yFacInv = (1.0f - factors[1]);
 
@@ -297,37 +413,9 @@ public:
     //get factors for bilinear interpolation
     Eigen::Vector2f factors(coords - indMin.cast<float>());
 
-    int sizeX = concreteGridMap->getSizeX();
-
-    int index = indMin[1] * sizeX + indMin[0];
-
     // get grid values for the 4 grid points surrounding the current coords. Check cached data first, if not contained
     // filter gridPoint with gaussian and store in cache.
-    if (!cacheMethod.containsCachedData(index, intensities[0])) {
-      intensities[0] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[0]);
-    }
-
-    ++index;
-
-    if (!cacheMethod.containsCachedData(index, intensities[1])) {
-      intensities[1] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[1]);
-    }
-
-    index += sizeX-1;
-
-    if (!cacheMethod.containsCachedData(index, intensities[2])) {
-      intensities[2] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[2]);
-    }
-
-    ++index;
-
-    if (!cacheMethod.containsCachedData(index, intensities[3])) {
-      intensities[3] = getUnfilteredGridPoint(index);
-      cacheMethod.cacheData(index, intensities[3]);
-    }
+    getCachedGridNeighborhood(indMin[0], indMin[1], intensities.data());
 
     float dx1 = intensities[0] - intensities[1];
     float dx2 = intensities[2] - intensities[3];
@@ -356,11 +444,43 @@ public:
     return Eigen::Translation2f(transVector[0], transVector[1]);
   }
 
+  /**
+   * Called after the map has been updated. Also brings the likelihood field up to date.
+   */
   void resetCachedData()
   {
     cacheMethod.resetCache();
+
+    if (likelihoodField) {
+      likelihoodField->update(*concreteGridMap);
+    }
   }
 
+  /**
+   * Called after every map update that is not followed by resetCachedData(), with concurrent map updates. Lets the
+   * likelihood field collect the changed cells, so its refresh by resetCachedData() stays incremental.
+   */
+  void addMapUpdate()
+  {
+    if (likelihoodField) {
+      likelihoodField->addMapUpdate(*concreteGridMap);
+    }
+  }
+
+  /**
+   * Called after the map has been reset, the likelihood field has to be rebuilt completely.
+   */
+  void resetMapData()
+  {
+    if (likelihoodField) {
+      likelihoodField->invalidate();
+    }
+
+    resetCachedData();
+  }
+
+  ConcreteCacheMethod& getCacheMethod() { return cacheMethod; };
+
   void resetSamplePoints()
   {
     samplePoints.clear();
@@ -379,6 +499,8 @@ protected:
 
   const ConcreteOccGridMap* concreteGridMap;
 
+  GridMapLikelihoodField<ConcreteOccGridMap>* likelihoodField; ///< Matched against instead of the map if set.
+
   std::vector<Eigen::Vector3f> samplePoints;
 
   int size;
@@ -31,14 +31,10 @@
 
 #include "OccGridMapUtil.h"
 
+//the cache can be selected per map level at runtime, SLAM_USE_HASH_CACHING makes the hash cache the default
 //#define SLAM_USE_HASH_CACHING
-#ifdef SLAM_USE_HASH_CACHING
-#include "GridMapCacheHash.h"
-typedef GridMapCacheHash GridMapCacheMethod;
-#else
-#include "GridMapCacheArray.h"
-typedef GridMapCacheArray GridMapCacheMethod;
-#endif
+#include "GridMapCacheSelectable.h"
+typedef GridMapCacheSelectable GridMapCacheMethod;
 
 namespace hectorslam {
 
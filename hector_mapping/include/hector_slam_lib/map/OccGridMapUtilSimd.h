@@ -0,0 +1,361 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __OccGridMapUtilSimd_h_
+#define __OccGridMapUtilSimd_h_
+
+#include <Eigen/Core>
+
+#if !defined(SLAM_DISABLE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SLAM_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(SLAM_DISABLE_SIMD) && (defined(__ARM_NEON) || defined(__aarch64__))
+#define SLAM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace hectorslam {
+
+namespace simd {
+
+/**
+ * Parameters shared by all lanes of a batched Hessian accumulation: the 2D pose transform in map coordinates
+ * and the map limits used for the bounds check (same semantics as MapDimensionProperties::pointOutOfMapBounds).
+ */
+struct HessianKernelParams
+{
+  float cosRot;
+  float sinRot;
+  float transX;
+  float transY;
+  float mapLimitX;
+  float mapLimitY;
+};
+
+/**
+ * Number of scan points processed per step by the vector kernel available on this CPU, 1 if only the scalar path
+ * can be used. The result of the CPU feature detection is computed once.
+ */
+inline int hessianKernelWidth()
+{
+#if defined(SLAM_SIMD_AVX2)
+  static const int width = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? 8 : 1;
+  return width;
+#elif defined(SLAM_SIMD_NEON)
+  return 4;
+#else
+  return 1;
+#endif
+}
+
+#if defined(SLAM_SIMD_AVX2)
+
+__attribute__((target("avx2,fma")))
+inline float horizontalSum(__m256 v)
+{
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+  return _mm_cvtss_f32(sum);
+}
+
+/**
+ * Accumulates H, dTr and the squared residual sum(1 - M(p))^2 for the scan points (xs[i], ys[i]) eight at a time. The pose transform, bounds check,
+ * bilinear interpolation and derivative computation run lane-wise, only the lookup of the 2x2 cell neighborhood
+ * of each point is done through gridNeighborhood(x, y, values) so the cell layout and caching of the calling
+ * OccGridMapUtil are kept. Out of bounds points contribute zero, exactly like in the scalar path.
+ */
+template<typename GridNeighborhoodFunctor>
+__attribute__((target("avx2,fma")))
+void accumulateHessianAvx2(const float* xs, const float* ys, int size, const HessianKernelParams& params,
+                           GridNeighborhoodFunctor& gridNeighborhood, Eigen::Matrix3f& H, Eigen::Vector3f& dTr,
+                           float& residual)
+{
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 cosRot = _mm256_set1_ps(params.cosRot);
+  const __m256 sinRot = _mm256_set1_ps(params.sinRot);
+  const __m256 transX = _mm256_set1_ps(params.transX);
+  const __m256 transY = _mm256_set1_ps(params.transY);
+  const __m256 limitX = _mm256_set1_ps(params.mapLimitX);
+  const __m256 limitY = _mm256_set1_ps(params.mapLimitY);
+  const __m256i laneIds = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  __m256 h00 = zero, h11 = zero, h22 = zero, h01 = zero, h02 = zero, h12 = zero;
+  __m256 d0 = zero, d1 = zero, d2 = zero;
+  __m256 r = zero;
+
+  alignas(32) int indicesX[8];
+  alignas(32) int indicesY[8];
+  alignas(32) int inBounds[8];
+  alignas(32) float intensities[4][8];
+  float values[4];
+
+  for (int i = 0; i < size; i += 8) {
+
+    int remaining = size - i;
+
+    __m256 x, y;
+    __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), laneIds);
+
+    if (remaining >= 8) {
+      x = _mm256_loadu_ps(xs + i);
+      y = _mm256_loadu_ps(ys + i);
+    } else {
+      x = _mm256_maskload_ps(xs + i, valid);
+      y = _mm256_maskload_ps(ys + i, valid);
+    }
+
+    __m256 mapX = _mm256_fmadd_ps(cosRot, x, _mm256_fnmadd_ps(sinRot, y, transX));
+    __m256 mapY = _mm256_fmadd_ps(sinRot, x, _mm256_fmadd_ps(cosRot, y, transY));
+
+    __m256 inMap = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(mapX, zero, _CMP_GE_OQ), _mm256_cmp_ps(mapX, limitX, _CMP_LE_OQ)),
+                                 _mm256_and_ps(_mm256_cmp_ps(mapY, zero, _CMP_GE_OQ), _mm256_cmp_ps(mapY, limitY, _CMP_LE_OQ)));
+    inMap = _mm256_and_ps(inMap, _mm256_castsi256_ps(valid));
+
+    //map coords are always positive inside the map, truncation floors them
+    __m256i indMinX = _mm256_cvttps_epi32(_mm256_and_ps(mapX, inMap));
+    __m256i indMinY = _mm256_cvttps_epi32(_mm256_and_ps(mapY, inMap));
+
+    __m256 factorX = _mm256_sub_ps(mapX, _mm256_cvtepi32_ps(indMinX));
+    __m256 factorY = _mm256_sub_ps(mapY, _mm256_cvtepi32_ps(indMinY));
+
+    _mm256_store_si256(reinterpret_cast<__m256i*>(indicesX), indMinX);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(indicesY), indMinY);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(inBounds), _mm256_castps_si256(inMap));
+
+    for (int lane = 0; lane < 8; ++lane) {
+      if (inBounds[lane]) {
+        gridNeighborhood(indicesX[lane], indicesY[lane], values);
+        intensities[0][lane] = values[0];
+        intensities[1][lane] = values[1];
+        intensities[2][lane] = values[2];
+        intensities[3][lane] = values[3];
+      } else {
+        intensities[0][lane] = 0.0f;
+        intensities[1][lane] = 0.0f;
+        intensities[2][lane] = 0.0f;
+        intensities[3][lane] = 0.0f;
+      }
+    }
+
+    __m256 i0 = _mm256_load_ps(intensities[0]);
+    __m256 i1 = _mm256_load_ps(intensities[1]);
+    __m256 i2 = _mm256_load_ps(intensities[2]);
+    __m256 i3 = _mm256_load_ps(intensities[3]);
+
+    __m256 xFacInv = _mm256_sub_ps(one, factorX);
+    __m256 yFacInv = _mm256_sub_ps(one, factorY);
+
+    __m256 value = _mm256_fmadd_ps(_mm256_fmadd_ps(i0, xFacInv, _mm256_mul_ps(i1, factorX)), yFacInv,
+                                   _mm256_mul_ps(_mm256_fmadd_ps(i2, xFacInv, _mm256_mul_ps(i3, factorX)), factorY));
+
+    //out of bounds lanes have zero intensities and therefore zero derivatives
+    __m256 derivX = _mm256_fmadd_ps(_mm256_sub_ps(i1, i0), xFacInv, _mm256_mul_ps(_mm256_sub_ps(i3, i2), factorX));
+    __m256 derivY = _mm256_fmadd_ps(_mm256_sub_ps(i2, i0), yFacInv, _mm256_mul_ps(_mm256_sub_ps(i3, i1), factorY));
+
+    __m256 funVal = _mm256_sub_ps(one, value);
+
+    __m256 rotDeriv = _mm256_fmadd_ps(_mm256_fnmsub_ps(sinRot, x, _mm256_mul_ps(cosRot, y)), derivX,
+                                      _mm256_mul_ps(_mm256_fnmadd_ps(sinRot, y, _mm256_mul_ps(cosRot, x)), derivY));
+
+    //lanes past the end of the scan must not add to the residual
+    __m256 validFunVal = _mm256_and_ps(funVal, _mm256_castsi256_ps(valid));
+    r = _mm256_fmadd_ps(validFunVal, validFunVal, r);
+
+    d0 = _mm256_fmadd_ps(derivX, funVal, d0);
+    d1 = _mm256_fmadd_ps(derivY, funVal, d1);
+    d2 = _mm256_fmadd_ps(rotDeriv, funVal, d2);
+
+    h00 = _mm256_fmadd_ps(derivX, derivX, h00);
+    h11 = _mm256_fmadd_ps(derivY, derivY, h11);
+    h22 = _mm256_fmadd_ps(rotDeriv, rotDeriv, h22);
+    h01 = _mm256_fmadd_ps(derivX, derivY, h01);
+    h02 = _mm256_fmadd_ps(derivX, rotDeriv, h02);
+    h12 = _mm256_fmadd_ps(derivY, rotDeriv, h12);
+  }
+
+  dTr[0] = horizontalSum(d0);
+  dTr[1] = horizontalSum(d1);
+  dTr[2] = horizontalSum(d2);
+
+  H(0, 0) = horizontalSum(h00);
+  H(1, 1) = horizontalSum(h11);
+  H(2, 2) = horizontalSum(h22);
+  H(0, 1) = H(1, 0) = horizontalSum(h01);
+  H(0, 2) = H(2, 0) = horizontalSum(h02);
+  H(1, 2) = H(2, 1) = horizontalSum(h12);
+
+  residual = horizontalSum(r);
+}
+
+#elif defined(SLAM_SIMD_NEON)
+
+inline float horizontalSum(float32x4_t v)
+{
+  float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+
+/**
+ * NEON variant of accumulateHessianAvx2, processing four scan points per step.
+ */
+template<typename GridNeighborhoodFunctor>
+void accumulateHessianNeon(const float* xs, const float* ys, int size, const HessianKernelParams& params,
+                           GridNeighborhoodFunctor& gridNeighborhood, Eigen::Matrix3f& H, Eigen::Vector3f& dTr,
+                           float& residual)
+{
+  const int32_t laneIdArray[4] = {0, 1, 2, 3};
+  const int32x4_t laneIds = vld1q_s32(laneIdArray);
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  const float32x4_t cosRot = vdupq_n_f32(params.cosRot);
+  const float32x4_t sinRot = vdupq_n_f32(params.sinRot);
+  const float32x4_t transX = vdupq_n_f32(params.transX);
+  const float32x4_t transY = vdupq_n_f32(params.transY);
+  const float32x4_t limitX = vdupq_n_f32(params.mapLimitX);
+  const float32x4_t limitY = vdupq_n_f32(params.mapLimitY);
+
+  float32x4_t h00 = zero, h11 = zero, h22 = zero, h01 = zero, h02 = zero, h12 = zero;
+  float32x4_t d0 = zero, d1 = zero, d2 = zero;
+  float32x4_t r = zero;
+
+  int32_t indicesX[4];
+  int32_t indicesY[4];
+  uint32_t inBounds[4];
+  float intensities[4][4];
+  float values[4];
+  float tailX[4];
+  float tailY[4];
+
+  for (int i = 0; i < size; i += 4) {
+
+    int remaining = size - i;
+
+    float32x4_t x, y;
+
+    if (remaining >= 4) {
+      x = vld1q_f32(xs + i);
+      y = vld1q_f32(ys + i);
+    } else {
+      for (int lane = 0; lane < 4; ++lane) {
+        tailX[lane] = lane < remaining ? xs[i + lane] : 0.0f;
+        tailY[lane] = lane < remaining ? ys[i + lane] : 0.0f;
+      }
+      x = vld1q_f32(tailX);
+      y = vld1q_f32(tailY);
+    }
+
+    float32x4_t mapX = vmlaq_f32(vmlsq_f32(transX, sinRot, y), cosRot, x);
+    float32x4_t mapY = vmlaq_f32(vmlaq_f32(transY, cosRot, y), sinRot, x);
+
+    uint32x4_t inMap = vandq_u32(vandq_u32(vcgeq_f32(mapX, zero), vcleq_f32(mapX, limitX)),
+                                 vandq_u32(vcgeq_f32(mapY, zero), vcleq_f32(mapY, limitY)));
+
+    int32x4_t indMinX = vcvtq_s32_f32(vbslq_f32(inMap, mapX, zero));
+    int32x4_t indMinY = vcvtq_s32_f32(vbslq_f32(inMap, mapY, zero));
+
+    float32x4_t factorX = vsubq_f32(mapX, vcvtq_f32_s32(indMinX));
+    float32x4_t factorY = vsubq_f32(mapY, vcvtq_f32_s32(indMinY));
+
+    vst1q_s32(indicesX, indMinX);
+    vst1q_s32(indicesY, indMinY);
+    vst1q_u32(inBounds, inMap);
+
+    for (int lane = 0; lane < 4; ++lane) {
+      if (lane < remaining && inBounds[lane]) {
+        gridNeighborhood(indicesX[lane], indicesY[lane], values);
+        intensities[0][lane] = values[0];
+        intensities[1][lane] = values[1];
+        intensities[2][lane] = values[2];
+        intensities[3][lane] = values[3];
+      } else {
+        intensities[0][lane] = 0.0f;
+        intensities[1][lane] = 0.0f;
+        intensities[2][lane] = 0.0f;
+        intensities[3][lane] = 0.0f;
+      }
+    }
+
+    float32x4_t i0 = vld1q_f32(intensities[0]);
+    float32x4_t i1 = vld1q_f32(intensities[1]);
+    float32x4_t i2 = vld1q_f32(intensities[2]);
+    float32x4_t i3 = vld1q_f32(intensities[3]);
+
+    float32x4_t xFacInv = vsubq_f32(one, factorX);
+    float32x4_t yFacInv = vsubq_f32(one, factorY);
+
+    float32x4_t value = vaddq_f32(vmulq_f32(vmlaq_f32(vmulq_f32(i1, factorX), i0, xFacInv), yFacInv),
+                                  vmulq_f32(vmlaq_f32(vmulq_f32(i3, factorX), i2, xFacInv), factorY));
+
+    float32x4_t derivX = vmlaq_f32(vmulq_f32(vsubq_f32(i3, i2), factorX), vsubq_f32(i1, i0), xFacInv);
+    float32x4_t derivY = vmlaq_f32(vmulq_f32(vsubq_f32(i3, i1), factorY), vsubq_f32(i2, i0), yFacInv);
+
+    float32x4_t funVal = vsubq_f32(one, value);
+
+    float32x4_t rotDeriv = vmlaq_f32(vmulq_f32(vmlsq_f32(vmulq_f32(cosRot, x), sinRot, y), derivY),
+                                     vnegq_f32(vmlaq_f32(vmulq_f32(cosRot, y), sinRot, x)), derivX);
+
+    //lanes past the end of the scan must not add to the residual
+    uint32x4_t valid = vcltq_s32(laneIds, vdupq_n_s32(remaining));
+    float32x4_t validFunVal = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(funVal), valid));
+    r = vmlaq_f32(r, validFunVal, validFunVal);
+
+    d0 = vmlaq_f32(d0, derivX, funVal);
+    d1 = vmlaq_f32(d1, derivY, funVal);
+    d2 = vmlaq_f32(d2, rotDeriv, funVal);
+
+    h00 = vmlaq_f32(h00, derivX, derivX);
+    h11 = vmlaq_f32(h11, derivY, derivY);
+    h22 = vmlaq_f32(h22, rotDeriv, rotDeriv);
+    h01 = vmlaq_f32(h01, derivX, derivY);
+    h02 = vmlaq_f32(h02, derivX, rotDeriv);
+    h12 = vmlaq_f32(h12, derivY, rotDeriv);
+  }
+
+  dTr[0] = horizontalSum(d0);
+  dTr[1] = horizontalSum(d1);
+  dTr[2] = horizontalSum(d2);
+
+  H(0, 0) = horizontalSum(h00);
+  H(1, 1) = horizontalSum(h11);
+  H(2, 2) = horizontalSum(h22);
+  H(0, 1) = H(1, 0) = horizontalSum(h01);
+  H(0, 2) = H(2, 0) = horizontalSum(h02);
+  H(1, 2) = H(2, 1) = horizontalSum(h12);
+
+  residual = horizontalSum(r);
+}
+
+#endif
+
+}
+
+}
+
+#endif
@@ -0,0 +1,389 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef _correlativescanmatcher_h__
+#define _correlativescanmatcher_h__
+
+#include <Eigen/Geometry>
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <stdint.h>
+
+#include "../scan/DataPointContainer.h"
+
+namespace hectorslam{
+
+/**
+ * Global scan matcher for relocalization. Exhaustively searches a window in (x, y, theta) around a pose hint for the
+ * pose maximizing the mean occupancy probability of the scan endpoints, using branch-and-bound over a stack of
+ * max-pooled copies of the map (see Hess et al., "Real-Time Loop Closure in 2D LIDAR SLAM"). Level h of the stack
+ * holds the maximum over 2^h x 2^h cell windows, so scoring a scan against it bounds the score of all translations
+ * inside that window from above and whole subtrees of candidates can be pruned.
+ * The result is only as accurate as the map cells and angular step, it is meant to be refined by ScanMatcher.
+ */
+template<typename ConcreteOccGridMap>
+class CorrelativeScanMatcher
+{
+public:
+
+  CorrelativeScanMatcher(int branchAndBoundDepthIn = 7)
+    : branchAndBoundDepth(branchAndBoundDepthIn)
+    , precomputedMap(0)
+    , precomputedUpdateIndex(-1)
+  {}
+
+  /**
+   * Makes the next match() rebuild the pooled grids. Has to be called when the map changed without a new update
+   * index, e.g. after a reset.
+   */
+  void invalidate()
+  {
+    precomputedMap = 0;
+  }
+
+  /**
+   * Searches the pose of the scan in gridMap.
+   * @param hintMap Center of the search window as pose in map coordinates
+   * @param dataContainer Scan points in map coordinates of gridMap
+   * @param linearWindow Half edge length of the square search window in map cells
+   * @param angularWindow Half width of the angular search window in radians, M_PI for a full rotation
+   * @param poseMap Best pose found, in map coordinates
+   * @return Mean probability of the scan endpoints at the best pose, 0 if no pose was found
+   */
+  float match(const ConcreteOccGridMap& gridMap, const DataContainer& dataContainer, const Eigen::Vector3f& hintMap,
+              float linearWindow, float angularWindow, Eigen::Vector3f& poseMap)
+  {
+    poseMap = hintMap;
+
+    filterScan(dataContainer);
+
+    if (points.empty()) {
+      return 0.0f;
+    }
+
+    precomputeGrids(gridMap);
+
+    if (pooledGrids.empty()) {
+      return 0.0f;
+    }
+
+    //angular step moving the farthest endpoint by about one cell
+    float maxRange = 1.0f;
+    for (size_t i = 0; i < points.size(); ++i) {
+      maxRange = std::max(maxRange, points[i].norm());
+    }
+
+    float angularStep = std::acos(1.0f - 1.0f / (2.0f * maxRange * maxRange));
+    int numAngularSteps = static_cast<int>(std::ceil(std::min(angularWindow, static_cast<float>(M_PI)) / angularStep));
+
+    int linearSteps = static_cast<int>(std::ceil(linearWindow));
+
+    discretizeScans(hintMap, angularStep, numAngularSteps);
+
+    //top level candidates cover the search window with tiles of the coarsest pooled grid
+    int topHeight = static_cast<int>(pooledGrids.size()) - 1;
+    int topStep = 1 << topHeight;
+
+    std::vector<Candidate> candidates;
+
+    for (int rotation = 0; rotation < static_cast<int>(discreteScans.size()); ++rotation) {
+      for (int offsetY = -linearSteps; offsetY <= linearSteps; offsetY += topStep) {
+        for (int offsetX = -linearSteps; offsetX <= linearSteps; offsetX += topStep) {
+          candidates.push_back(Candidate(rotation, offsetX, offsetY));
+        }
+      }
+    }
+
+    scoreCandidates(topHeight, candidates);
+
+    Candidate best (0, 0, 0);
+    best.score = 0;
+
+    branchAndBound(candidates, topHeight, linearSteps, best);
+
+    if (best.score == 0) {
+      return 0.0f;
+    }
+
+    poseMap = Eigen::Vector3f(hintMap.x() + static_cast<float>(best.offsetX),
+                              hintMap.y() + static_cast<float>(best.offsetY),
+                              hintMap.z() + static_cast<float>(best.rotation - numAngularSteps) * angularStep);
+
+    return static_cast<float>(best.score) / (255.0f * static_cast<float>(points.size()));
+  }
+
+protected:
+
+  struct Candidate
+  {
+    Candidate(int rotationIn, int offsetXIn, int offsetYIn)
+      : rotation(rotationIn)
+      , offsetX(offsetXIn)
+      , offsetY(offsetYIn)
+      , score(0)
+    {}
+
+    bool operator>(const Candidate& other) const { return score > other.score; };
+
+    int rotation;
+    int offsetX;
+    int offsetY;
+    int score;
+  };
+
+  /**
+   * Max-pooled grid: cell (x,y) holds the maximum probability (scaled to 0-255) of the map cells in
+   * [x, x+2^h) x [y, y+2^h).
+   */
+  struct PooledGrid
+  {
+    int originX;
+    int originY;
+    int sizeX;
+    int sizeY;
+    std::vector<uint8_t> cells;
+
+    int get(int x, int y) const
+    {
+      x -= originX;
+      y -= originY;
+
+      if ((x < 0) || (y < 0) || (x >= sizeX) || (y >= sizeY)) {
+        return 0;
+      }
+
+      return cells[y * sizeX + x];
+    }
+  };
+
+  /**
+   * Drops scan points falling into the same map cell as one of the preceding points. On coarse maps this removes
+   * most points without changing the result.
+   */
+  void filterScan(const DataContainer& dataContainer)
+  {
+    points.clear();
+
+    std::vector<std::pair<int, int> > occupiedCells;
+
+    int size = dataContainer.getSize();
+
+    for (int i = 0; i < size; ++i) {
+      Eigen::Vector2f point (dataContainer.getVecEntry(i));
+      std::pair<int, int> cell (static_cast<int>(std::floor(point.x() + 0.5f)), static_cast<int>(std::floor(point.y() + 0.5f)));
+
+      if (std::find(occupiedCells.end() - std::min<size_t>(occupiedCells.size(), 4), occupiedCells.end(), cell) == occupiedCells.end()) {
+        occupiedCells.push_back(cell);
+        points.push_back(point);
+      }
+    }
+  }
+
+  void discretizeScans(const Eigen::Vector3f& hintMap, float angularStep, int numAngularSteps)
+  {
+    int numRotations = 2 * numAngularSteps + 1;
+
+    discreteScans.resize(numRotations);
+
+    for (int rotation = 0; rotation < numRotations; ++rotation) {
+      float angle = hintMap.z() + static_cast<float>(rotation - numAngularSteps) * angularStep;
+
+      Eigen::Affine2f transform (Eigen::Translation2f(hintMap.x(), hintMap.y()) * Eigen::Rotation2Df(angle));
+
+      std::vector<Eigen::Vector2i>& discreteScan (discreteScans[rotation]);
+      discreteScan.resize(points.size());
+
+      for (size_t i = 0; i < points.size(); ++i) {
+        Eigen::Vector2f mapPoint (transform * points[i]);
+        discreteScan[i] = Eigen::Vector2i(static_cast<int>(std::floor(mapPoint.x() + 0.5f)), static_cast<int>(std::floor(mapPoint.y() + 0.5f)));
+      }
+    }
+  }
+
+  void scoreCandidates(int height, std::vector<Candidate>& candidates) const
+  {
+    const PooledGrid& grid (pooledGrids[height]);
+
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      Candidate& candidate (candidates[c]);
+      const std::vector<Eigen::Vector2i>& discreteScan (discreteScans[candidate.rotation]);
+
+      int score = 0;
+
+      for (size_t i = 0; i < discreteScan.size(); ++i) {
+        score += grid.get(discreteScan[i].x() + candidate.offsetX, discreteScan[i].y() + candidate.offsetY);
+      }
+
+      candidate.score = score;
+    }
+
+    std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+  }
+
+  void branchAndBound(const std::vector<Candidate>& candidates, int height, int linearSteps, Candidate& best) const
+  {
+    if (height == 0) {
+      if (!candidates.empty() && (candidates.front().score > best.score)) {
+        best = candidates.front();
+      }
+      return;
+    }
+
+    int halfStep = 1 << (height - 1);
+
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      const Candidate& candidate (candidates[c]);
+
+      //candidates are sorted, none of the remaining ones can beat the best solution
+      if (candidate.score <= best.score) {
+        break;
+      }
+
+      std::vector<Candidate> children;
+
+      for (int dy = 0; dy <= halfStep; dy += halfStep) {
+        for (int dx = 0; dx <= halfStep; dx += halfStep) {
+          if ((candidate.offsetX + dx <= linearSteps) && (candidate.offsetY + dy <= linearSteps)) {
+            children.push_back(Candidate(candidate.rotation, candidate.offsetX + dx, candidate.offsetY + dy));
+          }
+        }
+      }
+
+      scoreCandidates(height - 1, children);
+      branchAndBound(children, height - 1, linearSteps, best);
+    }
+  }
+
+  /**
+   * Builds the pooled grids over the allocated part of the map, unless they are up to date already.
+   */
+  void precomputeGrids(const ConcreteOccGridMap& gridMap)
+  {
+    if ((precomputedMap == &gridMap) && (precomputedUpdateIndex == gridMap.getUpdateIndex())) {
+      return;
+    }
+
+    precomputedMap = &gridMap;
+    precomputedUpdateIndex = gridMap.getUpdateIndex();
+
+    pooledGrids.clear();
+
+    Eigen::Vector2i minCell, maxCell;
+
+    if (!gridMap.getAllocatedBounds(minCell, maxCell)) {
+      return;
+    }
+
+    pooledGrids.resize(branchAndBoundDepth);
+
+    PooledGrid probabilities;
+    probabilities.originX = minCell.x();
+    probabilities.originY = minCell.y();
+    probabilities.sizeX = maxCell.x() - minCell.x() + 1;
+    probabilities.sizeY = maxCell.y() - minCell.y() + 1;
+    probabilities.cells.resize(probabilities.sizeX * probabilities.sizeY);
+
+    for (int y = 0; y < probabilities.sizeY; ++y) {
+      for (int x = 0; x < probabilities.sizeX; ++x) {
+        float probability = gridMap.getGridProbabilityMap(probabilities.originX + x, probabilities.originY + y);
+        probabilities.cells[y * probabilities.sizeX + x] = static_cast<uint8_t>(probability * 255.0f + 0.5f);
+      }
+    }
+
+    //Candidate poses lie on a lattice anchored at the hint, so the best one can be up to half a cell and half an
+    //angular step off the true pose. On thin walls that costs more score than a wrong but cell aligned pose would,
+    //so the base level holds the maximum of the 3x3 neighbourhood and ScanMatcher recovers sub-cell accuracy.
+    PooledGrid& base (pooledGrids[0]);
+    base.originX = probabilities.originX - 1;
+    base.originY = probabilities.originY - 1;
+    base.sizeX = probabilities.sizeX + 2;
+    base.sizeY = probabilities.sizeY + 2;
+    base.cells.resize(base.sizeX * base.sizeY);
+
+    for (int y = 0; y < base.sizeY; ++y) {
+      int mapY = base.originY + y;
+
+      for (int x = 0; x < base.sizeX; ++x) {
+        int mapX = base.originX + x;
+
+        int val = 0;
+
+        for (int dy = -1; dy <= 1; ++dy) {
+          for (int dx = -1; dx <= 1; ++dx) {
+            val = std::max(val, probabilities.get(mapX + dx, mapY + dy));
+          }
+        }
+
+        base.cells[y * base.sizeX + x] = static_cast<uint8_t>(val);
+      }
+    }
+
+    //window 2^h is the maximum of four windows 2^(h-1), shifted by 0 or 2^(h-1) in x and y
+    for (int height = 1; height < branchAndBoundDepth; ++height) {
+      const PooledGrid& lower (pooledGrids[height - 1]);
+      PooledGrid& grid (pooledGrids[height]);
+
+      int halfStep = 1 << (height - 1);
+
+      grid.originX = lower.originX - halfStep;
+      grid.originY = lower.originY - halfStep;
+      grid.sizeX = lower.sizeX + halfStep;
+      grid.sizeY = lower.sizeY + halfStep;
+      grid.cells.resize(grid.sizeX * grid.sizeY);
+
+      for (int y = 0; y < grid.sizeY; ++y) {
+        int mapY = grid.originY + y;
+
+        for (int x = 0; x < grid.sizeX; ++x) {
+          int mapX = grid.originX + x;
+
+          int val = std::max(std::max(lower.get(mapX, mapY), lower.get(mapX + halfStep, mapY)),
+                             std::max(lower.get(mapX, mapY + halfStep), lower.get(mapX + halfStep, mapY + halfStep)));
+
+          grid.cells[y * grid.sizeX + x] = static_cast<uint8_t>(val);
+        }
+      }
+    }
+  }
+
+  int branchAndBoundDepth;
+
+  const ConcreteOccGridMap* precomputedMap;
+  int precomputedUpdateIndex;
+  std::vector<PooledGrid> pooledGrids;
+
+  std::vector<Eigen::Vector2f> points;
+  std::vector<std::vector<Eigen::Vector2i> > discreteScans;
+};
+
+}
+
+#endif
@@ -30,6 +30,9 @@
 #define _scanmatcher_h__
 
 #include <Eigen/Geometry>
+#include <chrono>
+#include <iostream>
+
 #include "../scan/DataPointContainer.h"
 #include "../util/UtilFunctions.h"
 
@@ -38,19 +41,60 @@
 
 namespace hectorslam{
 
+/**
+ * Reasons for ScanMatcher::matchData to stop iterating, reported through HectorDebugInfoInterface::addMatchResult.
+ */
+enum ScanMatchTermination
+{
+  ScanMatchMaxIterations = 0,     ///< All iterations were used
+  ScanMatchStepConverged = 1,     ///< The last step was below the translation and angle thresholds
+  ScanMatchResidualConverged = 2, ///< The residual changed less than the relative residual threshold
+  ScanMatchTimeBudget = 3,        ///< The deadline for matching the current scan has passed
+  ScanMatchDegenerate = 4         ///< The Hessian was singular, the estimate could not be updated
+};
+
 template<typename ConcreteOccGridMapUtil>
 class ScanMatcher
 {
 public:
 
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
   ScanMatcher(DrawInterface* drawInterfaceIn = 0, HectorDebugInfoInterface* debugInterfaceIn = 0)
     : drawInterface(drawInterfaceIn)
     , debugInterface(debugInterfaceIn)
+    , minStepTranslation(0.0f)
+    , minStepAngle(0.0f)
+    , minResidualChange(0.0f)
+    , useLevenbergMarquardt(false)
+    , deadline(TimePoint::max())
   {}
 
   ~ScanMatcher()
   {}
 
+  /**
+   * Sets the thresholds for stopping the iteration early. Translation is given in map cells of the matched map,
+   * angle in radians, the residual change relative to the previous residual. Thresholds of zero disable the test.
+   */
+  void setConvergenceThresholds(float minStepTranslationIn, float minStepAngleIn, float minResidualChangeIn)
+  {
+    minStepTranslation = minStepTranslationIn;
+    minStepAngle = minStepAngleIn;
+    minResidualChange = minResidualChangeIn;
+  }
+
+  /**
+   * Enables Levenberg-Marquardt damping of the Gauss-Newton steps. Steps that increase the residual are taken back
+   * and retried with stronger damping.
+   */
+  void setUseLevenbergMarquardt(bool useLM) { useLevenbergMarquardt = useLM; };
+
+  /**
+   * Sets the point in time after which no further iterations are started. At least one iteration is always done.
+   */
+  void setDeadline(const TimePoint& deadlineIn) { deadline = deadlineIn; };
+
   Eigen::Vector3f matchData(const Eigen::Vector3f& beginEstimateWorld, ConcreteOccGridMapUtil& gridMapUtil, const DataContainer& dataContainer, Eigen::Matrix3f& covMatrix, int maxIterations)
   {
     if (drawInterface){
@@ -71,9 +115,6 @@ public:
 
       Eigen::Vector3f estimate(beginEstimateMap);
 
-      estimateTransformationLogLh(estimate, gridMapUtil, dataContainer);
-      //bool notConverged = estimateTransformationLogLh(estimate, gridMapUtil, dataContainer);
-
       /*
       const Eigen::Matrix2f& hessian (H.block<2,2>(0,0));
 
@@ -88,14 +129,63 @@ public:
       //std::cout << "\n cond: " << cond << " det: " << determinant << "\n";
 
 
-      int numIter = maxIterations;
+      //one initial step followed by up to maxIterations further steps
+      int numIter = maxIterations + 1;
+
+      ScanMatchTermination termination = ScanMatchMaxIterations;
+
+      float residual = 0.0f;
+      float lastResidual = -1.0f;
+      const float lmLambdaMin = 1e-6f;
+      float lmLambda = 1e-3f;
 
+      Eigen::Vector3f lastEstimate(estimate);
+      Eigen::Matrix3f lastH(Eigen::Matrix3f::Zero());
+      Eigen::Vector3f lastdTr(Eigen::Vector3f::Zero());
 
-      for (int i = 0; i < numIter; ++i) {
+      int i = 0;
+
+      for (; i < numIter; ++i) {
         //std::cout << "\nest:\n" << estimate;
 
-        estimateTransformationLogLh(estimate, gridMapUtil, dataContainer);
-        //notConverged = estimateTransformationLogLh(estimate, gridMapUtil, dataContainer);
+        if ((i > 0) && (std::chrono::steady_clock::now() > deadline)) {
+          termination = ScanMatchTimeBudget;
+          break;
+        }
+
+        gridMapUtil.getCompleteHessianDerivs(estimate, dataContainer, H, dTr, residual);
+
+        bool stepRejected = false;
+
+        if (useLevenbergMarquardt && (lastResidual >= 0.0f)) {
+          if (residual > lastResidual) {
+            //last step made things worse, go back and retry with stronger damping
+            estimate = lastEstimate;
+            H = lastH;
+            dTr = lastdTr;
+            residual = lastResidual;
+            lmLambda *= 10.0f;
+            stepRejected = true;
+          } else {
+            lmLambda = std::max(lmLambda * 0.1f, lmLambdaMin);
+          }
+        }
+
+        bool residualConverged = !stepRejected && (minResidualChange > 0.0f) && (lastResidual >= 0.0f) &&
+                                 (std::abs(lastResidual - residual) <= minResidualChange * lastResidual);
+
+        lastEstimate = estimate;
+        lastH = H;
+        lastdTr = dTr;
+        lastResidual = residual;
+
+        Eigen::Vector3f searchDir;
+
+        if (!estimateTransformationLogLh(estimate, searchDir, useLevenbergMarquardt ? lmLambda : 0.0f)) {
+          termination = ScanMatchDegenerate;
+          ++i;
+          break;
+        }
 
         if(drawInterface){
           float invNumIterf = 1.0f/static_cast<float> (numIter);
@@ -107,6 +197,22 @@ public:
         if(debugInterface){
           debugInterface->addHessianMatrix(H);
         }
+
+        if (residualConverged) {
+          termination = ScanMatchResidualConverged;
+          ++i;
+          break;
+        }
+
+        if (!stepRejected && (searchDir.head<2>().norm() < minStepTranslation) && (std::abs(searchDir[2]) < minStepAngle)) {
+          termination = ScanMatchStepConverged;
+          ++i;
+          break;
+        }
+      }
+
+      if (debugInterface){
+        debugInterface->addMatchResult(i, static_cast<int>(termination), residual);
       }
 
       if (drawInterface){
@@ -191,27 +297,33 @@ public:
 
 protected:
 
-  bool estimateTransformationLogLh(Eigen::Vector3f& estimate, ConcreteOccGridMapUtil& gridMapUtil, const DataContainer& dataPoints)
+  /**
+   * Computes the (optionally damped) Gauss-Newton step from the current H and dTr and applies it to estimate.
+   * @param lambda Levenberg-Marquardt damping factor, zero for plain Gauss-Newton
+   */
+  bool estimateTransformationLogLh(Eigen::Vector3f& estimate, Eigen::Vector3f& searchDir, float lambda)
   {
-    gridMapUtil.getCompleteHessianDerivs(estimate, dataPoints, H, dTr);
     //std::cout << "\nH\n" << H  << "\n";
     //std::cout << "\ndTr\n" << dTr  << "\n";
 
 
     if ((H(0, 0) != 0.0f) && (H(1, 1) != 0.0f)) {
 
-
-      //H += Eigen::Matrix3f::Identity() * 1.0f;
-      Eigen::Vector3f searchDir (H.inverse() * dTr);
+      if (lambda > 0.0f) {
+        Eigen::Matrix3f dampedH (H);
+        dampedH.diagonal() *= (1.0f + lambda);
+        searchDir = dampedH.inverse() * dTr;
+      } else {
+        //H += Eigen::Matrix3f::Identity() * 1.0f;
+        searchDir = H.inverse() * dTr;
+      }
 
       //std::cout << "\nsearchdir\n" << searchDir  << "\n";
 
       if (searchDir[2] > 0.2f) {
         searchDir[2] = 0.2f;
-        std::cout << "SearchDir angle change too large\n";
       } else if (searchDir[2] < -0.2f) {
         searchDir[2] = -0.2f;
-        std::cout << "SearchDir angle change too large\n";
       }
 
       updateEstimatedPose(estimate, searchDir);
@@ -244,6 +356,14 @@ protected:
 
   DrawInterface* drawInterface;
   HectorDebugInfoInterface* debugInterface;
+
+  float minStepTranslation;
+  float minStepAngle;
+  float minResidualChange;
+
+  bool useLevenbergMarquardt;
+
+  TimePoint deadline;
 };
 
 }
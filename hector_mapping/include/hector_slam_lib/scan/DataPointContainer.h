@@ -31,6 +31,8 @@
 
 #include <vector>
 
+#include "DataPointContainerSoA.h"
+
 namespace hectorslam {
 
 template<typename DataPointType>
@@ -93,7 +95,7 @@ protected:
   DataPointType origo;
 };
 
-typedef DataPointContainer<Eigen::Vector2f> DataContainer;
+typedef DataPointContainerSoA DataContainer;
 
 }
 
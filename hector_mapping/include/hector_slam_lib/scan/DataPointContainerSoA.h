@@ -0,0 +1,233 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __DataPointContainerSoA_h_
+#define __DataPointContainerSoA_h_
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "../util/AlignedAllocator.h"
+
+namespace hectorslam {
+
+/**
+ * Structure-of-arrays storage for 2D scan points. The x and y coordinates are kept in separate 32 byte aligned arrays
+ * whose length is always padded to a multiple of SimdWidth, so vector kernels can load full registers up to the end
+ * of the scan. Capacity is only ever grown, so refilling the container (and deriving scaled copies for coarser map
+ * levels with setFrom()) does not touch the heap once it has reached the size of a typical scan.
+ * Beams start at the origin (origo) by default. Scans of several sensors can be fused into one container, the points
+ * are then grouped by the origin of their sensor (see addOrigo()).
+ */
+class DataPointContainerSoA
+{
+public:
+
+  enum { SimdWidth = 8 };
+
+  typedef std::vector<float, util::AlignedAllocator<float, 32> > CoordinateArray;
+
+  DataPointContainerSoA(int size = 1000)
+    : numPoints(0)
+    , origo(Eigen::Vector2f::Zero())
+  {
+    reserve(size);
+  }
+
+  /**
+   * Sets this container to a copy of other with all points (and the origin) scaled by factor.
+   */
+  void setFrom(const DataPointContainerSoA& other, float factor)
+  {
+    origo = other.getOrigo()*factor;
+
+    extraOrigos.resize(other.extraOrigos.size());
+    extraOrigoBegins = other.extraOrigoBegins;
+
+    for (size_t i = 0; i < extraOrigos.size(); ++i){
+      extraOrigos[i] = other.extraOrigos[i]*factor;
+    }
+
+    numPoints = other.numPoints;
+    reserve(numPoints);
+
+    const float* otherX = other.getX();
+    const float* otherY = other.getY();
+
+    float* dstX = &xs[0];
+    float* dstY = &ys[0];
+
+    int paddedSize = getPaddedSize();
+
+    for (int i = 0; i < paddedSize; ++i){
+      dstX[i] = otherX[i] * factor;
+      dstY[i] = otherY[i] * factor;
+    }
+  }
+
+  void add(const Eigen::Vector2f& dataPoint)
+  {
+    if (numPoints == static_cast<int>(xs.size())){
+      reserve(numPoints * 2);
+    }
+
+    xs[numPoints] = dataPoint.x();
+    ys[numPoints] = dataPoint.y();
+    ++numPoints;
+  }
+
+  void clear()
+  {
+    numPoints = 0;
+    extraOrigos.clear();
+    extraOrigoBegins.clear();
+  }
+
+  /**
+   * Appends the points of other, keeping the origin of each of its groups of points.
+   */
+  void append(const DataPointContainerSoA& other)
+  {
+    for (int group = 0; group < other.getNumOrigos(); ++group){
+      addOrigo(other.getOrigo(group));
+
+      int end = other.getOrigoEnd(group);
+
+      for (int i = other.getOrigoBegin(group); i < end; ++i){
+        add(other.getVecEntry(i));
+      }
+    }
+  }
+
+  int getSize() const
+  {
+    return numPoints;
+  }
+
+  /**
+   * Number of valid entries in the x and y arrays, getSize() rounded up to a multiple of SimdWidth.
+   */
+  int getPaddedSize() const
+  {
+    return (numPoints + SimdWidth - 1) & ~(SimdWidth - 1);
+  }
+
+  Eigen::Vector2f getVecEntry(int index) const
+  {
+    return Eigen::Vector2f(xs[index], ys[index]);
+  }
+
+  const float* getX() const { return &xs[0]; };
+  const float* getY() const { return &ys[0]; };
+
+  Eigen::Vector2f getOrigo() const
+  {
+    return origo;
+  }
+
+  void setOrigo(const Eigen::Vector2f& origoIn)
+  {
+    origo = origoIn;
+  }
+
+  /**
+   * Starts a new group of points, the beams of points added from now on start at origoIn. If no points were added
+   * since the current group started, its origin is replaced instead.
+   */
+  void addOrigo(const Eigen::Vector2f& origoIn)
+  {
+    if (numPoints == getOrigoBegin(getNumOrigos() - 1)){
+      if (extraOrigos.empty()){
+        origo = origoIn;
+      } else {
+        extraOrigos.back() = origoIn;
+      }
+    } else {
+      extraOrigos.push_back(origoIn);
+      extraOrigoBegins.push_back(numPoints);
+    }
+  }
+
+  /**
+   * Number of groups of points with their own origin, 1 unless scans of several sensors were fused.
+   */
+  int getNumOrigos() const
+  {
+    return 1 + static_cast<int>(extraOrigos.size());
+  }
+
+  Eigen::Vector2f getOrigo(int group) const
+  {
+    return (group == 0) ? origo : extraOrigos[group - 1];
+  }
+
+  /**
+   * Points [getOrigoBegin(group), getOrigoEnd(group)) start at getOrigo(group).
+   */
+  int getOrigoBegin(int group) const
+  {
+    return (group == 0) ? 0 : extraOrigoBegins[group - 1];
+  }
+
+  int getOrigoEnd(int group) const
+  {
+    return (group + 1 < getNumOrigos()) ? extraOrigoBegins[group] : numPoints;
+  }
+
+protected:
+
+  /**
+   * Grows both coordinate arrays to hold at least size points plus padding. Newly added entries are zero.
+   */
+  void reserve(int size)
+  {
+    size_t paddedSize = static_cast<size_t>((size + SimdWidth - 1) & ~(SimdWidth - 1));
+
+    if (paddedSize < SimdWidth){
+      paddedSize = SimdWidth;
+    }
+
+    if (paddedSize > xs.size()){
+      xs.resize(paddedSize, 0.0f);
+      ys.resize(paddedSize, 0.0f);
+    }
+  }
+
+  CoordinateArray xs;
+  CoordinateArray ys;
+  int numPoints;
+  Eigen::Vector2f origo;
+
+  std::vector<Eigen::Vector2f> extraOrigos;  ///< Origins of the groups of points after the first one.
+  std::vector<int> extraOrigoBegins;         ///< Index of the first point of each of these groups.
+};
+
+}
+
+#endif
@@ -0,0 +1,246 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __LaserScanProjection_h_
+#define __LaserScanProjection_h_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "DataPointContainer.h"
+#include "PointCloudConversion.h"
+#include "../util/AlignedAllocator.h"
+
+namespace hectorslam {
+
+/**
+ * Projects the ranges of a planar laser scan into a DataContainer without going through a point cloud. The sine and
+ * cosine of every beam are computed once per beam geometry, and their rotation into the target frame (scaled to map
+ * units) once per sensor transform. Both are only recomputed when the scan geometry or the transform changes, so
+ * projecting a scan costs one multiply-add per coordinate and beam. Beams are handled in batches of SimdWidth whose
+ * loops are free of branches so the compiler vectorizes them, only the accepted points are appended.
+ */
+class LaserScanProjection
+{
+public:
+
+  enum { SimdWidth = DataContainer::SimdWidth };
+
+  typedef std::vector<float, util::AlignedAllocator<float, 32> > TableArray;
+
+  LaserScanProjection()
+    : angleMin(0.0f)
+    , angleIncrement(0.0f)
+    , numBeams(0)
+    , rotation(Eigen::Matrix3f::Identity())
+    , translation(Eigen::Vector3f::Zero())
+    , scaleToMap(1.0f)
+    , directionsValid(false)
+  {}
+
+  /**
+   * Sets the angle of the first beam, the angle between beams and the number of beams. The sine and cosine tables
+   * are only recomputed if one of them changed.
+   */
+  void setBeamGeometry(float angleMinIn, float angleIncrementIn, int numBeamsIn)
+  {
+    if ((angleMinIn == angleMin) && (angleIncrementIn == angleIncrement) && (numBeamsIn == numBeams)) {
+      return;
+    }
+
+    angleMin = angleMinIn;
+    angleIncrement = angleIncrementIn;
+    numBeams = numBeamsIn;
+
+    cosTable.resize(numBeams);
+    sinTable.resize(numBeams);
+
+    //angles are computed from the beam index like laser_geometry does, accumulating the increment would drift
+    for (int i = 0; i < numBeams; ++i) {
+      double angle = static_cast<double>(angleMin) + static_cast<double>(i) * static_cast<double>(angleIncrement);
+      cosTable[i] = static_cast<float>(std::cos(angle));
+      sinTable[i] = static_cast<float>(std::sin(angle));
+    }
+
+    directionsValid = false;
+  }
+
+  /**
+   * Sets the transform from the sensor into the target frame and the factor from target frame to map units. The
+   * transformed beam directions are only recomputed if one of them changed.
+   */
+  void setSensorTransform(const Eigen::Matrix3f& rotationIn, const Eigen::Vector3f& translationIn, float scaleToMapIn)
+  {
+    if ((rotationIn == rotation) && (translationIn == translation) && (scaleToMapIn == scaleToMap)) {
+      return;
+    }
+
+    rotation = rotationIn;
+    translation = translationIn;
+    scaleToMap = scaleToMapIn;
+
+    directionsValid = false;
+  }
+
+  /**
+   * Projects the ranges within (minRange, maxRange) into the plane of the sensor, scaled by scaleToMapIn. The origin
+   * of the container is zero. ranges has to hold the number of beams given to setBeamGeometry().
+   */
+  void projectPlanar(const float* ranges, float minRange, float maxRange, float scaleToMapIn,
+                     DataContainer& dataContainer) const
+  {
+    dataContainer.clear();
+    dataContainer.setOrigo(Eigen::Vector2f::Zero());
+
+    const float* cosines = cosTable.data();
+    const float* sines = sinTable.data();
+
+    float x[SimdWidth], y[SimdWidth];
+    int keep[SimdWidth];
+
+    for (int start = 0; start < numBeams; start += SimdWidth) {
+      int batchSize = std::min(static_cast<int>(SimdWidth), numBeams - start);
+
+      for (int i = 0; i < batchSize; ++i) {
+        float range = ranges[start + i];
+
+        keep[i] = (range > minRange) & (range < maxRange);
+
+        range *= scaleToMapIn;
+        x[i] = cosines[start + i] * range;
+        y[i] = sines[start + i] * range;
+      }
+
+      appendKept(x, y, keep, batchSize, dataContainer);
+    }
+  }
+
+  /**
+   * Projects the ranges within (minRange, maxRange) into the target frame of setSensorTransform(), keeps the points
+   * that pass filter (see PointFilterParams) and stores them in map units. The origin of the container is the sensor
+   * position. Gives the same points as projecting the scan to a point cloud and using packedPointsToDataContainer().
+   */
+  void projectTransformed(const float* ranges, float minRange, float maxRange, const PointFilterParams& filter,
+                          DataContainer& dataContainer)
+  {
+    if (!directionsValid) {
+      updateDirections();
+    }
+
+    dataContainer.clear();
+    dataContainer.setOrigo(translation.head<2>() * scaleToMap);
+
+    const float* cosines = cosTable.data();
+    const float* dirX = dirXTable.data();
+    const float* dirY = dirYTable.data();
+    const float* dirZ = dirZTable.data();
+
+    const float tx = translation.x() * scaleToMap;
+    const float ty = translation.y() * scaleToMap;
+
+    float x[SimdWidth], y[SimdWidth];
+    int keep[SimdWidth];
+
+    for (int start = 0; start < numBeams; start += SimdWidth) {
+      int batchSize = std::min(static_cast<int>(SimdWidth), numBeams - start);
+
+      for (int i = 0; i < batchSize; ++i) {
+        float range = ranges[start + i];
+        float distSqr = range * range;
+
+        //height above the sensor in the target frame
+        float heightAboveSensor = dirZ[start + i] * range;
+
+        keep[i] = (range > minRange) & (range < maxRange) &
+                  (distSqr > filter.sqrMinDist) & (distSqr < filter.sqrMaxDist) &
+                  !((cosines[start + i] < 0.0f) & (distSqr < 0.50f)) &
+                  (heightAboveSensor > filter.zMin) & (heightAboveSensor < filter.zMax);
+
+        x[i] = dirX[start + i] * range + tx;
+        y[i] = dirY[start + i] * range + ty;
+      }
+
+      appendKept(x, y, keep, batchSize, dataContainer);
+    }
+  }
+
+  int getNumBeams() const { return numBeams; };
+
+protected:
+
+  /**
+   * Rotates the beam directions into the target frame, x and y are scaled to map units.
+   */
+  void updateDirections()
+  {
+    dirXTable.resize(numBeams);
+    dirYTable.resize(numBeams);
+    dirZTable.resize(numBeams);
+
+    for (int i = 0; i < numBeams; ++i) {
+      Eigen::Vector3f direction (rotation * Eigen::Vector3f(cosTable[i], sinTable[i], 0.0f));
+      dirXTable[i] = direction.x() * scaleToMap;
+      dirYTable[i] = direction.y() * scaleToMap;
+      dirZTable[i] = direction.z();
+    }
+
+    directionsValid = true;
+  }
+
+  static void appendKept(const float* x, const float* y, const int* keep, int batchSize, DataContainer& dataContainer)
+  {
+    for (int i = 0; i < batchSize; ++i) {
+      if (keep[i]) {
+        dataContainer.add(Eigen::Vector2f(x[i], y[i]));
+      }
+    }
+  }
+
+  float angleMin;
+  float angleIncrement;
+  int numBeams;
+
+  Eigen::Matrix3f rotation;
+  Eigen::Vector3f translation;
+  float scaleToMap;
+
+  TableArray cosTable;
+  TableArray sinTable;
+
+  TableArray dirXTable;   ///< Beam directions rotated into the target frame, x and y in map units.
+  TableArray dirYTable;
+  TableArray dirZTable;
+  bool directionsValid;   ///< Whether the direction tables match the current beam geometry and transform.
+};
+
+}
+
+#endif
@@ -0,0 +1,269 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __PointCloudConversion_h_
+#define __PointCloudConversion_h_
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "DataPointContainer.h"
+
+namespace hectorslam {
+
+/**
+ * Describes points stored in a packed buffer (e.g. the data of a PointCloud2 message): pointStep bytes between
+ * consecutive points and the byte offsets of the x, y and z coordinates within a point, stored as native float32.
+ * Multi ring clouds can additionally give the offset of an unsigned ring index of ringSize (1 or 2) bytes, ringOffset
+ * is negative if there is none.
+ */
+struct PackedPointLayout
+{
+  PackedPointLayout()
+    : data(0)
+    , numPoints(0)
+    , pointStep(0)
+    , xOffset(-1)
+    , yOffset(-1)
+    , zOffset(-1)
+    , ringOffset(-1)
+    , ringSize(0)
+  {}
+
+  const unsigned char* data;
+  int numPoints;
+  int pointStep;
+  int xOffset;
+  int yOffset;
+  int zOffset;
+  int ringOffset;
+  int ringSize;
+};
+
+/**
+ * Points are kept if their squared distance in the xy plane of the sensor is within (sqrMinDist, sqrMaxDist) and
+ * their height above the sensor, measured in the target frame, is within (zMin, zMax). Points closer than
+ * sqrt(0.5) behind the sensor are dropped as well, they usually hit the robot itself. If the layout has a ring index,
+ * only points of rings within [ringMin, ringMax] are kept.
+ */
+struct PointFilterParams
+{
+  PointFilterParams()
+    : sqrMinDist(0.0f)
+    , sqrMaxDist(std::numeric_limits<float>::max())
+    , zMin(-std::numeric_limits<float>::max())
+    , zMax(std::numeric_limits<float>::max())
+    , ringMin(0)
+    , ringMax(INT_MAX)
+  {}
+
+  float sqrMinDist;
+  float sqrMaxDist;
+  float zMin;
+  float zMax;
+  int ringMin;
+  int ringMax;
+};
+
+/**
+ * Transforms the points into the target frame given by rotation and translation, filters them and calls
+ * functor(mapX, mapY, sensorX, sensorY) for every point kept, with mapX and mapY scaled by scaleToMap and sensorX and
+ * sensorY the coordinates in the sensor frame. Points are read in batches of DataContainer::SimdWidth whose
+ * transform and filter loops are free of branches so the compiler vectorizes them.
+ */
+template<typename PointFunctor>
+inline void forEachFilteredPoint(const PackedPointLayout& layout, const Eigen::Matrix3f& rotation,
+                                 const Eigen::Vector3f& translation, const PointFilterParams& filter,
+                                 float scaleToMap, PointFunctor functor)
+{
+  enum { BatchSize = DataContainer::SimdWidth };
+
+  const float r00 = rotation(0, 0) * scaleToMap, r01 = rotation(0, 1) * scaleToMap, r02 = rotation(0, 2) * scaleToMap;
+  const float r10 = rotation(1, 0) * scaleToMap, r11 = rotation(1, 1) * scaleToMap, r12 = rotation(1, 2) * scaleToMap;
+  const float r20 = rotation(2, 0), r21 = rotation(2, 1), r22 = rotation(2, 2);
+  const float tx = translation.x() * scaleToMap;
+  const float ty = translation.y() * scaleToMap;
+
+  float px[BatchSize], py[BatchSize], pz[BatchSize];
+  float mapX[BatchSize], mapY[BatchSize];
+  int ring[BatchSize];
+  int keep[BatchSize];
+
+  std::fill(px, px + BatchSize, 0.0f);
+  std::fill(py, py + BatchSize, 0.0f);
+  std::fill(pz, pz + BatchSize, 0.0f);
+  std::fill(ring, ring + BatchSize, 0);
+
+  const unsigned char* point = layout.data;
+
+  for (int start = 0; start < layout.numPoints; start += BatchSize) {
+    int batchSize = std::min(static_cast<int>(BatchSize), layout.numPoints - start);
+
+    for (int i = 0; i < batchSize; ++i, point += layout.pointStep) {
+      memcpy(&px[i], point + layout.xOffset, sizeof(float));
+      memcpy(&py[i], point + layout.yOffset, sizeof(float));
+      memcpy(&pz[i], point + layout.zOffset, sizeof(float));
+
+      if (layout.ringOffset >= 0) {
+        if (layout.ringSize == 1) {
+          ring[i] = point[layout.ringOffset];
+        } else {
+          uint16_t ringIndex;
+          memcpy(&ringIndex, point + layout.ringOffset, sizeof(uint16_t));
+          ring[i] = ringIndex;
+        }
+      }
+    }
+
+    for (int i = 0; i < BatchSize; ++i) {
+      float distSqr = px[i] * px[i] + py[i] * py[i];
+
+      //height above the sensor in the target frame, the translation cancels out
+      float heightAboveSensor = r20 * px[i] + r21 * py[i] + r22 * pz[i];
+
+      mapX[i] = r00 * px[i] + r01 * py[i] + r02 * pz[i] + tx;
+      mapY[i] = r10 * px[i] + r11 * py[i] + r12 * pz[i] + ty;
+
+      keep[i] = (distSqr > filter.sqrMinDist) & (distSqr < filter.sqrMaxDist) &
+                !((px[i] < 0.0f) & (distSqr < 0.50f)) &
+                (heightAboveSensor > filter.zMin) & (heightAboveSensor < filter.zMax) &
+                (ring[i] >= filter.ringMin) & (ring[i] <= filter.ringMax);
+    }
+
+    for (int i = 0; i < batchSize; ++i) {
+      if (keep[i]) {
+        functor(mapX[i], mapY[i], px[i], py[i]);
+      }
+    }
+  }
+}
+
+/**
+ * Fills dataContainer with the points kept by forEachFilteredPoint(). The origin is set to the sensor position.
+ * Reusing the container avoids any allocation once it has grown to the size of a scan.
+ */
+inline void packedPointsToDataContainer(const PackedPointLayout& layout, const Eigen::Matrix3f& rotation,
+                                        const Eigen::Vector3f& translation, const PointFilterParams& filter,
+                                        float scaleToMap, DataContainer& dataContainer)
+{
+  dataContainer.clear();
+  dataContainer.setOrigo(translation.head<2>() * scaleToMap);
+
+  forEachFilteredPoint(layout, rotation, translation, filter, scaleToMap,
+                       [&dataContainer](float mapX, float mapY, float, float)
+  {
+    dataContainer.add(Eigen::Vector2f(mapX, mapY));
+  });
+}
+
+/**
+ * Turns a multi ring (3D lidar) cloud into a planar scan. The points kept by forEachFilteredPoint() are binned by
+ * their azimuth in the sensor frame, and only the closest point of each bin is used, like a laser scanner would see
+ * it. This evens out the point density of the selected rings. The bins are kept between calls.
+ */
+class PointCloudSlicer
+{
+public:
+
+  PointCloudSlicer(int numBinsIn = 1080)
+  {
+    setNumBins(numBinsIn);
+  }
+
+  /**
+   * Sets the number of azimuth bins over the full circle, 0 keeps all points.
+   */
+  void setNumBins(int numBinsIn)
+  {
+    numBins = std::max(numBinsIn, 0);
+    binDistSqr.assign(numBins, std::numeric_limits<float>::max());
+    binX.resize(numBins);
+    binY.resize(numBins);
+  }
+
+  int getNumBins() const { return numBins; };
+
+  /**
+   * Fills dataContainer with the closest point of each bin, in order of azimuth. The origin is set to the sensor
+   * position.
+   */
+  void slice(const PackedPointLayout& layout, const Eigen::Matrix3f& rotation, const Eigen::Vector3f& translation,
+             const PointFilterParams& filter, float scaleToMap, DataContainer& dataContainer)
+  {
+    if (numBins == 0) {
+      packedPointsToDataContainer(layout, rotation, translation, filter, scaleToMap, dataContainer);
+      return;
+    }
+
+    const float binsPerRad = static_cast<float>(numBins) / (2.0f * static_cast<float>(M_PI));
+
+    forEachFilteredPoint(layout, rotation, translation, filter, scaleToMap,
+                         [&](float mapX, float mapY, float sensorX, float sensorY)
+    {
+      int bin = static_cast<int>((std::atan2(sensorY, sensorX) + static_cast<float>(M_PI)) * binsPerRad);
+      bin = std::min(std::max(bin, 0), numBins - 1);
+
+      float distSqr = sensorX * sensorX + sensorY * sensorY;
+
+      if (distSqr < binDistSqr[bin]) {
+        binDistSqr[bin] = distSqr;
+        binX[bin] = mapX;
+        binY[bin] = mapY;
+      }
+    });
+
+    dataContainer.clear();
+    dataContainer.setOrigo(translation.head<2>() * scaleToMap);
+
+    for (int i = 0; i < numBins; ++i) {
+      if (binDistSqr[i] < std::numeric_limits<float>::max()) {
+        dataContainer.add(Eigen::Vector2f(binX[i], binY[i]));
+        binDistSqr[i] = std::numeric_limits<float>::max();
+      }
+    }
+  }
+
+protected:
+
+  int numBins;
+
+  std::vector<float> binDistSqr;  ///< Squared distance of the closest point of each bin, max if the bin is empty.
+  std::vector<float> binX;        ///< Map coordinates of the closest point of each bin.
+  std::vector<float> binY;
+};
+
+}
+
+#endif
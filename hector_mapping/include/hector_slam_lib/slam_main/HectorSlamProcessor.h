@@ -31,6 +31,7 @@
 
 #include "../map/GridMap.h"
 #include "../map/OccGridMapUtilConfig.h"
+#include "../map/GridMapFile.h"
 #include "../matcher/ScanMatcher.h"
 #include "../scan/DataPointContainer.h"
 
@@ -41,6 +42,7 @@
 
 #include "MapRepresentationInterface.h"
 #include "MapRepMultiMap.h"
+#include "SlamLatencyStats.h"
 
 
 #include <float.h>
@@ -52,7 +54,15 @@ class HectorSlamProcessor
 public:
 
   HectorSlamProcessor(float mapResolution, int mapSizeX, int mapSizeY , const Eigen::Vector2f& startCoords, int multi_res_size, DrawInterface* drawInterfaceIn = 0, HectorDebugInfoInterface* debugInterfaceIn = 0)
-    : drawInterface(drawInterfaceIn)
+    : matchTimeBudget(0.0f)
+    , relocalizationMinScore(0.0f)
+    , relocalizationLinearWindow(3.0f)
+    , relocalizationAngularWindow(static_cast<float>(M_PI))
+    , lastScanMatchScore(-1.0f)
+    , concurrentMapUpdates(false)
+    , localizationMode(false)
+    , latencyStats(0)
+    , drawInterface(drawInterfaceIn)
     , debugInterface(debugInterfaceIn)
   {
     mapRep = new MapRepMultiMap(mapResolution, mapSizeX, mapSizeY, multi_res_size, startCoords, drawInterfaceIn, debugInterfaceIn);
@@ -69,47 +79,146 @@ public:
   }
 
   void update(const DataContainer& dataContainer, const Eigen::Vector3f& poseHintWorld, bool map_without_matching = false)
+  {
+    if (matchScan(dataContainer, poseHintWorld, map_without_matching)){
+      updateMap(dataContainer, lastScanMatchPose);
+    }
+
+    flushDebugOutput();
+  }
+
+  /**
+   * Sends the drawings and debug info collected while matching the last scan. Called by update(), callers using
+   * matchScan() directly have to call it after every scan.
+   */
+  void flushDebugOutput()
+  {
+    if(drawInterface){
+      const GridMap& gridMapRef (mapRep->getGridMap());
+      drawInterface->setColor(1.0, 0.0, 0.0);
+      drawInterface->setScale(0.15);
+
+      drawInterface->drawPoint(gridMapRef.getWorldCoords(Eigen::Vector2f::Zero()));
+      drawInterface->drawPoint(gridMapRef.getWorldCoords((gridMapRef.getMapDimensions().array()-1).cast<float>()));
+      drawInterface->drawPoint(Eigen::Vector2f(1.0f, 1.0f));
+
+      drawInterface->sendAndResetData();
+    }
+
+    if (debugInterface)
+    {
+      debugInterface->sendAndResetData();
+    }
+  }
+
+  /**
+   * Matching part of update(): estimates the pose of the scan and decides whether the map has to be updated with it.
+   * @return True if the map should be updated with the scan at getLastScanMatchPose()
+   */
+  bool matchScan(const DataContainer& dataContainer, const Eigen::Vector3f& poseHintWorld, bool map_without_matching = false)
   {
     //std::cout << "\nph:\n" << poseHintWorld << "\n";
 
     Eigen::Vector3f newPoseEstimateWorld;
 
     if (!map_without_matching){
+        if (matchTimeBudget > 0.0f){
+          mapRep->setMatchDeadline(std::chrono::steady_clock::now() +
+                                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(matchTimeBudget)));
+        }else{
+          mapRep->setMatchDeadline(std::chrono::steady_clock::time_point::max());
+        }
+
         newPoseEstimateWorld = (mapRep->matchData(poseHintWorld, dataContainer, lastScanMatchCov));
+
+        if (relocalizationMinScore > 0.0f){
+          lastScanMatchScore = mapRep->getMatchScore(newPoseEstimateWorld, dataContainer);
+
+          //matching diverged, fall back to a global search around the pose hint (not possible on an empty map)
+          if ((lastScanMatchScore < relocalizationMinScore) && mapRep->getGridMap().hasUpdates()){
+            Eigen::Vector3f relocalizedPoseWorld;
+            float relocalizedScore = this->relocalize(dataContainer, poseHintWorld, relocalizationLinearWindow, relocalizationAngularWindow, relocalizedPoseWorld);
+
+            if (relocalizedScore > lastScanMatchScore){
+              newPoseEstimateWorld = relocalizedPoseWorld;
+              lastScanMatchScore = relocalizedScore;
+            }
+          }
+        }
     }else{
         newPoseEstimateWorld = poseHintWorld;
     }
 
     lastScanMatchPose = newPoseEstimateWorld;
 
+    //the maps are frozen in localization mode
+    if (localizationMode){
+      return false;
+    }
+
     //std::cout << "\nt1:\n" << newPoseEstimateWorld << "\n";
 
     //std::cout << "\n1";
     //std::cout << "\n" << lastScanMatchPose << "\n";
     if(util::poseDifferenceLargerThan(newPoseEstimateWorld, lastMapUpdatePose, paramMinDistanceDiffForMapUpdate, paramMinAngleDiffForMapUpdate) || map_without_matching){
+      lastMapUpdatePose = newPoseEstimateWorld;
+      return true;
+    }
 
-      mapRep->updateByScan(dataContainer, newPoseEstimateWorld);
+    return false;
+  }
 
-      mapRep->onMapUpdated();
-      lastMapUpdatePose = newPoseEstimateWorld;
+  /**
+   * Map update part of update(). With concurrent map updates enabled this can run on another thread than matchScan().
+   */
+  void updateMap(const DataContainer& dataContainer, const Eigen::Vector3f& poseWorld)
+  {
+    LatencyHistogram::Clock::time_point start;
+
+    if (latencyStats){
+      start = LatencyHistogram::now();
     }
 
-    if(drawInterface){
-      const GridMap& gridMapRef (mapRep->getGridMap());
-      drawInterface->setColor(1.0, 0.0, 0.0);
-      drawInterface->setScale(0.15);
+    mapRep->updateByScan(dataContainer, poseWorld);
+    mapRep->updateMapSnapshots();
 
-      drawInterface->drawPoint(gridMapRef.getWorldCoords(Eigen::Vector2f::Zero()));
-      drawInterface->drawPoint(gridMapRef.getWorldCoords((gridMapRef.getMapDimensions().array()-1).cast<float>()));
-      drawInterface->drawPoint(Eigen::Vector2f(1.0f, 1.0f));
+    if (latencyStats){
+      LatencyHistogram::Clock::time_point end = LatencyHistogram::now();
+      latencyStats->mapUpdate.record(end - start);
+      start = end;
+    }
 
-      drawInterface->sendAndResetData();
+    //with concurrent map updates, matching refreshes cached map data itself
+    if (!concurrentMapUpdates){
+      mapRep->onMapUpdated();
+
+      if (latencyStats){
+        latencyStats->cacheReset.recordSince(start);
+      }
     }
+  }
 
-    if (debugInterface)
-    {
-      debugInterface->sendAndResetData();
+  /**
+   * Searches the pose of the scan in the current map around poseHintWorld with the correlative scan matcher and
+   * refines the result with the regular scan matcher. Does not update the map or the last scan match pose.
+   * @param linearWindow Half edge length of the square search window in meters
+   * @param angularWindow Half width of the angular search window in radians
+   * @param poseWorld The found pose
+   * @return The match score (mean endpoint probability) of the found pose
+   */
+  float relocalize(const DataContainer& dataContainer, const Eigen::Vector3f& poseHintWorld, float linearWindow, float angularWindow, Eigen::Vector3f& poseWorld)
+  {
+    Eigen::Vector3f searchPoseWorld;
+
+    if (mapRep->searchPose(poseHintWorld, dataContainer, linearWindow, angularWindow, searchPoseWorld) <= 0.0f){
+      poseWorld = poseHintWorld;
+      return 0.0f;
     }
+
+    mapRep->setMatchDeadline(std::chrono::steady_clock::time_point::max());
+    poseWorld = mapRep->matchData(searchPoseWorld, dataContainer, lastScanMatchCov);
+
+    return mapRep->getMatchScore(poseWorld, dataContainer);
   }
 
   void reset()
@@ -121,6 +230,7 @@ public:
     //lastScanMatchPose.z() = M_PI*0.15f;
 
     mapRep->reset();
+    mapRep->updateMapSnapshots();
   }
 
   const Eigen::Vector3f& getLastScanMatchPose() const { return lastScanMatchPose; };
@@ -135,6 +245,115 @@ public:
 
   void setUpdateFactorFree(float free_factor) { mapRep->setUpdateFactorFree(free_factor); };
   void setUpdateFactorOccupied(float occupied_factor) { mapRep->setUpdateFactorOccupied(occupied_factor); };
+  void setUseProbabilityPlane(bool enabled) { mapRep->setUseProbabilityPlane(enabled); };
+  void setMatchConvergenceThresholds(float minStepTranslation, float minStepAngle, float minResidualChange) { mapRep->setMatchConvergenceThresholds(minStepTranslation, minStepAngle, minResidualChange); };
+  void setMatchUseLevenbergMarquardt(bool useLM) { mapRep->setMatchUseLevenbergMarquardt(useLM); };
+  void setMapUpdateThreads(int numThreads, int numFinestLevelBands) { mapRep->setMapUpdateThreads(numThreads, numFinestLevelBands); };
+  void setPoolCoarseLevels(bool enabled) { mapRep->setPoolCoarseLevels(enabled); };
+  void setUseHashCache(int level, bool enabled) { mapRep->setUseHashCache(level, enabled); };
+
+  /**
+   * Enables immutable snapshots of a map level, taken after every map update. Readers can get the latest one from
+   * any thread with getMapSnapshot() without blocking scan processing. If graded is set, the snapshots contain graded
+   * occupancy values like convertToOccupancy() with graded set.
+   */
+  void setUseMapSnapshot(int level, bool enabled, bool graded = false) { mapRep->setUseMapSnapshot(level, enabled, graded); };
+  std::shared_ptr<const GridMapSnapshot> getMapSnapshot(int level = 0) const { return mapRep->getMapSnapshot(level); };
+  void setUseLikelihoodField(bool enabled, float sigma) { mapRep->setUseLikelihoodField(enabled, sigma); };
+
+  /**
+   * Copies all map levels and the last scan match pose to writer. Writing the file does not need the maps any more,
+   * so GridMapFileWriter::write() can run on another thread while mapping continues.
+   */
+  void saveMaps(GridMapFileWriter& writer)
+  {
+    mapRep->saveMaps(writer);
+    writer.setPose(lastScanMatchPose);
+  }
+
+  /**
+   * Replaces all map levels with the saved ones and continues from the saved pose.
+   * @return False if the saved maps do not match the configured ones, nothing is changed then
+   */
+  bool loadMaps(const GridMapFileReader& reader)
+  {
+    if (!mapRep->loadMaps(reader)){
+      return false;
+    }
+
+    lastMapUpdatePose = Eigen::Vector3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    lastScanMatchPose = reader.getPose();
+
+    mapRep->updateMapSnapshots();
+    return true;
+  }
+
+  /**
+   * Sets the time in seconds scan matching of one scan may take before no further iterations are started,
+   * zero disables the limit.
+   */
+  void setMatchTimeBudget(float seconds) { matchTimeBudget = seconds; };
+
+  /**
+   * Enables relocalization with the correlative scan matcher whenever the match score of a scan falls below
+   * minScore (zero disables it). Scores are mean endpoint probabilities, endpoints in unexplored space score 0.5.
+   */
+  void setRelocalizationMinScore(float minScore) { relocalizationMinScore = minScore; };
+  void setRelocalizationSearchWindow(float linearWindow, float angularWindow) { relocalizationLinearWindow = linearWindow; relocalizationAngularWindow = angularWindow; };
+
+  /**
+   * Score of the last scan match, only computed if relocalization is enabled (-1 otherwise).
+   */
+  float getLastScanMatchScore() const { return lastScanMatchScore; };
+
+  /**
+   * Allows calling updateMap() concurrently to matchScan(). All map levels need a map mutex then (see addMapMutex()),
+   * matching locks each level while matching against it. Other methods must not be called concurrently, in particular
+   * callers have to serialize reset(), setStaticMap(), loadMaps() and saveMaps() with updateMap() and drop map
+   * updates of scans matched before a reset.
+   */
+  void setConcurrentMapUpdates(bool enabled)
+  {
+    concurrentMapUpdates = enabled;
+    mapRep->setLockMapsWhileMatching(enabled);
+  }
+
+  /**
+   * In localization mode scans are only matched, the maps are never updated. As they cannot change any more, the
+   * probability plane of every level is built once, matching then reads it instead of converting cells, and cached
+   * map data is never invalidated.
+   */
+  void setLocalizationMode(bool enabled)
+  {
+    localizationMode = enabled;
+
+    if (enabled){
+      mapRep->setUseProbabilityPlane(true);
+    }
+  }
+
+  bool getLocalizationMode() const { return localizationMode; };
+
+  /**
+   * Replaces all map levels with an occupancy grid, e.g. a prebuilt map for localization mode. See
+   * OccGridMapBase::setFromOccupancyGrid() for the grid format.
+   */
+  void setStaticMap(const int8_t* gridData, int gridWidth, int gridHeight, float gridResolution, const Eigen::Vector2f& gridOriginWorld)
+  {
+    mapRep->setStaticMap(gridData, gridWidth, gridHeight, gridResolution, gridOriginWorld);
+    mapRep->updateMapSnapshots();
+  }
+
+  /**
+   * Records the latencies of matching each map level, map updates and cache resets into stats, which has to be
+   * created for getMapLevels() levels and outlive the processor. Zero disables recording.
+   */
+  void setLatencyStats(SlamLatencyStats* stats)
+  {
+    latencyStats = stats;
+    mapRep->setLatencyStats(stats);
+  }
+
   void setMapUpdateMinDistDiff(float minDist) { paramMinDistanceDiffForMapUpdate = minDist; };
   void setMapUpdateMinAngleDiff(float angleChange) { paramMinAngleDiffForMapUpdate = angleChange; };
 
@@ -149,6 +368,18 @@ protected:
   float paramMinDistanceDiffForMapUpdate;
   float paramMinAngleDiffForMapUpdate;
 
+  float matchTimeBudget;
+
+  float relocalizationMinScore;
+  float relocalizationLinearWindow;
+  float relocalizationAngularWindow;
+  float lastScanMatchScore;
+
+  bool concurrentMapUpdates;
+  bool localizationMode;
+
+  SlamLatencyStats* latencyStats;
+
   DrawInterface* drawInterface;
   HectorDebugInfoInterface* debugInterface;
 };
@@ -31,6 +31,8 @@
 
 #include "../map/GridMap.h"
 #include "../map/OccGridMapUtilConfig.h"
+#include "../map/GridMapSnapshot.h"
+#include "../map/GridMapFile.h"
 #include "../matcher/ScanMatcher.h"
 #include "../util/MapLockerInterface.h"
 
@@ -48,6 +50,8 @@ public:
     , gridMapUtil(gridMapUtilIn)
     , scanMatcher(scanMatcherIn)
     , mapMutex(0)
+    , snapshotBuffer(0)
+    , cachedDataUpdateIndex(-1)
   {}
 
   virtual ~MapProcContainer()
@@ -62,17 +66,34 @@ public:
     if (mapMutex){
       delete mapMutex;
     }
+
+    delete snapshotBuffer;
   }
 
   void reset()
   {
+    lockMap();
     gridMap->reset();
-    gridMapUtil->resetCachedData();
+    gridMapUtil->resetMapData();
+    cachedDataUpdateIndex = gridMap->getUpdateIndex();
+    unlockMap();
   }
 
   void resetCachedData()
   {
     gridMapUtil->resetCachedData();
+    cachedDataUpdateIndex = gridMap->getUpdateIndex();
+  }
+
+  /**
+   * Resets the cached data only if the map has been updated since the last reset.
+   */
+  void updateCachedData()
+  {
+    if (gridMap->getUpdateIndex() != cachedDataUpdateIndex)
+    {
+      resetCachedData();
+    }
   }
 
   float getScaleToMap() const { return gridMap->getScaleToMap(); };
@@ -95,6 +116,126 @@ public:
     return mapMutex;
   }
 
+  void lockMap()
+  {
+    if (mapMutex)
+    {
+      mapMutex->lockMap();
+    }
+  }
+
+  void unlockMap()
+  {
+    if (mapMutex)
+    {
+      mapMutex->unlockMap();
+    }
+  }
+
+  /**
+   * Enables taking snapshots of the map after updates, see updateSnapshot(). The snapshots consume the dirty bounds
+   * of the map, which must not be cleared by anyone else then. If graded is set, the snapshots contain graded
+   * occupancy values.
+   */
+  void setUseSnapshot(bool enabled, bool graded = false)
+  {
+    lockMap();
+
+    if (snapshotBuffer && (!enabled || (snapshotBuffer->isGraded() != graded))){
+      delete snapshotBuffer;
+      snapshotBuffer = 0;
+    }
+
+    if (enabled && !snapshotBuffer){
+      snapshotBuffer = new GridMapSnapshotBuffer(graded);
+      snapshotBuffer->rebuild(*gridMap);
+      gridMap->clearDirtyBounds();
+    }
+
+    unlockMap();
+  }
+
+  /**
+   * Takes a new snapshot if cells changed since the last one. Only copies the tiles inside the dirty bounds.
+   */
+  void updateSnapshot()
+  {
+    if (!snapshotBuffer){
+      return;
+    }
+
+    lockMap();
+
+    Eigen::Vector2i minCell, maxCell;
+
+    if (gridMap->getDirtyBounds(minCell, maxCell)){
+      snapshotBuffer->update(*gridMap, minCell, maxCell);
+      gridMap->clearDirtyBounds();
+    }
+
+    unlockMap();
+  }
+
+  /**
+   * Latest snapshot of the map, empty if snapshots are disabled. Can be called from any thread without locking.
+   */
+  std::shared_ptr<const GridMapSnapshot> getSnapshot() const
+  {
+    return snapshotBuffer ? snapshotBuffer->getSnapshot() : std::shared_ptr<const GridMapSnapshot>();
+  }
+
+  /**
+   * Appends a copy of the map to writer.
+   */
+  void saveMap(GridMapFileWriter& writer)
+  {
+    lockMap();
+    writer.addLevel(*gridMap);
+    unlockMap();
+  }
+
+  /**
+   * Replaces the map with the given level of a map file, see GridMapFileReader::readLevel().
+   */
+  bool loadMap(const GridMapFileReader& reader, int level)
+  {
+    lockMap();
+
+    bool loaded = reader.readLevel(level, *gridMap);
+
+    if (loaded){
+      gridMapUtil->resetMapData();
+      cachedDataUpdateIndex = gridMap->getUpdateIndex();
+    }
+
+    unlockMap();
+    return loaded;
+  }
+
+  /**
+   * Replaces the map with an occupancy grid, see OccGridMapBase::setFromOccupancyGrid().
+   */
+  void setFromOccupancyGrid(const int8_t* gridData, int gridWidth, int gridHeight, float gridResolution, const Eigen::Vector2f& gridOriginWorld)
+  {
+    lockMap();
+    gridMap->setFromOccupancyGrid(gridData, gridWidth, gridHeight, gridResolution, gridOriginWorld);
+    gridMapUtil->resetMapData();
+    cachedDataUpdateIndex = gridMap->getUpdateIndex();
+    unlockMap();
+  }
+
+  /**
+   * Replaces the map with the pooled map of fineContainer, which has twice the resolution.
+   */
+  void setByPooling(const MapProcContainer& fineContainer)
+  {
+    lockMap();
+    gridMap->updateByPooling(fineContainer.getGridMap());
+    gridMapUtil->resetMapData();
+    cachedDataUpdateIndex = gridMap->getUpdateIndex();
+    unlockMap();
+  }
+
   Eigen::Vector3f matchData(const Eigen::Vector3f& beginEstimateWorld, const DataContainer& dataContainer, Eigen::Matrix3f& covMatrix, int maxIterations)
   {
     return scanMatcher->matchData(beginEstimateWorld, *gridMapUtil, dataContainer, covMatrix, maxIterations);
@@ -108,6 +249,7 @@ public:
     }
 
     gridMap->updateByScan(dataContainer, robotPoseWorld);
+    gridMapUtil->addMapUpdate();
 
     if (mapMutex)
     {
@@ -119,6 +261,8 @@ public:
   OccGridMapUtilConfig<GridMap>* gridMapUtil;
   ScanMatcher<OccGridMapUtilConfig<GridMap> >* scanMatcher;
   MapLockerInterface* mapMutex;
+  GridMapSnapshotBuffer* snapshotBuffer;
+  int cachedDataUpdateIndex;
 };
 
 }
@@ -29,15 +29,20 @@
 #ifndef _hectormaprepmultimap_h__
 #define _hectormaprepmultimap_h__
 
+#include <iostream>
+
 #include "MapRepresentationInterface.h"
 #include "MapProcContainer.h"
+#include "SlamLatencyStats.h"
 
 #include "../map/GridMap.h"
 #include "../map/OccGridMapUtilConfig.h"
 #include "../matcher/ScanMatcher.h"
+#include "../matcher/CorrelativeScanMatcher.h"
 
 #include "../util/DrawInterface.h"
 #include "../util/HectorDebugInfoInterface.h"
+#include "../util/WorkerPool.h"
 
 namespace hectorslam{
 
@@ -46,6 +51,10 @@ class MapRepMultiMap : public MapRepresentationInterface
 
 public:
   MapRepMultiMap(float mapResolution, int mapSizeX, int mapSizeY, unsigned int numDepth, const Eigen::Vector2f& startCoords, DrawInterface* drawInterfaceIn, HectorDebugInfoInterface* debugInterfaceIn)
+    : numUpdateBands(1)
+    , poolCoarseLevels(false)
+    , lockMapsWhileMatching(false)
+    , latencyStats(0)
   {
     //unsigned int numDepth = 3;
     Eigen::Vector2i resolution(mapSizeX, mapSizeY);
@@ -69,6 +78,7 @@ public:
     }
 
     dataContainers.resize(numDepth-1);
+    updateDataContainers.resize(numDepth-1);
   }
 
   virtual ~MapRepMultiMap()
@@ -87,6 +97,8 @@ public:
     for (unsigned int i = 0; i < size; ++i){
       mapContainer[i].reset();
     }
+
+    correlativeScanMatcher.invalidate();
   }
 
   virtual float getScaleToMap() const { return mapContainer[0].getScaleToMap(); };
@@ -121,31 +133,236 @@ public:
 
     for (int index = size - 1; index >= 0; --index){
       //std::cout << " m " << i;
+      ScopedLatency latency(latencyStats ? &latencyStats->getMatchLevel(index) : 0);
+
+      if (lockMapsWhileMatching){
+        mapContainer[index].lockMap();
+        mapContainer[index].updateCachedData();
+      }
+
       if (index == 0){
         tmp  = (mapContainer[index].matchData(tmp, dataContainer, covMatrix, 5));
       }else{
+        //scaled copies reuse the storage of the previous scan, so this does not allocate in steady state
         dataContainers[index-1].setFrom(dataContainer, static_cast<float>(1.0 / pow(2.0, static_cast<double>(index))));
         tmp  = (mapContainer[index].matchData(tmp, dataContainers[index-1], covMatrix, 3));
       }
+
+      if (lockMapsWhileMatching){
+        mapContainer[index].unlockMap();
+      }
     }
     return tmp;
   }
 
+  /**
+   * Returns the mean probability of the scan endpoints on the finest map level for the given pose.
+   */
+  virtual float getMatchScore(const Eigen::Vector3f& poseWorld, const DataContainer& dataContainer)
+  {
+    OccGridMapUtilConfig<GridMap>& gridMapUtil (*mapContainer[0].gridMapUtil);
+
+    if (!lockMapsWhileMatching){
+      return gridMapUtil.getLikelihoodForState(gridMapUtil.getMapCoordsPose(poseWorld), dataContainer);
+    }
+
+    mapContainer[0].lockMap();
+    mapContainer[0].updateCachedData();
+    float score = gridMapUtil.getLikelihoodForState(gridMapUtil.getMapCoordsPose(poseWorld), dataContainer);
+    mapContainer[0].unlockMap();
+
+    return score;
+  }
+
+  /**
+   * Global search for the scan pose on the coarsest map level, see CorrelativeScanMatcher.
+   * @param linearWindow Half edge length of the square search window in meters
+   * @param angularWindow Half width of the angular search window in radians
+   * @return Score of the found pose
+   */
+  virtual float searchPose(const Eigen::Vector3f& beginEstimateWorld, const DataContainer& dataContainer, float linearWindow, float angularWindow, Eigen::Vector3f& poseWorld)
+  {
+    int searchLevel = static_cast<int>(mapContainer.size()) - 1;
+    const GridMap& gridMap (mapContainer[searchLevel].getGridMap());
+
+    searchDataContainer.setFrom(dataContainer, static_cast<float>(1.0 / pow(2.0, static_cast<double>(searchLevel))));
+
+    if (lockMapsWhileMatching){
+      mapContainer[searchLevel].lockMap();
+    }
+
+    Eigen::Vector3f poseMap;
+    float score = correlativeScanMatcher.match(gridMap, searchDataContainer, gridMap.getMapCoordsPose(beginEstimateWorld),
+                                               linearWindow * gridMap.getScaleToMap(), angularWindow, poseMap);
+
+    if (lockMapsWhileMatching){
+      mapContainer[searchLevel].unlockMap();
+    }
+
+    poseWorld = gridMap.getWorldCoordsPose(poseMap);
+    return score;
+  }
+
   virtual void updateByScan(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld)
   {
     unsigned int size = mapContainer.size();
 
+    if (poolCoarseLevels){
+      updateByScanPooled(dataContainer, robotPoseWorld);
+      return;
+    }
+
+    if (updateWorkers.getNumThreads() > 1){
+      updateByScanParallel(dataContainer, robotPoseWorld);
+      return;
+    }
+
     for (unsigned int i = 0; i < size; ++i){
       //std::cout << " u " <<  i;
       if (i==0){
         mapContainer[i].updateByScan(dataContainer, robotPoseWorld);
       }else{
-        mapContainer[i].updateByScan(dataContainers[i-1], robotPoseWorld);
+        mapContainer[i].updateByScan(getUpdateDataContainer(dataContainer, i), robotPoseWorld);
       }
     }
     //std::cout << "\n";
   }
 
+  /**
+   * Updates all levels concurrently, each coarse level being one task. The finest level has most cells to update,
+   * it can be split further into numFinestLevelBands bands of rows that are updated concurrently as well.
+   * Map updates of a single thread (the default) run on the calling thread.
+   */
+  virtual void setMapUpdateThreads(int numThreads, int numFinestLevelBands)
+  {
+    updateWorkers.setNumThreads(numThreads);
+    numUpdateBands = std::max(numFinestLevelBands, 1);
+  }
+
+  /**
+   * Derives the coarse levels from the finest one by 2x2 max pooling instead of ray tracing the scan into each of
+   * them. Only the cells inside the bounding box of a scan are pooled. When enabling, the coarse levels are rebuilt from the finest.
+   */
+  virtual void setPoolCoarseLevels(bool enabled)
+  {
+    if (enabled && !poolCoarseLevels){
+      size_t size = mapContainer.size();
+
+      for (size_t i = 1; i < size; ++i){
+        mapContainer[i].lockMap();
+        mapContainer[i].getGridMap().updateByPooling(mapContainer[i-1].getGridMap());
+        mapContainer[i].gridMapUtil->addMapUpdate();
+        mapContainer[i].unlockMap();
+      }
+    }
+
+    poolCoarseLevels = enabled;
+  }
+
+  /**
+   * Selects the fixed size hash cache instead of the map sized cache array for the filtered map accesses of level.
+   */
+  virtual void setUseHashCache(int level, bool enabled)
+  {
+    if ((level >= 0) && (level < static_cast<int>(mapContainer.size()))){
+      mapContainer[level].gridMapUtil->getCacheMethod().setUseHashCache(enabled);
+    }
+  }
+
+  /**
+   * Matches all levels against their likelihood fields, sigma is given in cells of the respective level.
+   */
+  virtual void setUseLikelihoodField(bool enabled, float sigma)
+  {
+    size_t size = mapContainer.size();
+
+    for (unsigned int i = 0; i < size; ++i){
+      mapContainer[i].gridMapUtil->setUseLikelihoodField(enabled, sigma);
+    }
+  }
+
+  /**
+   * Locks each level while matching against it, so the map can be updated concurrently. Cached map data is then
+   * refreshed by matching whenever a level has changed, instead of by onMapUpdated().
+   */
+  virtual void setLockMapsWhileMatching(bool enabled)
+  {
+    lockMapsWhileMatching = enabled;
+  }
+
+  virtual void setLatencyStats(SlamLatencyStats* stats)
+  {
+    latencyStats = stats;
+  }
+
+  virtual void setUseMapSnapshot(int level, bool enabled, bool graded)
+  {
+    if ((level >= 0) && (level < static_cast<int>(mapContainer.size()))){
+      mapContainer[level].setUseSnapshot(enabled, graded);
+    }
+  }
+
+  virtual void updateMapSnapshots()
+  {
+    size_t size = mapContainer.size();
+
+    for (size_t i = 0; i < size; ++i){
+      mapContainer[i].updateSnapshot();
+    }
+  }
+
+  virtual std::shared_ptr<const GridMapSnapshot> getMapSnapshot(int level) const
+  {
+    return mapContainer[level].getSnapshot();
+  }
+
+  virtual void saveMaps(GridMapFileWriter& writer)
+  {
+    size_t size = mapContainer.size();
+
+    for (size_t i = 0; i < size; ++i){
+      mapContainer[i].saveMap(writer);
+    }
+  }
+
+  /**
+   * Loads all levels, which have to match the configured ones. Nothing is loaded if any level does not.
+   */
+  virtual bool loadMaps(const GridMapFileReader& reader)
+  {
+    int size = static_cast<int>(mapContainer.size());
+
+    if (reader.getNumLevels() != size){
+      return false;
+    }
+
+    for (int i = 0; i < size; ++i){
+      if (!reader.fitsLevel(i, mapContainer[i].getGridMap())){
+        return false;
+      }
+    }
+
+    for (int i = 0; i < size; ++i){
+      mapContainer[i].loadMap(reader, i);
+    }
+
+    return true;
+  }
+
+  /**
+   * Sets the finest level from the grid, coarser levels are pooled from it so thin obstacles survive.
+   */
+  virtual void setStaticMap(const int8_t* gridData, int gridWidth, int gridHeight, float gridResolution, const Eigen::Vector2f& gridOriginWorld)
+  {
+    size_t size = mapContainer.size();
+
+    mapContainer[0].setFromOccupancyGrid(gridData, gridWidth, gridHeight, gridResolution, gridOriginWorld);
+
+    for (size_t i = 1; i < size; ++i){
+      mapContainer[i].setByPooling(mapContainer[i-1]);
+    }
+  }
+
   virtual void setUpdateFactorFree(float free_factor)
   {
     size_t size = mapContainer.size();
@@ -166,9 +383,137 @@ public:
     }
   }
 
+  virtual void setUseProbabilityPlane(bool enabled)
+  {
+    size_t size = mapContainer.size();
+
+    for (unsigned int i = 0; i < size; ++i){
+      GridMap& map = mapContainer[i].getGridMap();
+      map.setProbabilityPlaneEnabled(enabled);
+    }
+  }
+
+  virtual void setMatchConvergenceThresholds(float minStepTranslation, float minStepAngle, float minResidualChange)
+  {
+    size_t size = mapContainer.size();
+
+    for (unsigned int i = 0; i < size; ++i){
+      mapContainer[i].scanMatcher->setConvergenceThresholds(minStepTranslation, minStepAngle, minResidualChange);
+    }
+  }
+
+  virtual void setMatchUseLevenbergMarquardt(bool useLM)
+  {
+    size_t size = mapContainer.size();
+
+    for (unsigned int i = 0; i < size; ++i){
+      mapContainer[i].scanMatcher->setUseLevenbergMarquardt(useLM);
+    }
+  }
+
+  virtual void setMatchDeadline(const std::chrono::steady_clock::time_point& deadline)
+  {
+    size_t size = mapContainer.size();
+
+    for (unsigned int i = 0; i < size; ++i){
+      mapContainer[i].scanMatcher->setDeadline(deadline);
+    }
+  }
+
 protected:
+
+  /**
+   * Scales the scan for a coarse level. Map updates keep their own scaled copies, as with concurrent map updates
+   * matching already rescales dataContainers for the next scan while this one is being traced.
+   */
+  const DataContainer& getUpdateDataContainer(const DataContainer& dataContainer, int level)
+  {
+    DataContainer& scaled (updateDataContainers[level - 1]);
+    scaled.setFrom(dataContainer, static_cast<float>(1.0 / pow(2.0, static_cast<double>(level))));
+    return scaled;
+  }
+
+  void updateByScanParallel(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld)
+  {
+    int size = static_cast<int>(mapContainer.size());
+
+    MapProcContainer& finest (mapContainer[0]);
+    GridMap& finestMap (finest.getGridMap());
+
+    finestMap.getScanUpdateBands(dataContainer, robotPoseWorld, numUpdateBands, updateBandRows);
+
+    int numBands = static_cast<int>(updateBandRows.size()) - 1;
+
+    finest.lockMap();
+    finestMap.beginScanUpdate(dataContainer, robotPoseWorld);
+
+    updateWorkers.run(numBands + size - 1, [&](int task){
+      if (task < numBands){
+        finestMap.updateByScanRows(dataContainer, robotPoseWorld, updateBandRows[task], updateBandRows[task + 1]);
+      }else{
+        int level = task - numBands + 1;
+        mapContainer[level].updateByScan(getUpdateDataContainer(dataContainer, level), robotPoseWorld);
+      }
+    });
+
+    finestMap.finishScanUpdate();
+    finest.gridMapUtil->addMapUpdate();
+    finest.unlockMap();
+  }
+
+  void updateByScanPooled(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld)
+  {
+    size_t size = mapContainer.size();
+
+    MapProcContainer& finest (mapContainer[0]);
+    GridMap& finestMap (finest.getGridMap());
+
+    if (updateWorkers.getNumThreads() > 1){
+      finestMap.getScanUpdateBands(dataContainer, robotPoseWorld, numUpdateBands, updateBandRows);
+
+      finest.lockMap();
+      finestMap.beginScanUpdate(dataContainer, robotPoseWorld);
+
+      updateWorkers.run(static_cast<int>(updateBandRows.size()) - 1, [&](int band){
+        finestMap.updateByScanRows(dataContainer, robotPoseWorld, updateBandRows[band], updateBandRows[band + 1]);
+      });
+
+      finestMap.finishScanUpdate();
+      finest.gridMapUtil->addMapUpdate();
+      finest.unlockMap();
+    }else{
+      finest.updateByScan(dataContainer, robotPoseWorld);
+    }
+
+    //each level only needs to pool the cells covering the box changed in the next finer one
+    for (size_t i = 1; i < size; ++i){
+      Eigen::Vector2i changedMin, changedMax;
+
+      if (!mapContainer[i-1].getGridMap().getLastUpdateBounds(changedMin, changedMax)){
+        return;
+      }
+
+      mapContainer[i].lockMap();
+      mapContainer[i].getGridMap().updateByPooling(mapContainer[i-1].getGridMap(), changedMin, changedMax);
+      mapContainer[i].gridMapUtil->addMapUpdate();
+      mapContainer[i].unlockMap();
+    }
+  }
+
   std::vector<MapProcContainer> mapContainer;
   std::vector<DataContainer> dataContainers;
+  std::vector<DataContainer> updateDataContainers;
+
+  WorkerPool updateWorkers;
+  int numUpdateBands;
+  std::vector<int> updateBandRows;
+
+  bool poolCoarseLevels;
+  bool lockMapsWhileMatching;
+  SlamLatencyStats* latencyStats;
+
+  CorrelativeScanMatcher<GridMap> correlativeScanMatcher;
+  DataContainer searchDataContainer;
 };
 
 }
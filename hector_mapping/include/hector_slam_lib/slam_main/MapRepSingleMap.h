@@ -30,13 +30,18 @@
 #define _hectormaprepsinglemap_h__
 
 #include "MapRepresentationInterface.h"
+#include "SlamLatencyStats.h"
 
 #include "../map/GridMap.h"
 #include "../map/OccGridMapUtilConfig.h"
+#include "../map/GridMapSnapshot.h"
+#include "../map/GridMapFile.h"
 #include "../matcher/ScanMatcher.h"
+#include "../matcher/CorrelativeScanMatcher.h"
 
 #include "../util/DrawInterface.h"
 #include "../util/HectorDebugInfoInterface.h"
+#include "../util/WorkerPool.h"
 
 namespace hectorslam{
 
@@ -45,6 +50,9 @@ class MapRepSingleMap : public MapRepresentationInterface
 
 public:
   MapRepSingleMap(float mapResolution, DrawInterface* drawInterfaceIn, HectorDebugInfoInterface* debugInterfaceIn)
+    : numUpdateBands(1)
+    , snapshotBuffer(0)
+    , latencyStats(0)
   {
     gridMap = new hectorslam::GridMap(mapResolution,Eigen::Vector2i(1024,1024), Eigen::Vector2f(20.0f, 20.0f));
     gridMapUtil = new OccGridMapUtilConfig<GridMap>(gridMap);
@@ -56,12 +64,14 @@ public:
     delete gridMap;
     delete gridMapUtil;
     delete scanMatcher;
+    delete snapshotBuffer;
   }
 
   virtual void reset()
   {
     gridMap->reset();
-    gridMapUtil->resetCachedData();
+    gridMapUtil->resetMapData();
+    correlativeScanMatcher.invalidate();
   }
 
   virtual float getScaleToMap() const { return gridMap->getScaleToMap(); };
@@ -76,18 +86,159 @@ public:
 
   virtual Eigen::Vector3f matchData(const Eigen::Vector3f& beginEstimateWorld, const DataContainer& dataContainer, Eigen::Matrix3f& covMatrix)
   {
+    ScopedLatency latency(latencyStats ? &latencyStats->getMatchLevel(0) : 0);
+
     return scanMatcher->matchData(beginEstimateWorld, *gridMapUtil, dataContainer, covMatrix, 20);
   }
 
   virtual void updateByScan(const DataContainer& dataContainer, const Eigen::Vector3f& robotPoseWorld)
   {
-    gridMap->updateByScan(dataContainer, robotPoseWorld);
+    if ((updateWorkers.getNumThreads() < 2) || (numUpdateBands < 2)){
+      gridMap->updateByScan(dataContainer, robotPoseWorld);
+      return;
+    }
+
+    gridMap->getScanUpdateBands(dataContainer, robotPoseWorld, numUpdateBands, updateBandRows);
+
+    gridMap->beginScanUpdate(dataContainer, robotPoseWorld);
+
+    updateWorkers.run(static_cast<int>(updateBandRows.size()) - 1, [&](int band){
+      gridMap->updateByScanRows(dataContainer, robotPoseWorld, updateBandRows[band], updateBandRows[band + 1]);
+    });
+
+    gridMap->finishScanUpdate();
+  }
+
+  virtual void setMapUpdateThreads(int numThreads, int numFinestLevelBands)
+  {
+    updateWorkers.setNumThreads(numThreads);
+    numUpdateBands = std::max(numFinestLevelBands, 1);
+  }
+
+  //single level, nothing to pool
+  virtual void setPoolCoarseLevels(bool enabled) {};
+
+  virtual void setUseHashCache(int level, bool enabled)
+  {
+    if (level == 0){
+      gridMapUtil->getCacheMethod().setUseHashCache(enabled);
+    }
+  }
+
+  virtual void setUseLikelihoodField(bool enabled, float sigma)
+  {
+    gridMapUtil->setUseLikelihoodField(enabled, sigma);
+  }
+
+  //no map mutex, updates must not run concurrently to matching
+  virtual void setLockMapsWhileMatching(bool enabled) {};
+
+  virtual void setLatencyStats(SlamLatencyStats* stats)
+  {
+    latencyStats = stats;
+  }
+
+  virtual void setUseMapSnapshot(int level, bool enabled, bool graded)
+  {
+    if (level != 0){
+      return;
+    }
+
+    if (snapshotBuffer && (!enabled || (snapshotBuffer->isGraded() != graded))){
+      delete snapshotBuffer;
+      snapshotBuffer = 0;
+    }
+
+    if (enabled && !snapshotBuffer){
+      snapshotBuffer = new GridMapSnapshotBuffer(graded);
+      snapshotBuffer->rebuild(*gridMap);
+      gridMap->clearDirtyBounds();
+    }
+  }
+
+  virtual void updateMapSnapshots()
+  {
+    Eigen::Vector2i minCell, maxCell;
+
+    if (snapshotBuffer && gridMap->getDirtyBounds(minCell, maxCell)){
+      snapshotBuffer->update(*gridMap, minCell, maxCell);
+      gridMap->clearDirtyBounds();
+    }
+  }
+
+  virtual std::shared_ptr<const GridMapSnapshot> getMapSnapshot(int level) const
+  {
+    return snapshotBuffer ? snapshotBuffer->getSnapshot() : std::shared_ptr<const GridMapSnapshot>();
+  }
+
+  virtual void saveMaps(GridMapFileWriter& writer)
+  {
+    writer.addLevel(*gridMap);
+  }
+
+  virtual bool loadMaps(const GridMapFileReader& reader)
+  {
+    if ((reader.getNumLevels() != 1) || !reader.readLevel(0, *gridMap)){
+      return false;
+    }
+
+    gridMapUtil->resetMapData();
+    return true;
+  }
+
+  virtual void setStaticMap(const int8_t* gridData, int gridWidth, int gridHeight, float gridResolution, const Eigen::Vector2f& gridOriginWorld)
+  {
+    gridMap->setFromOccupancyGrid(gridData, gridWidth, gridHeight, gridResolution, gridOriginWorld);
+    gridMapUtil->resetMapData();
+  }
+
+  virtual void setUseProbabilityPlane(bool enabled)
+  {
+    gridMap->setProbabilityPlaneEnabled(enabled);
+  }
+
+  virtual void setMatchConvergenceThresholds(float minStepTranslation, float minStepAngle, float minResidualChange)
+  {
+    scanMatcher->setConvergenceThresholds(minStepTranslation, minStepAngle, minResidualChange);
+  }
+
+  virtual void setMatchUseLevenbergMarquardt(bool useLM)
+  {
+    scanMatcher->setUseLevenbergMarquardt(useLM);
+  }
+
+  virtual void setMatchDeadline(const std::chrono::steady_clock::time_point& deadline)
+  {
+    scanMatcher->setDeadline(deadline);
+  }
+
+  virtual float getMatchScore(const Eigen::Vector3f& poseWorld, const DataContainer& dataContainer)
+  {
+    return gridMapUtil->getLikelihoodForState(gridMapUtil->getMapCoordsPose(poseWorld), dataContainer);
+  }
+
+  virtual float searchPose(const Eigen::Vector3f& beginEstimateWorld, const DataContainer& dataContainer, float linearWindow, float angularWindow, Eigen::Vector3f& poseWorld)
+  {
+    Eigen::Vector3f poseMap;
+    float score = correlativeScanMatcher.match(*gridMap, dataContainer, gridMap->getMapCoordsPose(beginEstimateWorld),
+                                               linearWindow * gridMap->getScaleToMap(), angularWindow, poseMap);
+
+    poseWorld = gridMap->getWorldCoordsPose(poseMap);
+    return score;
   }
 
 protected:
   GridMap* gridMap;
   OccGridMapUtilConfig<GridMap>* gridMapUtil;
   ScanMatcher<OccGridMapUtilConfig<GridMap> >* scanMatcher;
+  CorrelativeScanMatcher<GridMap> correlativeScanMatcher;
+
+  WorkerPool updateWorkers;
+  int numUpdateBands;
+  std::vector<int> updateBandRows;
+
+  GridMapSnapshotBuffer* snapshotBuffer;
+  SlamLatencyStats* latencyStats;
 };
 
 }
@@ -29,12 +29,21 @@
 #ifndef _hectormaprepresentationinterface_h__
 #define _hectormaprepresentationinterface_h__
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
 class GridMap;
 class ConcreteOccGridMapUtil;
 class DataContainer;
 
 namespace hectorslam{
 
+class GridMapSnapshot;
+class GridMapFileWriter;
+class GridMapFileReader;
+class SlamLatencyStats;
+
 class MapRepresentationInterface
 {
 public:
@@ -59,6 +68,29 @@ public:
 
   virtual void setUpdateFactorFree(float free_factor) = 0;
   virtual void setUpdateFactorOccupied(float occupied_factor) = 0;
+  virtual void setUseProbabilityPlane(bool enabled) = 0;
+
+  virtual void setMatchConvergenceThresholds(float minStepTranslation, float minStepAngle, float minResidualChange) = 0;
+  virtual void setMatchUseLevenbergMarquardt(bool useLM) = 0;
+  virtual void setMatchDeadline(const std::chrono::steady_clock::time_point& deadline) = 0;
+  virtual void setMapUpdateThreads(int numThreads, int numFinestLevelBands) = 0;
+  virtual void setPoolCoarseLevels(bool enabled) = 0;
+  virtual void setUseHashCache(int level, bool enabled) = 0;
+  virtual void setUseLikelihoodField(bool enabled, float sigma) = 0;
+  virtual void setLockMapsWhileMatching(bool enabled) = 0;
+
+  virtual void setUseMapSnapshot(int level, bool enabled, bool graded) = 0;
+  virtual void updateMapSnapshots() = 0;
+  virtual std::shared_ptr<const GridMapSnapshot> getMapSnapshot(int level) const = 0;
+
+  virtual void saveMaps(GridMapFileWriter& writer) = 0;
+  virtual bool loadMaps(const GridMapFileReader& reader) = 0;
+  virtual void setStaticMap(const int8_t* gridData, int gridWidth, int gridHeight, float gridResolution, const Eigen::Vector2f& gridOriginWorld) = 0;
+
+  virtual void setLatencyStats(SlamLatencyStats* stats) = 0;
+
+  virtual float getMatchScore(const Eigen::Vector3f& poseWorld, const DataContainer& dataContainer) = 0;
+  virtual float searchPose(const Eigen::Vector3f& beginEstimateWorld, const DataContainer& dataContainer, float linearWindow, float angularWindow, Eigen::Vector3f& poseWorld) = 0;
 };
 
 }
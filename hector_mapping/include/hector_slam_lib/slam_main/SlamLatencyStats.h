@@ -0,0 +1,76 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __SlamLatencyStats_h_
+#define __SlamLatencyStats_h_
+
+#include <memory>
+
+#include "../util/LatencyHistogram.h"
+
+namespace hectorslam {
+
+/**
+ * Latency histograms of the processing stages of HectorSlamProcessor, see HectorSlamProcessor::setLatencyStats().
+ */
+class SlamLatencyStats
+{
+public:
+
+  SlamLatencyStats(int numMapLevels)
+    : matchLevels(new LatencyHistogram[numMapLevels])
+    , numMatchLevels(numMapLevels)
+  {}
+
+  int getNumMatchLevels() const { return numMatchLevels; };
+
+  /**
+   * Matching against one map level. With concurrent map updates this includes waiting for the map lock and
+   * refreshing cached data of the level.
+   */
+  LatencyHistogram& getMatchLevel(int level) { return matchLevels[level]; };
+
+  /**
+   * Updating all map levels with a scan.
+   */
+  LatencyHistogram mapUpdate;
+
+  /**
+   * Invalidating cached map data of all levels after a map update.
+   */
+  LatencyHistogram cacheReset;
+
+protected:
+
+  std::unique_ptr<LatencyHistogram[]> matchLevels;
+  int numMatchLevels;
+};
+
+}
+
+#endif
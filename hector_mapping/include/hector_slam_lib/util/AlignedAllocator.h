@@ -0,0 +1,81 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __AlignedAllocator_h_
+#define __AlignedAllocator_h_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace util{
+
+/**
+ * Minimal std::allocator replacement returning memory aligned to Alignment bytes, so that containers of floats can
+ * be loaded with full width (aligned) SIMD instructions.
+ */
+template<typename T, std::size_t Alignment = 32>
+class AlignedAllocator
+{
+public:
+  typedef T value_type;
+
+  template<typename U>
+  struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+  AlignedAllocator() {}
+
+  template<typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(std::size_t n)
+  {
+    void* ptr = 0;
+
+    if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, std::size_t)
+  {
+    free(ptr);
+  }
+
+  template<typename U>
+  bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+  template<typename U>
+  bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+}
+
+#endif
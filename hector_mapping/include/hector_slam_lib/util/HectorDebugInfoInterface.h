@@ -35,6 +35,12 @@ public:
   virtual void sendAndResetData() = 0;
   virtual void addHessianMatrix(const Eigen::Matrix3f& hessian) = 0;
   virtual void addPoseLikelihood(float lh) = 0;
+
+  /**
+   * Called once per matched map level with the number of iterations done, the reason for stopping (see
+   * ScanMatchTermination in ScanMatcher.h) and the final squared residual.
+   */
+  virtual void addMatchResult(int numIterations, int terminationReason, float residual) = 0;
 };
 
 #endif
@@ -0,0 +1,238 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __LatencyHistogram_h_
+#define __LatencyHistogram_h_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace hectorslam {
+
+/**
+ * Lock-free latency histogram with logarithmic buckets that are split linearly into 32 sub-buckets (like HDR
+ * histograms), so every recorded latency up to about 68 seconds is kept with a relative error below 3.2%. Any
+ * number of threads can record concurrently while another thread collects, recording is a few relaxed atomic
+ * operations and never allocates.
+ */
+class LatencyHistogram
+{
+public:
+
+  typedef std::chrono::steady_clock Clock;
+
+  enum
+  {
+    subBucketBits = 5,
+    subBucketCount = 1 << subBucketBits,
+    maxValueBits = 36,
+    bucketCount = (maxValueBits - subBucketBits + 1) * subBucketCount
+  };
+
+  /**
+   * Latencies collected over one interval, owned by a single thread.
+   */
+  class Snapshot
+  {
+  public:
+
+    Snapshot()
+      : counts(bucketCount, 0)
+      , count(0)
+      , sumNanoseconds(0)
+      , maxNanoseconds(0)
+    {}
+
+    uint64_t getCount() const { return count; };
+
+    double getMean() const { return (count > 0) ? (static_cast<double>(sumNanoseconds) * 1e-9 / count) : 0.0; };
+
+    double getMax() const { return static_cast<double>(maxNanoseconds) * 1e-9; };
+
+    /**
+     * @param quantile Between 0 and 1
+     * @return Upper bound of the bucket holding the quantile in seconds, never more than the exact maximum
+     */
+    double getQuantile(double quantile) const
+    {
+      if (count == 0){
+        return 0.0;
+      }
+
+      uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count - 1)) + 1;
+      uint64_t seen = 0;
+
+      for (int i = 0; i < bucketCount; ++i){
+        seen += counts[i];
+
+        if (seen >= rank){
+          return static_cast<double>(std::min(getBucketUpperBound(i), maxNanoseconds)) * 1e-9;
+        }
+      }
+
+      return getMax();
+    }
+
+    void clear()
+    {
+      std::fill(counts.begin(), counts.end(), 0);
+      count = 0;
+      sumNanoseconds = 0;
+      maxNanoseconds = 0;
+    }
+
+  protected:
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t sumNanoseconds;
+    uint64_t maxNanoseconds;
+
+    friend class LatencyHistogram;
+  };
+
+  LatencyHistogram()
+    : sumNanoseconds(0)
+    , maxNanoseconds(0)
+  {
+    for (int i = 0; i < bucketCount; ++i){
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  static Clock::time_point now() { return Clock::now(); };
+
+  void record(const Clock::duration& latency)
+  {
+    uint64_t nanoseconds = static_cast<uint64_t>(std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count(),
+                                                          static_cast<std::chrono::nanoseconds::rep>(0)));
+
+    counts[getBucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    sumNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t currMax = maxNanoseconds.load(std::memory_order_relaxed);
+
+    while ((nanoseconds > currMax) && !maxNanoseconds.compare_exchange_weak(currMax, nanoseconds, std::memory_order_relaxed)){
+    }
+  }
+
+  /**
+   * Records the time passed since start.
+   */
+  void recordSince(const Clock::time_point& start)
+  {
+    record(Clock::now() - start);
+  }
+
+  /**
+   * Moves everything recorded since the last call into snapshot (adding to what it holds). Latencies recorded
+   * concurrently are never lost, they end up in this or the next interval.
+   */
+  void collect(Snapshot& snapshot)
+  {
+    for (int i = 0; i < bucketCount; ++i){
+      if (counts[i].load(std::memory_order_relaxed) != 0){
+        uint64_t numRecorded = counts[i].exchange(0, std::memory_order_relaxed);
+        snapshot.counts[i] += numRecorded;
+        snapshot.count += numRecorded;
+      }
+    }
+
+    snapshot.sumNanoseconds += sumNanoseconds.exchange(0, std::memory_order_relaxed);
+    snapshot.maxNanoseconds = std::max(snapshot.maxNanoseconds, maxNanoseconds.exchange(0, std::memory_order_relaxed));
+  }
+
+  static int getBucketIndex(uint64_t nanoseconds)
+  {
+    const uint64_t maxValue = (static_cast<uint64_t>(1) << maxValueBits) - 1;
+    uint64_t value = std::min(nanoseconds, maxValue);
+
+    int shift = 0;
+
+    if (value >= 2 * subBucketCount){
+      shift = (63 - __builtin_clzll(value)) - subBucketBits;
+    }
+
+    return shift * subBucketCount + static_cast<int>(value >> shift);
+  }
+
+  static uint64_t getBucketUpperBound(int index)
+  {
+    int shift = std::max(index / subBucketCount - 1, 0);
+    uint64_t lowerBound = static_cast<uint64_t>(index - shift * subBucketCount) << shift;
+
+    return lowerBound + (static_cast<uint64_t>(1) << shift) - 1;
+  }
+
+protected:
+
+  std::atomic<uint64_t> counts[bucketCount];
+  std::atomic<uint64_t> sumNanoseconds;
+  std::atomic<uint64_t> maxNanoseconds;
+};
+
+/**
+ * Records the lifetime of the object into histogram, does nothing if histogram is zero.
+ */
+class ScopedLatency
+{
+public:
+
+  ScopedLatency(LatencyHistogram* histogramIn)
+    : histogram(histogramIn)
+  {
+    if (histogram){
+      start = LatencyHistogram::now();
+    }
+  }
+
+  ~ScopedLatency()
+  {
+    if (histogram){
+      histogram->recordSince(start);
+    }
+  }
+
+  ScopedLatency(const ScopedLatency&) = delete;
+  ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+protected:
+
+  LatencyHistogram* histogram;
+  LatencyHistogram::Clock::time_point start;
+};
+
+}
+
+#endif
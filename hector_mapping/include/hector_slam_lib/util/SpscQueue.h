@@ -0,0 +1,119 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __SpscQueue_h_
+#define __SpscQueue_h_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace hectorslam {
+
+/**
+ * Bounded lock-free queue for handing items from exactly one producer thread to exactly one consumer thread. The
+ * capacity is rounded up to a power of two. Push and pop never block, waiting for items is up to the user.
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+
+  SpscQueue(size_t minCapacity = 16)
+    : head(0)
+    , tail(0)
+  {
+    size_t capacity = 1;
+
+    while (capacity < minCapacity) {
+      capacity <<= 1;
+    }
+
+    buffer.resize(capacity);
+    mask = capacity - 1;
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  /**
+   * Producer side. Appends item unless the queue is full.
+   * @return False if the queue is full
+   */
+  bool tryPush(const T& item)
+  {
+    size_t currTail = tail.load(std::memory_order_relaxed);
+
+    if (currTail - head.load(std::memory_order_acquire) > mask) {
+      return false;
+    }
+
+    buffer[currTail & mask] = item;
+    tail.store(currTail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side. Removes the oldest item and writes it to item unless the queue is empty.
+   * @return False if the queue is empty
+   */
+  bool tryPop(T& item)
+  {
+    size_t currHead = head.load(std::memory_order_relaxed);
+
+    if (currHead == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    item = buffer[currHead & mask];
+    head.store(currHead + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Can be called from both sides, the result may be outdated immediately.
+   */
+  bool empty() const
+  {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return mask + 1; };
+
+protected:
+
+  std::vector<T> buffer;
+  size_t mask;
+
+  alignas(64) std::atomic<size_t> head; ///< Next item to pop, written by the consumer only
+  alignas(64) std::atomic<size_t> tail; ///< Next slot to push to, written by the producer only
+};
+
+}
+
+#endif
@@ -30,7 +30,6 @@
 #define utilfunctions_h__
 
 #include <cmath>
-#include "tf2/utils.h"
 
 namespace util{
 
@@ -85,21 +84,12 @@ static bool poseDifferenceLargerThan(const Eigen::Vector3f& pose1, const Eigen::
     angleDiff += M_PI * 2.0f;
   }
 
-  if (abs(angleDiff) > angleDiffThresh){
+  if (std::abs(angleDiff) > angleDiffThresh){
     return true;
   }
   return false;
 }
 
-static double getYawFromQuat(const geometry_msgs::msg::Quaternion &quat)
-{
-  tf2::Quaternion q(quat.x, quat.y, quat.z, quat.w);
-  tf2::Matrix3x3 m(q);
-  double roll, pitch, yaw;
-  m.getRPY(roll, pitch, yaw);  
-  return yaw;
-}
-
 }
 
 #endif
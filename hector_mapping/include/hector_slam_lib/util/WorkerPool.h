@@ -0,0 +1,178 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef __WorkerPool_h_
+#define __WorkerPool_h_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+namespace hectorslam {
+
+/**
+ * Persistent pool of worker threads for fork-join parallelism. run() hands out the task indices 0..numTasks-1 to the
+ * workers and the calling thread and returns once all tasks are finished. A pool with a single thread runs all tasks
+ * on the calling thread.
+ */
+class WorkerPool
+{
+public:
+
+  WorkerPool(int numThreadsIn = 1)
+    : task(0)
+    , numTasks(0)
+    , nextTask(0)
+    , numBusyWorkers(0)
+    , generation(0)
+    , shutdown(false)
+  {
+    setNumThreads(numThreadsIn);
+  }
+
+  ~WorkerPool()
+  {
+    stopWorkers();
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  /**
+   * Sets the number of threads working on tasks, including the thread calling run().
+   */
+  void setNumThreads(int numThreads)
+  {
+    stopWorkers();
+
+    shutdown = false;
+
+    for (int i = 1; i < numThreads; ++i) {
+      workers.push_back(std::thread(&WorkerPool::workerLoop, this, generation));
+    }
+  }
+
+  int getNumThreads() const { return static_cast<int>(workers.size()) + 1; };
+
+  /**
+   * Calls task(i) for i in [0, numTasksIn), distributed over all threads. Blocks until all calls have returned.
+   */
+  void run(int numTasksIn, const std::function<void(int)>& taskIn)
+  {
+    if (workers.empty() || (numTasksIn < 2)) {
+      for (int i = 0; i < numTasksIn; ++i) {
+        taskIn(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      task = &taskIn;
+      numTasks = numTasksIn;
+      nextTask = 0;
+      numBusyWorkers = static_cast<int>(workers.size());
+      ++generation;
+    }
+    workAvailable.notify_all();
+
+    processTasks();
+
+    std::unique_lock<std::mutex> lock (mutex);
+    workDone.wait(lock, [this]() { return numBusyWorkers == 0; });
+    task = 0;
+  }
+
+protected:
+
+  void processTasks()
+  {
+    for (int i = nextTask++; i < numTasks; i = nextTask++) {
+      (*task)(i);
+    }
+  }
+
+  void workerLoop(unsigned int lastGeneration)
+  {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock (mutex);
+        workAvailable.wait(lock, [this, lastGeneration]() { return shutdown || (generation != lastGeneration); });
+
+        if (shutdown) {
+          return;
+        }
+
+        lastGeneration = generation;
+      }
+
+      processTasks();
+
+      {
+        std::lock_guard<std::mutex> lock (mutex);
+        --numBusyWorkers;
+      }
+      workDone.notify_one();
+    }
+  }
+
+  void stopWorkers()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex);
+      shutdown = true;
+    }
+    workAvailable.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+      workers[i].join();
+    }
+
+    workers.clear();
+  }
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+
+  const std::function<void(int)>* task;
+  int numTasks;
+  std::atomic<int> nextTask;
+  int numBusyWorkers;
+  unsigned int generation;
+  bool shutdown;
+};
+
+}
+
+#endif
@@ -50,6 +50,7 @@ public:
   {
     debugInfoPublisher_->publish(debugInfo);
     debugInfo.iter_data.clear();
+    debugInfo.match_results.clear();
   }
 
   virtual void addHessianMatrix(const Eigen::Matrix3f& hessian)
@@ -81,6 +82,17 @@ public:
 
   }
 
+  virtual void addMatchResult(int numIterations, int terminationReason, float residual)
+  {
+    hector_nav_msgs::msg::HectorMatchResult matchResult;
+
+    matchResult.iterations = numIterations;
+    matchResult.termination_reason = static_cast<uint8_t>(terminationReason);
+    matchResult.residual = static_cast<double>(residual);
+
+    debugInfo.match_results.push_back(matchResult);
+  }
+
 
   hector_nav_msgs::msg::HectorDebugInfo debugInfo;
 
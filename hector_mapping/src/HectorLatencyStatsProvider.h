@@ -0,0 +1,167 @@
+//=================================================================================================
+// Copyright (c) 2011, Stefan Kohlbrecher, TU Darmstadt
+// All rights reserved.
+
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the Simulation, Systems Optimization and Robotics
+//       group, TU Darmstadt nor the names of its contributors may be used to
+//       endorse or promote products derived from this software without
+//       specific prior written permission.
+
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//=================================================================================================
+
+#ifndef HECTOR_LATENCY_STATS_PROVIDER_H__
+#define HECTOR_LATENCY_STATS_PROVIDER_H__
+
+#include "slam_main/SlamLatencyStats.h"
+#include "util/LatencyHistogram.h"
+
+#include "rclcpp/rclcpp.hpp"
+
+#include "diagnostic_msgs/msg/diagnostic_array.hpp"
+#include "hector_nav_msgs/msg/hector_latency_stats.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+/**
+ * Owns the latency histograms of the node and the slam processor and periodically publishes their distributions
+ * to /diagnostics and latency_stats. Histograms are recorded into from the scan processing threads without locking.
+ */
+class HectorLatencyStatsProvider
+{
+public:
+
+  HectorLatencyStatsProvider(rclcpp::Node::SharedPtr node, int numMapLevels)
+    : slamStats(numMapLevels)
+    , nh_(node)
+    , lastPublishTime_(node->get_clock()->now())
+  {
+    diagnosticsPublisher_ = nh_->create_publisher<diagnostic_msgs::msg::DiagnosticArray>("/diagnostics", 10);
+    latencyStatsPublisher_ = nh_->create_publisher<hector_nav_msgs::msg::HectorLatencyStats>("latency_stats", 10);
+
+    this->addStage("tf_wait", tfWait);
+    this->addStage("conversion", conversion);
+
+    // Levels are matched coarsest first
+    for (int i = numMapLevels - 1; i >= 0; --i)
+    {
+      this->addStage("match_level_" + std::to_string(i), slamStats.getMatchLevel(i));
+    }
+
+    this->addStage("map_update", slamStats.mapUpdate);
+    this->addStage("cache_reset", slamStats.cacheReset);
+    this->addStage("publish", publish);
+
+    snapshots_.resize(stages_.size());
+  }
+
+  void publishStats()
+  {
+    rclcpp::Time now = nh_->get_clock()->now();
+
+    hector_nav_msgs::msg::HectorLatencyStats stats;
+    stats.header.stamp = now;
+    stats.period = (now - lastPublishTime_).seconds();
+    lastPublishTime_ = now;
+
+    diagnostic_msgs::msg::DiagnosticArray diagnostics;
+    diagnostics.header.stamp = now;
+
+    for (size_t i = 0; i < stages_.size(); ++i)
+    {
+      hectorslam::LatencyHistogram::Snapshot& snapshot = snapshots_[i];
+      snapshot.clear();
+      stages_[i].second->collect(snapshot);
+
+      hector_nav_msgs::msg::HectorStageLatency stage;
+      stage.stage = stages_[i].first;
+      stage.count = snapshot.getCount();
+      stage.mean = snapshot.getMean();
+      stage.p50 = snapshot.getQuantile(0.5);
+      stage.p90 = snapshot.getQuantile(0.9);
+      stage.p99 = snapshot.getQuantile(0.99);
+      stage.p999 = snapshot.getQuantile(0.999);
+      stage.max = snapshot.getMax();
+      stats.stages.push_back(stage);
+
+      diagnostic_msgs::msg::DiagnosticStatus status;
+      status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+      status.name = std::string(nh_->get_name()) + ": " + stage.stage + " latency";
+      status.hardware_id = nh_->get_fully_qualified_name();
+      status.message = (stage.count > 0) ? ("p99 " + formatMilliseconds(stage.p99) + " ms") : std::string("no samples");
+      status.values.push_back(makeKeyValue("count", std::to_string(stage.count)));
+      status.values.push_back(makeKeyValue("mean_ms", formatMilliseconds(stage.mean)));
+      status.values.push_back(makeKeyValue("p50_ms", formatMilliseconds(stage.p50)));
+      status.values.push_back(makeKeyValue("p90_ms", formatMilliseconds(stage.p90)));
+      status.values.push_back(makeKeyValue("p99_ms", formatMilliseconds(stage.p99)));
+      status.values.push_back(makeKeyValue("p999_ms", formatMilliseconds(stage.p999)));
+      status.values.push_back(makeKeyValue("max_ms", formatMilliseconds(stage.max)));
+      diagnostics.status.push_back(status);
+    }
+
+    latencyStatsPublisher_->publish(stats);
+    diagnosticsPublisher_->publish(diagnostics);
+  }
+
+  hectorslam::SlamLatencyStats slamStats;
+
+  // Waiting for the laser to base frame transform of a scan
+  hectorslam::LatencyHistogram tfWait;
+
+  // Converting a scan to the slam data container
+  hectorslam::LatencyHistogram conversion;
+
+  // Publishing the pose, odometry and transforms of a matched scan
+  hectorslam::LatencyHistogram publish;
+
+protected:
+
+  void addStage(const std::string& name, hectorslam::LatencyHistogram& histogram)
+  {
+    stages_.push_back(std::make_pair(name, &histogram));
+  }
+
+  static std::string formatMilliseconds(double seconds)
+  {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", seconds * 1000.0);
+    return std::string(buffer);
+  }
+
+  static diagnostic_msgs::msg::KeyValue makeKeyValue(const std::string& key, const std::string& value)
+  {
+    diagnostic_msgs::msg::KeyValue keyValue;
+    keyValue.key = key;
+    keyValue.value = value;
+    return keyValue;
+  }
+
+  rclcpp::Node::SharedPtr nh_;
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr diagnosticsPublisher_;
+  rclcpp::Publisher<hector_nav_msgs::msg::HectorLatencyStats>::SharedPtr latencyStatsPublisher_;
+
+  std::vector<std::pair<std::string, hectorslam::LatencyHistogram*> > stages_;
+  std::vector<hectorslam::LatencyHistogram::Snapshot> snapshots_;
+  rclcpp::Time lastPublishTime_;
+};
+
+#endif
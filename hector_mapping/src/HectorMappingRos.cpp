@@ -29,19 +29,21 @@
 #include "HectorMappingRos.h"
 
 #include "map/GridMap.h"
+#include "scan/PointCloudConversion.h"
 
 #include "geometry_msgs/msg/pose_with_covariance_stamped.hpp"
-#include "geometry_msgs/msg/point32.hpp"
 #include "nav_msgs/msg/odometry.hpp"
 
 #include "sensor_msgs/msg/point_cloud2.hpp"
-#include "sensor_msgs/point_cloud_conversion.hpp"
+#include "sensor_msgs/msg/point_field.hpp"
 
 #include "HectorDrawings.h"
 #include "HectorDebugInfoProvider.h"
+#include "HectorLatencyStatsProvider.h"
 #include "HectorMapMutex.h"
 
 #include "tf2/convert.h"
+#include "tf2/utils.h"
 #include "tf2_ros/create_timer_ros.h"
 
 #include "boost/lexical_cast.hpp"
@@ -52,13 +54,32 @@
 
 using std::placeholders::_1;
 
+static double getYawFromQuat(const geometry_msgs::msg::Quaternion &quat)
+{
+  tf2::Quaternion q(quat.x, quat.y, quat.z, quat.w);
+  tf2::Matrix3x3 m(q);
+  double roll, pitch, yaw;
+  m.getRPY(roll, pitch, yaw);
+  return yaw;
+}
+
 HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
   : node_(node)
   , debugInfoProvider(0)
   , hectorDrawings(0)
+  , latencyStatsProvider(0)
   , lastGetMapUpdateIndex(-100)
   , tfB_(0)
   , map__publish_thread_(0)
+  , scanQueue_(16)
+  , mapUpdateQueue_(16)
+  , matchedScanJobs_(64)
+  , mappedScanJobs_(64)
+  , stop_scan_pipeline_(false)
+  , scan_match_thread_(0)
+  , map_update_thread_(0)
+  , mapGeneration_(0)
+  , map_save_thread_(0)
   , initial_pose_set_(true)
   , pause_scan_processing_(false)
 {
@@ -89,11 +110,33 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
 
   p_update_factor_free_ = node_->declare_parameter("update_factor_free", 0.4);
   p_update_factor_occupied_ = node_->declare_parameter("update_factor_occupied", 0.9);
+  p_use_probability_plane_ = node_->declare_parameter("use_probability_plane", false);
+
+  p_match_step_thresh_translation_ = node_->declare_parameter("match_step_thresh_translation", 0.02);
+  p_match_step_thresh_angle_ = node_->declare_parameter("match_step_thresh_angle", 0.0005);
+  p_match_residual_thresh_ = node_->declare_parameter("match_residual_thresh", 0.0);
+  p_match_use_levenberg_marquardt_ = node_->declare_parameter("match_use_levenberg_marquardt", false);
+  p_match_time_budget_ = node_->declare_parameter("match_time_budget", 0.0);
+  p_match_likelihood_field_ = node_->declare_parameter("match_likelihood_field", false);
+  p_match_likelihood_field_sigma_ = node_->declare_parameter("match_likelihood_field_sigma", 1.0);
+
+  p_relocalization_min_score_ = node_->declare_parameter("relocalization_min_score", 0.0);
+  p_relocalization_linear_window_ = node_->declare_parameter("relocalization_linear_window", 3.0);
+  p_relocalization_angular_window_ = node_->declare_parameter("relocalization_angular_window", M_PI);
+  p_relocalize_initial_pose_ = node_->declare_parameter("relocalize_initial_pose", false);
 
   p_map_update_distance_threshold_ = node_->declare_parameter("map_update_distance_thresh", 0.4);
   p_map_update_angle_threshold_ = node_->declare_parameter("map_update_angle_thresh", 0.9);
+  p_map_update_threads_ = node_->declare_parameter("map_update_threads", 1);
+  p_map_update_finest_level_bands_ = node_->declare_parameter("map_update_finest_level_bands", 1);
+  p_map_pool_coarse_levels_ = node_->declare_parameter("map_pool_coarse_levels", false);
+  p_map_hash_cache_levels_ = node_->declare_parameter("map_hash_cache_levels", std::vector<int64_t>());
 
   p_scan_topic_ = node_->declare_parameter("scan_topic", "/scan");
+  p_scan_cloud_topic_ = node_->declare_parameter("scan_cloud_topic", "");
+  p_fused_scan_topics_ = node_->declare_parameter("fused_scan_topics", std::vector<std::string>());
+  p_fused_scan_cloud_topics_ = node_->declare_parameter("fused_scan_cloud_topics", std::vector<std::string>());
+  p_scan_fusion_window_ = node_->declare_parameter("scan_fusion_window", 0.05);
   p_sys_msg_topic_ = node_->declare_parameter("sys_msg_topic", "syscommand");
   p_pose_update_topic_ = node_->declare_parameter("pose_update_topic", "poseupdate");
 
@@ -109,8 +152,24 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
   p_tf_map_scanmatch_transform_frame_name_ = node_->declare_parameter("tf_map_scanmatch_transform_frame_name", "base_link");
 
   p_timing_output_ = node_->declare_parameter("output_timing", false);
+  p_latency_stats_ = node_->declare_parameter("latency_stats", false);
+  p_latency_stats_period_ = node_->declare_parameter("latency_stats_period", 5.0);
+
+  p_async_scan_processing_ = node_->declare_parameter("async_scan_processing", false);
+  p_scan_drop_stale_ = node_->declare_parameter("scan_drop_stale", true);
 
   p_map_pub_period_ = node_->declare_parameter("map_pub_period", 2.0);
+  p_map_pub_incremental_ = node_->declare_parameter("map_pub_incremental", false);
+  p_map_pub_full_period_ = node_->declare_parameter("map_pub_full_period", 30.0);
+  p_map_pub_snapshots_ = node_->declare_parameter("map_pub_snapshots", false);
+  p_map_pub_graded_ = node_->declare_parameter("map_pub_graded", false);
+  p_map_pub_threads_ = node_->declare_parameter("map_pub_threads", 1);
+
+  p_map_file_ = node_->declare_parameter("map_file", std::string(""));
+  p_map_save_period_ = node_->declare_parameter("map_save_period", 0.0);
+
+  p_localization_mode_ = node_->declare_parameter("localization_mode", false);
+  p_static_map_topic_ = node_->declare_parameter("static_map_topic", std::string(""));
 
   double tmp;
   tmp = node_->declare_parameter("laser_min_dist", 0.4);
@@ -125,6 +184,26 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
   tmp = node_->declare_parameter("laser_z_max_value", 1.0);
   p_laser_z_max_value_ = static_cast<float>(tmp);
 
+  p_cloud_ring_min_ = node_->declare_parameter("cloud_ring_min", -1);
+  p_cloud_ring_max_ = node_->declare_parameter("cloud_ring_max", -1);
+  p_cloud_angular_bins_ = node_->declare_parameter("cloud_angular_bins", 1080);
+
+  // Without tf every input would stay in its own sensor frame, fusing them needs the extrinsics from tf
+  if (!p_use_tf_scan_transformation_ && (!p_fused_scan_topics_.empty() || !p_fused_scan_cloud_topics_.empty()))
+  {
+    RCLCPP_ERROR(node_->get_logger(), "HectorSM fused_scan_topics and fused_scan_cloud_topics need use_tf_scan_transformation, only using the primary input");
+    p_fused_scan_topics_.clear();
+    p_fused_scan_cloud_topics_.clear();
+  }
+
+  size_t num_scan_sources = 1 + p_fused_scan_topics_.size() + p_fused_scan_cloud_topics_.size();
+
+  for (size_t i = 0; i < num_scan_sources; ++i)
+  {
+    scanSources_.push_back(std::unique_ptr<ScanSource>(new ScanSource()));
+    scanSources_.back()->pointCloudSlicer.setNumBins(p_cloud_angular_bins_);
+  }
+
   if (p_pub_drawings)
   {
     RCLCPP_INFO(node_->get_logger(), "HectorSM publishing debug drawings");
@@ -142,11 +221,71 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
     odometryPublisher_ = node_->create_publisher<nav_msgs::msg::Odometry>("scanmatch_odom", 50);
   }
 
-  slamProcessor = new hectorslam::HectorSlamProcessor(static_cast<float>(p_map_resolution_), p_map_size_, p_map_size_, Eigen::Vector2f(p_map_start_x_, p_map_start_y_), p_map_multi_res_levels_, hectorDrawings, debugInfoProvider);
+  // A saved map defines the map geometry, so mapping resumes in the same frame after a restart
+  hectorslam::GridMapFileReader mapFileReader;
+  Eigen::Vector2i mapSize(p_map_size_, p_map_size_);
+
+  if (!p_map_file_.empty() && mapFileReader.open(p_map_file_))
+  {
+    MapDimensionProperties dimProperties(mapFileReader.getLevelDimProperties(0));
+
+    mapSize = dimProperties.getMapDimensions();
+    p_map_resolution_ = dimProperties.getCellLength();
+    p_map_start_x_ = dimProperties.getTopLeftOffset().x() / (p_map_resolution_ * mapSize.x());
+    p_map_start_y_ = dimProperties.getTopLeftOffset().y() / (p_map_resolution_ * mapSize.y());
+    p_map_multi_res_levels_ = mapFileReader.getNumLevels();
+  }
+
+  slamProcessor = new hectorslam::HectorSlamProcessor(static_cast<float>(p_map_resolution_), mapSize.x(), mapSize.y(), Eigen::Vector2f(p_map_start_x_, p_map_start_y_), p_map_multi_res_levels_, hectorDrawings, debugInfoProvider);
+
+  if (p_latency_stats_)
+  {
+    RCLCPP_INFO(node_->get_logger(), "HectorSM publishing latency stats every %f seconds", p_latency_stats_period_);
+    latencyStatsProvider = new HectorLatencyStatsProvider(node_, slamProcessor->getMapLevels());
+    slamProcessor->setLatencyStats(&latencyStatsProvider->slamStats);
+    latencyStatsTimer_ = node_->create_wall_timer(std::chrono::duration<double>(p_latency_stats_period_),
+        std::bind(&HectorLatencyStatsProvider::publishStats, latencyStatsProvider));
+  }
+
   slamProcessor->setUpdateFactorFree(p_update_factor_free_);
   slamProcessor->setUpdateFactorOccupied(p_update_factor_occupied_);
+  slamProcessor->setUseProbabilityPlane(p_use_probability_plane_);
+  slamProcessor->setMatchConvergenceThresholds(p_match_step_thresh_translation_, p_match_step_thresh_angle_, p_match_residual_thresh_);
+  slamProcessor->setMatchUseLevenbergMarquardt(p_match_use_levenberg_marquardt_);
+  slamProcessor->setUseLikelihoodField(p_match_likelihood_field_, static_cast<float>(p_match_likelihood_field_sigma_));
+  slamProcessor->setRelocalizationMinScore(p_relocalization_min_score_);
+  slamProcessor->setRelocalizationSearchWindow(p_relocalization_linear_window_, p_relocalization_angular_window_);
   slamProcessor->setMapUpdateMinDistDiff(p_map_update_distance_threshold_);
   slamProcessor->setMapUpdateMinAngleDiff(p_map_update_angle_threshold_);
+  slamProcessor->setMapUpdateThreads(p_map_update_threads_, p_map_update_finest_level_bands_);
+  slamProcessor->setPoolCoarseLevels(p_map_pool_coarse_levels_);
+  slamProcessor->setUseMapSnapshot(0, p_map_pub_snapshots_, p_map_pub_graded_);
+
+  mapPubWorkers_.setNumThreads(p_map_pub_threads_);
+
+  for (size_t i = 0; i < p_map_hash_cache_levels_.size(); ++i)
+  {
+    slamProcessor->setUseHashCache(static_cast<int>(p_map_hash_cache_levels_[i]), true);
+  }
+
+  if (mapFileReader.isOpen())
+  {
+    if (slamProcessor->loadMaps(mapFileReader))
+    {
+      initial_pose_ = slamProcessor->getLastScanMatchPose();
+      initial_pose_set_ = true;
+      RCLCPP_INFO(node_->get_logger(), "HectorSM loaded map from %s, resuming at x: %f y: %f yaw: %f", p_map_file_.c_str(),
+                  initial_pose_[0], initial_pose_[1], initial_pose_[2]);
+    }
+    else
+    {
+      RCLCPP_ERROR(node_->get_logger(), "HectorSM map file %s does not match the map configuration, starting with an empty map", p_map_file_.c_str());
+    }
+
+    mapFileReader.close();
+  }
+
+  slamProcessor->setLocalizationMode(p_localization_mode_);
 
   int mapLevels = slamProcessor->getMapLevels();
   mapLevels = 1;
@@ -169,6 +308,15 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
     MapPublisherContainer& tmp = mapPubContainer[i];
     tmp.mapPublisher_ = node_->create_publisher<nav_msgs::msg::OccupancyGrid>(mapTopicStr, 1);
     tmp.mapMetadataPublisher_ = node_->create_publisher<nav_msgs::msg::MapMetaData>(mapMetaTopicStr, 1);
+    tmp.minCell_ = Eigen::Vector2i(0, 0);
+    tmp.maxCell_ = Eigen::Vector2i(-1, -1);
+    tmp.lastMapSubscriptionCount_ = 0;
+    tmp.lastFullMapPublishTime_ = rclcpp::Time(0, 0, node_->get_clock()->get_clock_type());
+
+    if (p_map_pub_incremental_)
+    {
+      tmp.mapUpdatesPublisher_ = node_->create_publisher<map_msgs::msg::OccupancyGridUpdate>(mapTopicStr + "_updates", 10);
+    }
 
     if ( (i == 0) && p_advertise_map_service_)
     {
@@ -190,26 +338,92 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
         std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
   toggle_scan_processing_service_ = node_->create_service<std_srvs::srv::SetBool>("pause_mapping", std::bind(&HectorMappingRos::pauseMapCallback, this,
         std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+  relocalize_service_ = node_->create_service<hector_nav_msgs::srv::RelocalizeScan>("relocalize", std::bind(&HectorMappingRos::relocalizeCallback, this,
+        std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+  save_map_service_ = node_->create_service<std_srvs::srv::Trigger>("save_map", std::bind(&HectorMappingRos::saveMapCallback, this,
+        std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
 
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_base_frame_: %s", p_base_frame_.c_str());
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_frame_: %s", p_map_frame_.c_str());
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_odom_frame_: %s", p_odom_frame_.c_str());
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_scan_topic_: %s", p_scan_topic_.c_str());
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_scan_cloud_topic_: %s", p_scan_cloud_topic_.c_str());
+  for (const std::string& topic : p_fused_scan_topics_)
+  {
+    RCLCPP_INFO(node_->get_logger(), "HectorSM p_fused_scan_topics_: %s", topic.c_str());
+  }
+  for (const std::string& topic : p_fused_scan_cloud_topics_)
+  {
+    RCLCPP_INFO(node_->get_logger(), "HectorSM p_fused_scan_cloud_topics_: %s", topic.c_str());
+  }
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_scan_fusion_window_: %f", p_scan_fusion_window_);
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_use_tf_scan_transformation_: %s", p_use_tf_scan_transformation_ ? ("true") : ("false"));
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_pub_map_odom_transform_: %s", p_pub_map_odom_transform_ ? ("true") : ("false"));
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_scan_subscriber_queue_size_: %d", p_scan_subscriber_queue_size_);
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pub_period_: %f", p_map_pub_period_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pub_incremental_: %s", p_map_pub_incremental_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pub_full_period_: %f", p_map_pub_full_period_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pub_snapshots_: %s", p_map_pub_snapshots_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pub_graded_: %s", p_map_pub_graded_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pub_threads_: %d", p_map_pub_threads_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_file_: %s", p_map_file_.c_str());
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_save_period_: %f", p_map_save_period_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_localization_mode_: %s", p_localization_mode_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_static_map_topic_: %s", p_static_map_topic_.c_str());
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_update_factor_free_: %f", p_update_factor_free_);
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_update_factor_occupied_: %f", p_update_factor_occupied_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_use_probability_plane_: %s", p_use_probability_plane_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_step_thresh_translation_: %f", p_match_step_thresh_translation_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_step_thresh_angle_: %f", p_match_step_thresh_angle_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_residual_thresh_: %f", p_match_residual_thresh_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_use_levenberg_marquardt_: %s", p_match_use_levenberg_marquardt_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_time_budget_: %f", p_match_time_budget_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_likelihood_field_: %s", p_match_likelihood_field_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_match_likelihood_field_sigma_: %f", p_match_likelihood_field_sigma_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_relocalization_min_score_: %f", p_relocalization_min_score_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_relocalization_linear_window_: %f", p_relocalization_linear_window_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_relocalization_angular_window_: %f", p_relocalization_angular_window_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_relocalize_initial_pose_: %s", p_relocalize_initial_pose_ ? ("true") : ("false"));
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_update_distance_threshold_: %f ", p_map_update_distance_threshold_);
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_update_angle_threshold_: %f", p_map_update_angle_threshold_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_update_threads_: %d", p_map_update_threads_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_update_finest_level_bands_: %d", p_map_update_finest_level_bands_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_pool_coarse_levels_: %s", p_map_pool_coarse_levels_ ? ("true") : ("false"));
+  for (size_t i = 0; i < p_map_hash_cache_levels_.size(); ++i)
+  {
+    RCLCPP_INFO(node_->get_logger(), "HectorSM p_map_hash_cache_levels_: %ld", static_cast<long>(p_map_hash_cache_levels_[i]));
+  }
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_async_scan_processing_: %s", p_async_scan_processing_ ? ("true") : ("false"));
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_scan_drop_stale_: %s", p_scan_drop_stale_ ? ("true") : ("false"));
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_laser_z_min_value_: %f", p_laser_z_min_value_);
   RCLCPP_INFO(node_->get_logger(), "HectorSM p_laser_z_max_value_: %f", p_laser_z_max_value_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_cloud_ring_min_: %d", p_cloud_ring_min_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_cloud_ring_max_: %d", p_cloud_ring_max_);
+  RCLCPP_INFO(node_->get_logger(), "HectorSM p_cloud_angular_bins_: %d", p_cloud_angular_bins_);
 
   rmw_qos_profile_t qos_profile = rmw_qos_profile_sensor_data;
   auto qos = rclcpp::QoS(rclcpp::QoSInitialization(qos_profile.history, 5), qos_profile);
 
-  scanSubscriber_ = node_->create_subscription<sensor_msgs::msg::LaserScan>(p_scan_topic_, qos, std::bind(&HectorMappingRos::scanCallback, this, _1));
+  // Multi ring clouds replace the laser scan input if a cloud topic is given
+  if (p_scan_cloud_topic_.empty())
+  {
+    scanSubscriber_ = node_->create_subscription<sensor_msgs::msg::LaserScan>(p_scan_topic_, qos, std::bind(&HectorMappingRos::scanCallback, this, _1));
+  }
+  else
+  {
+    cloudSubscriber_ = node_->create_subscription<sensor_msgs::msg::PointCloud2>(p_scan_cloud_topic_, qos, std::bind(&HectorMappingRos::pointCloudCallback, this, _1));
+  }
+
+  // Further inputs, their scans are fused with the primary input into one frame per update
+  size_t source_index = 1;
+  for (const std::string& topic : p_fused_scan_topics_)
+  {
+    fusedScanSubscribers_.push_back(node_->create_subscription<sensor_msgs::msg::LaserScan>(topic, qos, std::bind(&HectorMappingRos::fusedScanCallback, this, _1, source_index++)));
+  }
+  for (const std::string& topic : p_fused_scan_cloud_topics_)
+  {
+    fusedCloudSubscribers_.push_back(node_->create_subscription<sensor_msgs::msg::PointCloud2>(topic, qos, std::bind(&HectorMappingRos::fusedPointCloudCallback, this, _1, source_index++)));
+  }
   sysMsgSubscriber_ = node_->create_subscription<std_msgs::msg::String>(p_sys_msg_topic_, 2, std::bind(&HectorMappingRos::sysMsgCallback, this, _1));
 
   poseUpdatePublisher_ = node_->create_publisher<geometry_msgs::msg::PoseWithCovarianceStamped>(p_pose_update_topic_, 1);
@@ -217,13 +431,12 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
 
   scan_point_cloud_publisher_ = node_->create_publisher<sensor_msgs::msg::PointCloud2>("slam_cloud",1);
 
-  /*
-  bool p_use_static_map_ = false;
-
-  if (p_use_static_map_){
-    mapSubscriber_ = node_.subscribe(mapTopic_, 1, &HectorMappingRos::staticMapCallback, this);
+  // Prebuilt maps, e.g. from map_server, are latched
+  if (!p_static_map_topic_.empty())
+  {
+    mapSubscriber_ = node_->create_subscription<nav_msgs::msg::OccupancyGrid>(p_static_map_topic_, rclcpp::QoS(1).transient_local(),
+        std::bind(&HectorMappingRos::staticMapCallback, this, std::placeholders::_1));
   }
-  */
 
   initial_pose_sub_ =
     node_->create_subscription<geometry_msgs::msg::PoseWithCovarianceStamped>(
@@ -232,13 +445,41 @@ HectorMappingRos::HectorMappingRos(rclcpp::Node::SharedPtr node)
 
   map__publish_thread_ = new boost::thread(boost::bind(&HectorMappingRos::publishMapLoop, this, p_map_pub_period_));
 
+  if (p_async_scan_processing_)
+  {
+    // Map updates run concurrently to matching, so every level needs a mutex, not only the published one
+    for (int i = mapLevels; i < slamProcessor->getMapLevels(); ++i)
+    {
+      slamProcessor->addMapMutex(i, new HectorMapMutex());
+    }
+
+    slamProcessor->setConcurrentMapUpdates(true);
+
+    // Enough jobs to fill the scan queue while one scan is matched and the map update queue is full
+    for (unsigned int i = 0; i < scanQueue_.capacity() + mapUpdateQueue_.capacity() + 2; ++i)
+    {
+      scanJobs_.push_back(std::unique_ptr<ScanJob>(new ScanJob()));
+      freeScanJobs_.push_back(scanJobs_.back().get());
+    }
+
+    scan_match_thread_ = new boost::thread(boost::bind(&HectorMappingRos::scanMatchLoop, this));
+    map_update_thread_ = new boost::thread(boost::bind(&HectorMappingRos::mapUpdateLoop, this));
+  }
+
   lastMapPublishTime = rclcpp::Time(0,0);
 }
 
 HectorMappingRos::~HectorMappingRos()
 {
+  this->stopScanPipeline();
+
   delete slamProcessor;
 
+  latencyStatsTimer_.reset();
+
+  if (latencyStatsProvider)
+    delete latencyStatsProvider;
+
   if (hectorDrawings)
     delete hectorDrawings;
 
@@ -250,9 +491,36 @@ HectorMappingRos::~HectorMappingRos()
 
   if(map__publish_thread_)
     delete map__publish_thread_;
+
+  if (map_save_thread_)
+  {
+    map_save_thread_->join();
+    delete map_save_thread_;
+  }
 }
 
 void HectorMappingRos::scanCallback(const sensor_msgs::msg::LaserScan& scan)
+{
+  this->processScan(scan, *scanSources_[0]);
+}
+
+void HectorMappingRos::pointCloudCallback(const sensor_msgs::msg::PointCloud2& cloud)
+{
+  this->processScan(cloud, *scanSources_[0]);
+}
+
+void HectorMappingRos::fusedScanCallback(const sensor_msgs::msg::LaserScan& scan, size_t sourceIndex)
+{
+  this->processScan(scan, *scanSources_[sourceIndex]);
+}
+
+void HectorMappingRos::fusedPointCloudCallback(const sensor_msgs::msg::PointCloud2& cloud, size_t sourceIndex)
+{
+  this->processScan(cloud, *scanSources_[sourceIndex]);
+}
+
+template<typename ScanMessage>
+void HectorMappingRos::processScan(const ScanMessage& scan, ScanSource& source)
 {
 
   if (pause_scan_processing_)
@@ -260,111 +528,283 @@ void HectorMappingRos::scanCallback(const sensor_msgs::msg::LaserScan& scan)
     return;
   }
 
+  // With the asynchronous pipeline, this only converts the scan and hands it to the scan matching thread
+  if (p_async_scan_processing_)
+  {
+    this->enqueueScan(scan, source);
+    return;
+  }
+
   if (hectorDrawings)
   {
     hectorDrawings->setTime(scan.header.stamp);
   }
 
   auto start_time = node_->get_clock()->now().seconds();
-  if (!p_use_tf_scan_transformation_)
+
+  // Convert the laser scan to our data container, in the base frame if we are using the tf tree. This may wait for tf,
+  // so it happens before locking.
+  rclcpp::Time stamp;
+  if (!this->convertScan(scan, source, convertedScanContainer, stamp))
   {
-    // If we are not using the tf tree to find the transform between the base frame and laser frame,
-    // then just convert the laser scan to our data container and process the update based on our last
-    // pose estimate
-    this->rosLaserScanToDataContainer(scan, laserScanContainer, slamProcessor->getScaleToMap());
-    slamProcessor->update(laserScanContainer, slamProcessor->getLastScanMatchPose());
+    return;
   }
-  else
+
+  boost::mutex::scoped_lock lock(slamMutex_);
+
+  this->updateMatchTimeBudget(stamp);
+
+  Eigen::Vector3f start_estimate(this->getStartEstimate(convertedScanContainer, stamp));
+
+  // If "p_map_with_known_poses_" is enabled, we assume that start_estimate is precise and doesn't need to be refined
+  slamProcessor->update(convertedScanContainer, start_estimate, p_use_tf_scan_transformation_ && p_map_with_known_poses_);
+
+  // Keep the scan for the relocalization service
+  laserScanContainer.setFrom(convertedScanContainer, 1.0f);
+
+  // If the debug flag "p_timing_output_" is enabled, print how long this last iteration took
+  if (p_timing_output_)
+  {
+    auto duration = node_->get_clock()->now().seconds() - start_time;
+    RCLCPP_INFO(node_->get_logger(), "HectorSLAM Iter took: %f milliseconds", duration * 1000.0);
+  }
+
+  // If we're just building a map with known poses, we're finished now. Code below this point publishes the localization results.
+  if (p_map_with_known_poses_)
+  {
+    return;
+  }
+
+  this->publishScanMatchResults(stamp);
+}
+
+template<typename ScanMessage>
+bool HectorMappingRos::convertScan(const ScanMessage& scan, ScanSource& source, hectorslam::DataContainer& dataContainer, rclcpp::Time& stamp)
+{
+  if (scanSources_.size() == 1)
+  {
+    stamp = scan.header.stamp;
+    return this->scanToDataContainer(scan, source, dataContainer);
+  }
+
+  // With several inputs, the scan waits for the scans of the other inputs, dataContainer only gets complete frames
+  if (!this->scanToDataContainer(scan, source, source.convertedScan))
+  {
+    return false;
+  }
+
+  return this->fuseScan(source, scan.header.stamp, dataContainer, stamp);
+}
+
+bool HectorMappingRos::fuseScan(ScanSource& source, const rclcpp::Time& stamp, hectorslam::DataContainer& dataContainer, rclcpp::Time& fusedStamp)
+{
+  // A frame holds at most one scan per input, all within the fusion window. A scan that does not fit in closes the
+  // frame early, so inputs that stop publishing do not stall the others.
+  bool close_frame = source.pending;
+  bool frame_empty = true;
+
+  for (const std::unique_ptr<ScanSource>& other : scanSources_)
   {
-    // If we are using the tf tree to find the transform between the base frame and laser frame,
-    // let's get that transform
-    geometry_msgs::msg::TransformStamped laser_transform;
-    if (tf_->canTransform(p_base_frame_, scan.header.frame_id, scan.header.stamp, rclcpp::Duration::from_seconds(0.5)))
+    if (other->pending)
     {
-      laser_transform = tf_->lookupTransform(p_base_frame_, scan.header.frame_id, scan.header.stamp);
+      frame_empty = false;
+      close_frame = close_frame || (std::abs((stamp - other->pendingStamp).seconds()) > p_scan_fusion_window_);
     }
-    else
+  }
+
+  bool frame_done = close_frame && !frame_empty;
+
+  if (frame_done)
+  {
+    this->collectPendingScans(dataContainer, fusedStamp);
+  }
+
+  std::swap(source.pendingScan, source.convertedScan);
+  source.pendingStamp = stamp;
+  source.pending = true;
+
+  if (!frame_done)
+  {
+    bool all_pending = true;
+
+    for (const std::unique_ptr<ScanSource>& other : scanSources_)
     {
-      RCLCPP_INFO(node_->get_logger(), "lookupTransform %s to %s timed out. Could not transform laser scan into base_frame.", p_base_frame_.c_str(), scan.header.frame_id.c_str());
-      return;
+      all_pending = all_pending && other->pending;
     }
 
-    // Convert the laser scan to point cloud
-    projector_.projectLaser(scan, laser_point_cloud_, 30.0);
-
-    // Publish the point cloud if there are any subscribers
-    if (scan_point_cloud_publisher_->get_subscription_count() > 0)
+    if (all_pending)
     {
-      scan_point_cloud_publisher_->publish(laser_point_cloud_);
+      this->collectPendingScans(dataContainer, fusedStamp);
+      frame_done = true;
     }
+  }
+
+  return frame_done;
+}
 
-    // Convert the point cloud to our data container
-    this->rosPointCloudToDataContainer(laser_point_cloud_, laser_transform, laserScanContainer, slamProcessor->getScaleToMap());
+void HectorMappingRos::collectPendingScans(hectorslam::DataContainer& dataContainer, rclcpp::Time& fusedStamp)
+{
+  // Each scan keeps the position of its sensor as origin of its beams, the frame is stamped with its newest scan
+  dataContainer.clear();
+  bool first = true;
 
-    // Now let's choose the initial pose estimate for our slam process update
-    Eigen::Vector3f start_estimate(Eigen::Vector3f::Zero());
-    if (initial_pose_set_)
+  for (const std::unique_ptr<ScanSource>& source : scanSources_)
+  {
+    if (source->pending)
     {
-      // User has requested a pose reset
-      initial_pose_set_ = false;
-      start_estimate = initial_pose_;
+      dataContainer.append(source->pendingScan);
+      fusedStamp = first ? source->pendingStamp : std::max(fusedStamp, source->pendingStamp);
+      first = false;
+      source->pending = false;
     }
-    else if (p_use_tf_pose_start_estimate_)
-    {
-      // Initial pose estimate comes from the tf tree
-      if (tf_->canTransform(p_map_frame_, p_base_frame_, scan.header.stamp, rclcpp::Duration::from_seconds(0.5)))
-      {
-        geometry_msgs::msg::TransformStamped stamped_pose;
+  }
+}
+
+void HectorMappingRos::updateMatchTimeBudget(const rclcpp::Time& stamp)
+{
+  // The matching time budget counts from the scan time stamp, so scans that are already late because processing
+  // falls behind get fewer iterations. They are always matched with at least one iteration per map level.
+  if (p_match_time_budget_ > 0.0)
+  {
+    double scan_age = node_->get_clock()->now().seconds() - stamp.seconds();
+    slamProcessor->setMatchTimeBudget(static_cast<float>(std::max(p_match_time_budget_ - std::max(scan_age, 0.0), 1e-6)));
+  }
+}
 
-        stamped_pose = tf_->lookupTransform(p_map_frame_, p_base_frame_, scan.header.stamp);
+bool HectorMappingRos::scanToDataContainer(const sensor_msgs::msg::LaserScan& scan, ScanSource& source, hectorslam::DataContainer& dataContainer)
+{
+  if (!p_use_tf_scan_transformation_)
+  {
+    // If we are not using the tf tree to find the transform between the base frame and laser frame,
+    // then just convert the laser scan to our data container and process the update based on our last
+    // pose estimate
+    hectorslam::ScopedLatency conversion_latency(latencyStatsProvider ? &latencyStatsProvider->conversion : 0);
 
-        tf2::Quaternion tmp_(
-          stamped_pose.transform.rotation.x,
-          stamped_pose.transform.rotation.y,
-          stamped_pose.transform.rotation.z,
-          stamped_pose.transform.rotation.w);
-        double roll, pitch, yaw;
-        tf2::Matrix3x3(tmp_).getRPY(roll, pitch, yaw);
+    this->rosLaserScanToDataContainer(scan, source.laserScanProjection, dataContainer, slamProcessor->getScaleToMap());
+    return true;
+  }
 
-        start_estimate = Eigen::Vector3f(stamped_pose.transform.translation.x, stamped_pose.transform.translation.y, yaw);
-      }
-      else
+  // If we are using the tf tree to find the transform between the base frame and laser frame,
+  // let's get that transform
+  geometry_msgs::msg::TransformStamped laser_transform;
+  if (!this->lookupLaserTransform(scan.header, laser_transform))
+  {
+    return false;
+  }
+
+  hectorslam::ScopedLatency conversion_latency(latencyStatsProvider ? &latencyStatsProvider->conversion : 0);
+
+  // Project the laser scan straight into our data container
+  this->rosLaserScanToDataContainer(scan, laser_transform, source.laserScanProjection, dataContainer, slamProcessor->getScaleToMap());
+
+  // Only build and publish the point cloud if there are any subscribers
+  if (scan_point_cloud_publisher_->get_subscription_count() > 0)
+  {
+    projector_.projectLaser(scan, laser_point_cloud_, 30.0);
+    scan_point_cloud_publisher_->publish(laser_point_cloud_);
+  }
+
+  return true;
+}
+
+bool HectorMappingRos::scanToDataContainer(const sensor_msgs::msg::PointCloud2& cloud, ScanSource& source, hectorslam::DataContainer& dataContainer)
+{
+  // Without the tf tree, the cloud is taken to be in the base frame
+  geometry_msgs::msg::TransformStamped laser_transform;
+  if (p_use_tf_scan_transformation_ && !this->lookupLaserTransform(cloud.header, laser_transform))
+  {
+    return false;
+  }
+
+  hectorslam::ScopedLatency conversion_latency(latencyStatsProvider ? &latencyStatsProvider->conversion : 0);
+
+  this->rosPointCloudToDataContainer(cloud, laser_transform, source.pointCloudSlicer, dataContainer, slamProcessor->getScaleToMap());
+  return true;
+}
+
+bool HectorMappingRos::lookupLaserTransform(const std_msgs::msg::Header& header, geometry_msgs::msg::TransformStamped& laserTransform)
+{
+  hectorslam::ScopedLatency tf_wait_latency(latencyStatsProvider ? &latencyStatsProvider->tfWait : 0);
+
+  if (!tf_->canTransform(p_base_frame_, header.frame_id, header.stamp, rclcpp::Duration::from_seconds(0.5)))
+  {
+    RCLCPP_INFO(node_->get_logger(), "lookupTransform %s to %s timed out. Could not transform laser scan into base_frame.", p_base_frame_.c_str(), header.frame_id.c_str());
+    return false;
+  }
+
+  laserTransform = tf_->lookupTransform(p_base_frame_, header.frame_id, header.stamp);
+  return true;
+}
+
+Eigen::Vector3f HectorMappingRos::getStartEstimate(const hectorslam::DataContainer& dataContainer, const rclcpp::Time& stamp)
+{
+  // Without the tf tree, the initial pose estimate is always the last estimated pose
+  if (!p_use_tf_scan_transformation_)
+  {
+    return slamProcessor->getLastScanMatchPose();
+  }
+
+  // Now let's choose the initial pose estimate for our slam process update
+  Eigen::Vector3f start_estimate(Eigen::Vector3f::Zero());
+  if (initial_pose_set_)
+  {
+    // User has requested a pose reset
+    initial_pose_set_ = false;
+    start_estimate = initial_pose_;
+
+    // The requested pose may be rough, search the map around it
+    if (p_relocalize_initial_pose_ && slamProcessor->getGridMap().hasUpdates())
+    {
+      Eigen::Vector3f relocalized_pose;
+      float score = slamProcessor->relocalize(dataContainer, initial_pose_, p_relocalization_linear_window_, p_relocalization_angular_window_, relocalized_pose);
+
+      if (score > 0.0f)
       {
-        RCLCPP_ERROR(node_->get_logger(), "Transform from %s to %s failed\n", p_map_frame_.c_str(), p_base_frame_.c_str());
-        start_estimate = slamProcessor->getLastScanMatchPose();
+        RCLCPP_INFO(node_->get_logger(), "[HectorSM]: Relocalized initial pose to x: %f y: %f yaw: %f, score: %f",
+                    relocalized_pose[0], relocalized_pose[1], relocalized_pose[2], score);
+        start_estimate = relocalized_pose;
       }
     }
-    else
+  }
+  else if (p_use_tf_pose_start_estimate_)
+  {
+    // Initial pose estimate comes from the tf tree
+    if (tf_->canTransform(p_map_frame_, p_base_frame_, stamp, rclcpp::Duration::from_seconds(0.5)))
     {
-      // If none of the above, the initial pose is simply the last estimated pose
-      start_estimate = slamProcessor->getLastScanMatchPose();
-    }
+      geometry_msgs::msg::TransformStamped stamped_pose;
 
-    // If "p_map_with_known_poses_" is enabled, we assume that start_estimate is precise and doesn't need to be refined
-    if (p_map_with_known_poses_)
-    {
-      slamProcessor->update(laserScanContainer, start_estimate, true);
+      stamped_pose = tf_->lookupTransform(p_map_frame_, p_base_frame_, stamp);
+
+      tf2::Quaternion tmp_(
+        stamped_pose.transform.rotation.x,
+        stamped_pose.transform.rotation.y,
+        stamped_pose.transform.rotation.z,
+        stamped_pose.transform.rotation.w);
+      double roll, pitch, yaw;
+      tf2::Matrix3x3(tmp_).getRPY(roll, pitch, yaw);
+
+      start_estimate = Eigen::Vector3f(stamped_pose.transform.translation.x, stamped_pose.transform.translation.y, yaw);
     }
     else
     {
-      slamProcessor->update(laserScanContainer, start_estimate);
+      RCLCPP_ERROR(node_->get_logger(), "Transform from %s to %s failed\n", p_map_frame_.c_str(), p_base_frame_.c_str());
+      start_estimate = slamProcessor->getLastScanMatchPose();
     }
   }
-
-  // If the debug flag "p_timing_output_" is enabled, print how long this last iteration took
-  if (p_timing_output_)
+  else
   {
-    auto duration = node_->get_clock()->now().seconds() - start_time;
-    RCLCPP_INFO(node_->get_logger(), "HectorSLAM Iter took: %f milliseconds", duration );
+    // If none of the above, the initial pose is simply the last estimated pose
+    start_estimate = slamProcessor->getLastScanMatchPose();
   }
 
-  // If we're just building a map with known poses, we're finished now. Code below this point publishes the localization results.
-  if (p_map_with_known_poses_)
-  {
-    return;
-  }
+  return start_estimate;
+}
+
+void HectorMappingRos::publishScanMatchResults(const rclcpp::Time& stamp)
+{
+  hectorslam::ScopedLatency publish_latency(latencyStatsProvider ? &latencyStatsProvider->publish : 0);
 
-  poseInfoContainer_.update(slamProcessor->getLastScanMatchPose(), slamProcessor->getLastScanMatchCovariance(), scan.header.stamp, p_map_frame_);
+  poseInfoContainer_.update(slamProcessor->getLastScanMatchPose(), slamProcessor->getLastScanMatchCovariance(), stamp, p_map_frame_);
 
   // Publish pose with and without covariances
   poseUpdatePublisher_->publish(poseInfoContainer_.getPoseWithCovarianceStamped());
@@ -386,9 +826,9 @@ void HectorMappingRos::scanCallback(const sensor_msgs::msg::LaserScan& scan)
   {
     geometry_msgs::msg::TransformStamped odom_to_base;
 
-    if (tf_->canTransform(p_odom_frame_, p_base_frame_, scan.header.stamp, rclcpp::Duration::from_seconds(0.5)))
+    if (tf_->canTransform(p_odom_frame_, p_base_frame_, stamp, rclcpp::Duration::from_seconds(0.5)))
     {
-      odom_to_base = tf_->lookupTransform(p_odom_frame_, p_base_frame_, scan.header.stamp);
+      odom_to_base = tf_->lookupTransform(p_odom_frame_, p_base_frame_, stamp);
     }
     else
     {
@@ -411,7 +851,7 @@ void HectorMappingRos::scanCallback(const sensor_msgs::msg::LaserScan& scan)
 
     geometry_msgs::msg::TransformStamped map_to_odom_;
     auto t_map_to_odom = t_map_to_base * t_odom_to_base.inverse();
-    map_to_odom_.header.stamp = scan.header.stamp;
+    map_to_odom_.header.stamp = stamp;
     map_to_odom_.transform.rotation.x = t_map_to_odom.getRotation().x();
     map_to_odom_.transform.rotation.y = t_map_to_odom.getRotation().y();
     map_to_odom_.transform.rotation.z = t_map_to_odom.getRotation().z();
@@ -419,7 +859,7 @@ void HectorMappingRos::scanCallback(const sensor_msgs::msg::LaserScan& scan)
     map_to_odom_.transform.translation.x = t_map_to_odom.getOrigin().x();
     map_to_odom_.transform.translation.y = t_map_to_odom.getOrigin().y();
     map_to_odom_.transform.translation.z = t_map_to_odom.getOrigin().z();
-    map_to_odom_.header.stamp = scan.header.stamp;
+    map_to_odom_.header.stamp = stamp;
     map_to_odom_.header.frame_id = p_map_frame_;
     map_to_odom_.child_frame_id = p_odom_frame_;
 
@@ -436,42 +876,256 @@ void HectorMappingRos::scanCallback(const sensor_msgs::msg::LaserScan& scan)
   }
 }
 
-void HectorMappingRos::sysMsgCallback(const std_msgs::msg::String& string)
+template<typename ScanMessage>
+void HectorMappingRos::enqueueScan(const ScanMessage& scan, ScanSource& source)
 {
-  RCLCPP_INFO(node_->get_logger(), "HectorSM sysMsgCallback, msg contents: %s", string.data.c_str());
+  // Take back the scan jobs the scan matching and map update threads are done with
+  ScanJob* job = 0;
 
-  if (string.data == "reset")
+  while (matchedScanJobs_.tryPop(job))
   {
-    RCLCPP_INFO(node_->get_logger(), "HectorSM reset");
-    slamProcessor->reset();
+    freeScanJobs_.push_back(job);
   }
-}
 
-bool HectorMappingRos::mapCallback(const std::shared_ptr<rmw_request_id_t> request_header,
-                                   const std::shared_ptr<nav_msgs::srv::GetMap::Request> req, 
-                                   std::shared_ptr<nav_msgs::srv::GetMap::Response> resp)
-{
-  RCLCPP_INFO(node_->get_logger(), "HectorSM Map service called");
-  *resp = mapPubContainer[0].map_;
-  return true;
-}
+  while (mappedScanJobs_.tryPop(job))
+  {
+    freeScanJobs_.push_back(job);
+  }
 
-bool HectorMappingRos::resetMapCallback(const std::shared_ptr<rmw_request_id_t> request_header,
-                                        const std::shared_ptr<std_srvs::srv::Trigger::Request> req, 
-                                        std::shared_ptr<std_srvs::srv::Trigger::Response> resp)
-{
-  RCLCPP_INFO(node_->get_logger(), "HectorSM Reset map service called");
-  slamProcessor->reset();
-  return true;
-}
+  if (freeScanJobs_.empty())
+  {
+    RCLCPP_WARN_THROTTLE(node_->get_logger(), *node_->get_clock(), 5000, "HectorSM scan pipeline is full, dropping scan");
+    return;
+  }
 
-bool HectorMappingRos::restartHectorCallback(const std::shared_ptr<rmw_request_id_t> request_header,
-                                             const std::shared_ptr<hector_nav_msgs::srv::ResetMapping::Request> req, 
-                                             std::shared_ptr<hector_nav_msgs::srv::ResetMapping::Response> resp)
+  job = freeScanJobs_.back();
+
+  if (!this->convertScan(scan, source, job->dataContainer, job->stamp))
+  {
+    return;
+  }
+
+  freeScanJobs_.pop_back();
+
+  if (!scanQueue_.tryPush(job))
+  {
+    freeScanJobs_.push_back(job);
+    RCLCPP_WARN_THROTTLE(node_->get_logger(), *node_->get_clock(), 5000, "HectorSM scan queue is full, dropping scan");
+    return;
+  }
+
+  this->notifyScanPipeline(scanAvailable_);
+}
+
+void HectorMappingRos::notifyScanPipeline(boost::condition_variable& condition)
+{
+  // Taking the mutex orders the push before a consumer going to sleep, so no wake up gets lost
+  {
+    boost::mutex::scoped_lock lock(pipelineMutex_);
+  }
+  condition.notify_one();
+}
+
+bool HectorMappingRos::waitForScanJob(hectorslam::SpscQueue<ScanJob*>& queue, boost::condition_variable& condition, ScanJob*& job)
+{
+  if (queue.tryPop(job))
+  {
+    return true;
+  }
+
+  boost::mutex::scoped_lock lock(pipelineMutex_);
+
+  while (!queue.tryPop(job))
+  {
+    if (stop_scan_pipeline_)
+    {
+      return false;
+    }
+
+    condition.wait(lock);
+  }
+
+  return true;
+}
+
+void HectorMappingRos::scanMatchLoop()
+{
+  ScanJob* job = 0;
+
+  while (this->waitForScanJob(scanQueue_, scanAvailable_, job))
+  {
+    // Scans that queued up while matching the last one are outdated, only match the newest
+    ScanJob* newer_job = 0;
+
+    while (p_scan_drop_stale_ && scanQueue_.tryPop(newer_job))
+    {
+      matchedScanJobs_.tryPush(job);
+      job = newer_job;
+    }
+
+    auto start_time = node_->get_clock()->now().seconds();
+
+    bool update_map;
+
+    {
+      boost::mutex::scoped_lock lock(slamMutex_);
+
+      if (hectorDrawings)
+      {
+        hectorDrawings->setTime(job->stamp);
+      }
+
+      this->updateMatchTimeBudget(job->stamp);
+
+      Eigen::Vector3f start_estimate(this->getStartEstimate(job->dataContainer, job->stamp));
+
+      update_map = slamProcessor->matchScan(job->dataContainer, start_estimate, p_use_tf_scan_transformation_ && p_map_with_known_poses_);
+      job->mapUpdatePose = slamProcessor->getLastScanMatchPose();
+      job->mapGeneration = mapGeneration_;
+
+      // Drawings and debug info of matching are otherwise only sent by update()
+      slamProcessor->flushDebugOutput();
+
+      // Keep the scan for the relocalization service
+      laserScanContainer.setFrom(job->dataContainer, 1.0f);
+
+      if (p_timing_output_)
+      {
+        auto duration = node_->get_clock()->now().seconds() - start_time;
+        RCLCPP_INFO(node_->get_logger(), "HectorSLAM Match took: %f milliseconds", duration * 1000.0);
+      }
+
+      // Poses are published before the map update, their latency only depends on matching
+      if (!p_map_with_known_poses_)
+      {
+        this->publishScanMatchResults(job->stamp);
+      }
+    }
+
+    if (update_map && !mapUpdateQueue_.tryPush(job))
+    {
+      RCLCPP_WARN_THROTTLE(node_->get_logger(), *node_->get_clock(), 5000, "HectorSM map updates fall behind, skipping map update");
+      update_map = false;
+    }
+
+    if (update_map)
+    {
+      this->notifyScanPipeline(mapUpdateAvailable_);
+    }
+    else
+    {
+      matchedScanJobs_.tryPush(job);
+    }
+  }
+}
+
+void HectorMappingRos::mapUpdateLoop()
+{
+  ScanJob* job = 0;
+
+  while (this->waitForScanJob(mapUpdateQueue_, mapUpdateAvailable_, job))
+  {
+    {
+      boost::mutex::scoped_lock lock(mapUpdateMutex_);
+
+      // Scans matched before the maps were reset or replaced must not end up in the new maps
+      if (job->mapGeneration == mapGeneration_)
+      {
+        slamProcessor->updateMap(job->dataContainer, job->mapUpdatePose);
+      }
+    }
+
+    mappedScanJobs_.tryPush(job);
+  }
+}
+
+void HectorMappingRos::resetMaps()
+{
+  boost::mutex::scoped_lock lock(slamMutex_);
+  boost::mutex::scoped_lock update_lock(mapUpdateMutex_);
+  ++mapGeneration_;
+  slamProcessor->reset();
+}
+
+void HectorMappingRos::stopScanPipeline()
+{
+  {
+    boost::mutex::scoped_lock lock(pipelineMutex_);
+    stop_scan_pipeline_ = true;
+  }
+
+  scanAvailable_.notify_all();
+  mapUpdateAvailable_.notify_all();
+
+  if (scan_match_thread_)
+  {
+    scan_match_thread_->join();
+    delete scan_match_thread_;
+    scan_match_thread_ = 0;
+  }
+
+  if (map_update_thread_)
+  {
+    map_update_thread_->join();
+    delete map_update_thread_;
+    map_update_thread_ = 0;
+  }
+}
+
+void HectorMappingRos::sysMsgCallback(const std_msgs::msg::String& string)
+{
+  RCLCPP_INFO(node_->get_logger(), "HectorSM sysMsgCallback, msg contents: %s", string.data.c_str());
+
+  if (string.data == "reset")
+  {
+    RCLCPP_INFO(node_->get_logger(), "HectorSM reset");
+    this->resetMaps();
+  }
+}
+
+bool HectorMappingRos::mapCallback(const std::shared_ptr<rmw_request_id_t> request_header,
+                                   const std::shared_ptr<nav_msgs::srv::GetMap::Request> req, 
+                                   std::shared_ptr<nav_msgs::srv::GetMap::Response> resp)
+{
+  RCLCPP_INFO(node_->get_logger(), "HectorSM Map service called");
+
+  std::shared_ptr<const hectorslam::GridMapSnapshot> snapshot (slamProcessor->getMapSnapshot(0));
+
+  // Answer from the latest snapshot if available, it is newer than the last published map and needs no locking
+  if (snapshot)
+  {
+    Eigen::Vector2i minCell, maxCell;
+    if (!snapshot->getAllocatedBounds(minCell, maxCell))
+    {
+      maxCell = minCell - Eigen::Vector2i::Ones();
+    }
+
+    setServiceGetMapData(*resp, slamProcessor->getGridMap(0), minCell, maxCell);
+    snapshot->copyRegion(minCell, maxCell, resp->map.data.data(), resp->map.info.width);
+    resp->map.header.stamp = node_->get_clock()->now();
+    return true;
+  }
+
+  *resp = mapPubContainer[0].map_;
+  return true;
+}
+
+bool HectorMappingRos::resetMapCallback(const std::shared_ptr<rmw_request_id_t> request_header,
+                                        const std::shared_ptr<std_srvs::srv::Trigger::Request> req, 
+                                        std::shared_ptr<std_srvs::srv::Trigger::Response> resp)
+{
+  RCLCPP_INFO(node_->get_logger(), "HectorSM Reset map service called");
+  this->resetMaps();
+  return true;
+}
+
+bool HectorMappingRos::restartHectorCallback(const std::shared_ptr<rmw_request_id_t> request_header,
+                                             const std::shared_ptr<hector_nav_msgs::srv::ResetMapping::Request> req, 
+                                             std::shared_ptr<hector_nav_msgs::srv::ResetMapping::Response> resp)
 {
   // Reset map
   RCLCPP_INFO(node_->get_logger(), "HectorSM Reset map");
-  slamProcessor->reset();
+  this->resetMaps();
 
   // Reset pose
   this->resetPose(req->initial_pose);
@@ -496,37 +1150,52 @@ void HectorMappingRos::publishMap(MapPublisherContainer& mapPublisher, const hec
 {
   nav_msgs::srv::GetMap::Response& map_ (mapPublisher.map_);
 
+  bool publishFullMap = this->isFullMapPublishDue(mapPublisher, timestamp);
+
+  Eigen::Vector2i dirtyMin, dirtyMax;
+  bool dirty = false;
+
   //only update map if it changed
   if (lastGetMapUpdateIndex != gridMap.getUpdateIndex())
   {
-
-    int sizeX = gridMap.getSizeX();
-    int sizeY = gridMap.getSizeY();
-
-    int size = sizeX * sizeY;
-
-    std::vector<int8_t>& data = map_.map.data;
-
-    //std::vector contents are guaranteed to be contiguous, use memset to set all to unknown to save time in loop
-    memset(&data[0], -1, sizeof(int8_t) * size);
-
     if (mapMutex)
     {
       mapMutex->lockMap();
     }
 
-    for(int i=0; i < size; ++i)
+    //only the allocated part of the map is published, for sparse maps this grows while exploring
+    Eigen::Vector2i minCell, maxCell;
+    if (!gridMap.getAllocatedBounds(minCell, maxCell))
     {
-      if(gridMap.isFree(i))
-      {
-        data[i] = 0;
-      }
-      else if (gridMap.isOccupied(i))
+      maxCell = minCell - Eigen::Vector2i::Ones();
+    }
+
+    dirty = gridMap.getDirtyBounds(dirtyMin, dirtyMax);
+
+    //the published grid can only be patched while its extent stays the same
+    if ((minCell != mapPublisher.minCell_) || (maxCell != mapPublisher.maxCell_))
+    {
+      setServiceGetMapData(map_, gridMap, minCell, maxCell);
+      setMapDataRegion(map_.map.data, map_.map.info.width, minCell, gridMap, minCell, maxCell);
+
+      mapPublisher.minCell_ = minCell;
+      mapPublisher.maxCell_ = maxCell;
+      publishFullMap = true;
+    }
+    else if (dirty)
+    {
+      dirtyMin = dirtyMin.cwiseMax(minCell);
+      dirtyMax = dirtyMax.cwiseMin(maxCell);
+      dirty = (dirtyMin.array() <= dirtyMax.array()).all();
+
+      if (dirty)
       {
-        data[i] = 100;
+        setMapDataRegion(map_.map.data, map_.map.info.width, minCell, gridMap, dirtyMin, dirtyMax);
       }
     }
 
+    gridMap.clearDirtyBounds();
+
     lastGetMapUpdateIndex = gridMap.getUpdateIndex();
 
     if (mapMutex)
@@ -535,85 +1204,248 @@ void HectorMappingRos::publishMap(MapPublisherContainer& mapPublisher, const hec
     }
   }
 
-  map_.map.header.stamp = timestamp;
-
-  mapPublisher.mapPublisher_->publish(map_.map);
+  this->sendMapData(mapPublisher, timestamp, publishFullMap, dirty, dirtyMin, dirtyMax);
 }
 
-void HectorMappingRos::rosLaserScanToDataContainer(const sensor_msgs::msg::LaserScan& scan, hectorslam::DataContainer& dataContainer, float scaleToMap)
+void HectorMappingRos::publishMapSnapshot(MapPublisherContainer& mapPublisher, const hectorslam::GridMap& gridMap, const std::shared_ptr<const hectorslam::GridMapSnapshot>& snapshot, rclcpp::Time timestamp)
 {
-  size_t size = scan.ranges.size();
+  nav_msgs::srv::GetMap::Response& map_ (mapPublisher.map_);
 
-  float angle = scan.angle_min;
+  bool publishFullMap = this->isFullMapPublishDue(mapPublisher, timestamp);
 
-  dataContainer.clear();
+  Eigen::Vector2i dirtyMin, dirtyMax;
+  bool dirty = false;
+
+  // Works on immutable snapshots only, so the map is never locked here
+  if (snapshot && (snapshot != mapPublisher.snapshot_))
+  {
+    Eigen::Vector2i minCell, maxCell;
+    if (!snapshot->getAllocatedBounds(minCell, maxCell))
+    {
+      maxCell = minCell - Eigen::Vector2i::Ones();
+    }
+
+    if (!mapPublisher.snapshot_ || (minCell != mapPublisher.minCell_) || (maxCell != mapPublisher.maxCell_))
+    {
+      setServiceGetMapData(map_, gridMap, minCell, maxCell);
+      snapshot->copyRegion(minCell, maxCell, map_.map.data.data(), map_.map.info.width);
+
+      mapPublisher.minCell_ = minCell;
+      mapPublisher.maxCell_ = maxCell;
+      publishFullMap = true;
+    }
+    else
+    {
+      // Unchanged tiles are shared with the last published snapshot, only copy the others
+      int tileSize = hectorslam::GridMapSnapshot::TileSize;
+      int width = map_.map.info.width;
+
+      dirtyMin = snapshot->getSize();
+      dirtyMax = Eigen::Vector2i(-1, -1);
+
+      for (int tileY = minCell.y() / tileSize; tileY <= maxCell.y() / tileSize; ++tileY)
+      {
+        for (int tileX = minCell.x() / tileSize; tileX <= maxCell.x() / tileSize; ++tileX)
+        {
+          if (snapshot->getTile(tileX, tileY) == mapPublisher.snapshot_->getTile(tileX, tileY))
+          {
+            continue;
+          }
+
+          Eigen::Vector2i tileMin (Eigen::Vector2i(tileX * tileSize, tileY * tileSize).cwiseMax(minCell));
+          Eigen::Vector2i tileMax ((Eigen::Vector2i(tileX, tileY) * tileSize + Eigen::Vector2i::Constant(tileSize - 1)).cwiseMin(maxCell));
+
+          snapshot->copyRegion(tileMin, tileMax, &map_.map.data[(tileMin.y() - minCell.y()) * width + (tileMin.x() - minCell.x())], width);
 
-  dataContainer.setOrigo(Eigen::Vector2f::Zero());
+          dirtyMin = dirtyMin.cwiseMin(tileMin);
+          dirtyMax = dirtyMax.cwiseMax(tileMax);
+        }
+      }
+
+      dirty = (dirtyMin.array() <= dirtyMax.array()).all();
+    }
+
+    mapPublisher.snapshot_ = snapshot;
+  }
 
-  float maxRangeForContainer = scan.range_max - 0.1f;
+  this->sendMapData(mapPublisher, timestamp, publishFullMap, dirty, dirtyMin, dirtyMax);
+}
 
-  for (size_t i = 0; i < size; ++i)
+bool HectorMappingRos::isFullMapPublishDue(MapPublisherContainer& mapPublisher, const rclcpp::Time& timestamp)
+{
+  // In incremental mode, the full map is only sent to new subscribers and every p_map_pub_full_period_ seconds,
+  // otherwise only the region changed since the last publish goes out as an update
+  if (!p_map_pub_incremental_)
   {
-    float dist = scan.ranges[i];
+    return true;
+  }
+
+  size_t subscriptionCount = mapPublisher.mapPublisher_->get_subscription_count();
+
+  bool due = (subscriptionCount > mapPublisher.lastMapSubscriptionCount_) ||
+             ((p_map_pub_full_period_ > 0.0) && ((timestamp - mapPublisher.lastFullMapPublishTime_).seconds() >= p_map_pub_full_period_));
 
-    if ( (dist > scan.range_min) && (dist < maxRangeForContainer))
+  mapPublisher.lastMapSubscriptionCount_ = subscriptionCount;
+  return due;
+}
+
+void HectorMappingRos::sendMapData(MapPublisherContainer& mapPublisher, const rclcpp::Time& timestamp, bool publishFullMap, bool dirty, const Eigen::Vector2i& dirtyMin, const Eigen::Vector2i& dirtyMax)
+{
+  nav_msgs::srv::GetMap::Response& map_ (mapPublisher.map_);
+
+  if (p_map_pub_incremental_ && dirty && !publishFullMap)
+  {
+    map_msgs::msg::OccupancyGridUpdate update;
+    update.header.stamp = timestamp;
+    update.header.frame_id = p_map_frame_;
+    update.x = dirtyMin.x() - mapPublisher.minCell_.x();
+    update.y = dirtyMin.y() - mapPublisher.minCell_.y();
+    update.width = dirtyMax.x() - dirtyMin.x() + 1;
+    update.height = dirtyMax.y() - dirtyMin.y() + 1;
+    update.data.resize(update.width * update.height);
+
+    for (unsigned int y = 0; y < update.height; ++y)
     {
-      dist *= scaleToMap;
-      dataContainer.add(Eigen::Vector2f(cos(angle) * dist, sin(angle) * dist));
+      std::vector<int8_t>::const_iterator row = map_.map.data.begin() + (update.y + y) * map_.map.info.width + update.x;
+      std::copy(row, row + update.width, update.data.begin() + y * update.width);
     }
 
-    angle += scan.angle_increment;
+    mapPublisher.mapUpdatesPublisher_->publish(update);
+  }
+
+  if (publishFullMap)
+  {
+    map_.map.header.stamp = timestamp;
+
+    mapPublisher.mapPublisher_->publish(map_.map);
+    mapPublisher.lastFullMapPublishTime_ = timestamp;
   }
 }
 
-void HectorMappingRos::rosPointCloudToDataContainer(const sensor_msgs::msg::PointCloud2& pointCloud2, const geometry_msgs::msg::TransformStamped& laserTransform, hectorslam::DataContainer& dataContainer, float scaleToMap)
+void HectorMappingRos::rosLaserScanToDataContainer(const sensor_msgs::msg::LaserScan& scan, hectorslam::LaserScanProjection& projection, hectorslam::DataContainer& dataContainer, float scaleToMap)
 {
-  sensor_msgs::msg::PointCloud pointCloud;
-  sensor_msgs::convertPointCloud2ToPointCloud(pointCloud2, pointCloud);
-
-  size_t size = pointCloud.points.size();
-  // RCLCPP_INFO(node_->get_logger(), "size: %d", size);
+  projection.setBeamGeometry(scan.angle_min, scan.angle_increment, static_cast<int>(scan.ranges.size()));
+  projection.projectPlanar(scan.ranges.data(), scan.range_min, scan.range_max - 0.1f, scaleToMap, dataContainer);
+}
 
-  dataContainer.clear();
+void HectorMappingRos::rosLaserScanToDataContainer(const sensor_msgs::msg::LaserScan& scan, const geometry_msgs::msg::TransformStamped& laserTransform, hectorslam::LaserScanProjection& projection, hectorslam::DataContainer& dataContainer, float scaleToMap)
+{
+  const geometry_msgs::msg::Quaternion& rotation (laserTransform.transform.rotation);
+  const geometry_msgs::msg::Vector3& translation (laserTransform.transform.translation);
+
+  // The beam directions in the base frame are cached as long as the scan geometry and the laser transform stay the same
+  projection.setBeamGeometry(scan.angle_min, scan.angle_increment, static_cast<int>(scan.ranges.size()));
+  projection.setSensorTransform(Eigen::Quaternionf(rotation.w, rotation.x, rotation.y, rotation.z).normalized().toRotationMatrix(),
+                                Eigen::Vector3f(translation.x, translation.y, translation.z), scaleToMap);
+
+  hectorslam::PointFilterParams filter;
+  filter.sqrMinDist = p_sqr_laser_min_dist_;
+  filter.sqrMaxDist = p_sqr_laser_max_dist_;
+  filter.zMin = p_laser_z_min_value_;
+  filter.zMax = p_laser_z_max_value_;
+
+  // Same range cutoff as projecting the scan to a point cloud
+  projection.projectTransformed(scan.ranges.data(), scan.range_min, std::min(scan.range_max, 30.0f), filter, dataContainer);
+}
 
-  tf2::Vector3 laserPos (laserTransform.transform.translation.x, laserTransform.transform.translation.y, laserTransform.transform.translation.z);
-  dataContainer.setOrigo(Eigen::Vector2f(laserTransform.transform.translation.x, laserTransform.transform.translation.y)*scaleToMap);
+bool HectorMappingRos::getPackedPointLayout(const sensor_msgs::msg::PointCloud2& pointCloud2, hectorslam::PackedPointLayout& layout)
+{
+  // Coordinates are read straight from the message buffer, they have to be native float32 values
+  layout = hectorslam::PackedPointLayout();
+  layout.data = pointCloud2.data.data();
+  layout.numPoints = static_cast<int>(pointCloud2.width * pointCloud2.height);
+  layout.pointStep = static_cast<int>(pointCloud2.point_step);
 
-  for (size_t i = 0; i < size; ++i)
+  for (const sensor_msgs::msg::PointField& field : pointCloud2.fields)
   {
-    const geometry_msgs::msg::Point32& currPoint(pointCloud.points[i]);
+    if (field.datatype == sensor_msgs::msg::PointField::FLOAT32)
+    {
+      if (field.name == "x") layout.xOffset = static_cast<int>(field.offset);
+      else if (field.name == "y") layout.yOffset = static_cast<int>(field.offset);
+      else if (field.name == "z") layout.zOffset = static_cast<int>(field.offset);
+    }
+    else if ((field.name == "ring") && ((field.datatype == sensor_msgs::msg::PointField::UINT8) || (field.datatype == sensor_msgs::msg::PointField::UINT16)))
+    {
+      layout.ringOffset = static_cast<int>(field.offset);
+      layout.ringSize = (field.datatype == sensor_msgs::msg::PointField::UINT8) ? 1 : 2;
+    }
+  }
 
-    float dist_sqr = currPoint.x*currPoint.x + currPoint.y* currPoint.y;
+  const uint16_t endianness_probe = 1;
+  bool host_is_bigendian = (*reinterpret_cast<const uint8_t*>(&endianness_probe) == 0);
 
-    if ( (dist_sqr > p_sqr_laser_min_dist_) && (dist_sqr < p_sqr_laser_max_dist_) ){
+  return (layout.xOffset >= 0) && (layout.yOffset >= 0) && (layout.zOffset >= 0) && (pointCloud2.is_bigendian == host_is_bigendian) &&
+         (static_cast<size_t>(layout.numPoints) * pointCloud2.point_step <= pointCloud2.data.size());
+}
 
-      if ( (currPoint.x < 0.0f) && (dist_sqr < 0.50f)){
-        continue;
-      }
+void HectorMappingRos::rosPointCloudToDataContainer(const sensor_msgs::msg::PointCloud2& pointCloud2, const geometry_msgs::msg::TransformStamped& laserTransform, hectorslam::PointCloudSlicer& slicer, hectorslam::DataContainer& dataContainer, float scaleToMap)
+{
+  hectorslam::PackedPointLayout layout;
 
-      tf2::Quaternion q(
-        laserTransform.transform.rotation.x,
-        laserTransform.transform.rotation.y,
-        laserTransform.transform.rotation.z,
-        laserTransform.transform.rotation.w);
-      tf2::Vector3 v(laserTransform.transform.translation.x,laserTransform.transform.translation.y,laserTransform.transform.translation.z);
-      tf2::Transform laserTransform_(q, v);
+  if (!this->getPackedPointLayout(pointCloud2, layout))
+  {
+    RCLCPP_ERROR_THROTTLE(node_->get_logger(), *node_->get_clock(), 5000, "HectorSM point cloud needs native float32 x, y and z fields, ignoring it");
+    dataContainer.clear();
+    return;
+  }
 
-      tf2::Vector3 pointPosBaseFrame(laserTransform_ * tf2::Vector3(currPoint.x, currPoint.y, currPoint.z));
+  const geometry_msgs::msg::Quaternion& rotation (laserTransform.transform.rotation);
+  const geometry_msgs::msg::Vector3& translation (laserTransform.transform.translation);
 
-      float pointPosLaserFrameZ = pointPosBaseFrame.z() - laserPos.z();
+  hectorslam::PointFilterParams filter;
+  filter.sqrMinDist = p_sqr_laser_min_dist_;
+  filter.sqrMaxDist = p_sqr_laser_max_dist_;
+  filter.zMin = p_laser_z_min_value_;
+  filter.zMax = p_laser_z_max_value_;
 
-      if (pointPosLaserFrameZ > p_laser_z_min_value_ && pointPosLaserFrameZ < p_laser_z_max_value_)
-      {
-        dataContainer.add(Eigen::Vector2f(pointPosBaseFrame.x(),pointPosBaseFrame.y())*scaleToMap);
-      }
+  // Rings are only selected if configured, the z band applies either way
+  if ((p_cloud_ring_min_ >= 0) && (layout.ringOffset >= 0))
+  {
+    filter.ringMin = p_cloud_ring_min_;
+    filter.ringMax = (p_cloud_ring_max_ >= 0) ? p_cloud_ring_max_ : p_cloud_ring_min_;
+  }
+  else
+  {
+    if (p_cloud_ring_min_ >= 0)
+    {
+      RCLCPP_WARN_THROTTLE(node_->get_logger(), *node_->get_clock(), 5000, "HectorSM point cloud has no ring field, selecting points by z band only");
     }
+
+    layout.ringOffset = -1;
   }
+
+  slicer.slice(layout,
+               Eigen::Quaternionf(rotation.w, rotation.x, rotation.y, rotation.z).normalized().toRotationMatrix(),
+               Eigen::Vector3f(translation.x, translation.y, translation.z),
+               filter, scaleToMap, dataContainer);
 }
 
 void HectorMappingRos::setServiceGetMapData(nav_msgs::srv::GetMap::Response& map_, const hectorslam::GridMap& gridMap)
 {
-  Eigen::Vector2f mapOrigin (gridMap.getWorldCoords(Eigen::Vector2f::Zero()));
+  Eigen::Vector2i minCell, maxCell;
+  if (!gridMap.getAllocatedBounds(minCell, maxCell))
+  {
+    maxCell = minCell - Eigen::Vector2i::Ones();
+  }
+
+  setServiceGetMapData(map_, gridMap, minCell, maxCell);
+}
+
+void HectorMappingRos::setMapDataRegion(std::vector<int8_t>& data, int dataWidth, const Eigen::Vector2i& dataMinCell, const hectorslam::GridMap& gridMap, const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell)
+{
+  if ((minCell.array() > maxCell.array()).any())
+  {
+    return;
+  }
+
+  int8_t* dataRegion = data.data() + (minCell.y() - dataMinCell.y()) * dataWidth + (minCell.x() - dataMinCell.x());
+
+  hectorslam::convertToOccupancy(gridMap, minCell, maxCell, dataRegion, dataWidth, p_map_pub_graded_, &mapPubWorkers_);
+}
+
+void HectorMappingRos::setServiceGetMapData(nav_msgs::srv::GetMap::Response& map_, const hectorslam::GridMap& gridMap, const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell)
+{
+  Eigen::Vector2f mapOrigin (gridMap.getWorldCoords(minCell.cast<float>()));
   mapOrigin.array() -= gridMap.getCellLength()*0.5f;
 
   map_.map.info.origin.position.x = mapOrigin.x();
@@ -622,38 +1454,76 @@ void HectorMappingRos::setServiceGetMapData(nav_msgs::srv::GetMap::Response& map
 
   map_.map.info.resolution = gridMap.getCellLength();
 
-  map_.map.info.width = gridMap.getSizeX();
-  map_.map.info.height = gridMap.getSizeY();
+  map_.map.info.width = maxCell.x() - minCell.x() + 1;
+  map_.map.info.height = maxCell.y() - minCell.y() + 1;
 
   map_.map.header.frame_id = p_map_frame_;
   map_.map.data.resize(map_.map.info.width * map_.map.info.height);
 }
 
-/*
-void HectorMappingRos::setStaticMapData(const nav_msgs::OccupancyGrid& map)
+void HectorMappingRos::setStaticMapData(const nav_msgs::msg::OccupancyGrid& map)
 {
-  float cell_length = map.info.resolution;
-  Eigen::Vector2f mapOrigin (map.info.origin.position.x + cell_length*0.5f,
-                             map.info.origin.position.y + cell_length*0.5f);
+  if (map.data.size() != static_cast<size_t>(map.info.width) * map.info.height)
+  {
+    RCLCPP_ERROR(node_->get_logger(), "HectorSM static map data does not match its size, ignoring it");
+    return;
+  }
 
-  int map_size_x = map.info.width;
-  int map_size_y = map.info.height;
+  if (std::fabs(getYawFromQuat(map.info.origin.orientation)) > 1e-3)
+  {
+    RCLCPP_ERROR(node_->get_logger(), "HectorSM rotated static maps are not supported, ignoring it");
+    return;
+  }
 
-  slamProcessor = new hectorslam::HectorSlamProcessor(cell_length, map_size_x, map_size_y, Eigen::Vector2f(0.0f, 0.0f), 1, hectorDrawings, debugInfoProvider);
+  if (!map.header.frame_id.empty() && (map.header.frame_id != p_map_frame_))
+  {
+    RCLCPP_WARN(node_->get_logger(), "HectorSM static map is in frame %s instead of %s, using it as is", map.header.frame_id.c_str(), p_map_frame_.c_str());
+  }
+
+  // The static map is resampled to the configured map geometry, parts outside of it are dropped
+  Eigen::Vector2f gridOrigin(map.info.origin.position.x, map.info.origin.position.y);
+
+  {
+    boost::mutex::scoped_lock lock(slamMutex_);
+    boost::mutex::scoped_lock update_lock(mapUpdateMutex_);
+    ++mapGeneration_;
+    slamProcessor->setStaticMap(map.data.data(), static_cast<int>(map.info.width), static_cast<int>(map.info.height), map.info.resolution, gridOrigin);
+  }
+
+  RCLCPP_INFO(node_->get_logger(), "HectorSM static map set: %u x %u cells, resolution %f", map.info.width, map.info.height, map.info.resolution);
 }
-*/
 
 
 void HectorMappingRos::publishMapLoop(double map_pub_period)
 {
   rclcpp::Rate r(1.0 / map_pub_period);
+  rclcpp::Time lastMapSaveTime = node_->get_clock()->now();
+
   while(rclcpp::ok())
   {
     //ros::WallTime t1 = ros::WallTime::now();
     auto mapTime = node_->get_clock()->now();
+
+    // Periodic saving limits what is lost if the node dies mid-mission
+    if ((p_map_save_period_ > 0.0) && !p_map_file_.empty() && ((mapTime - lastMapSaveTime).seconds() >= p_map_save_period_))
+    {
+      std::string message;
+
+      if (saveMap(message))
+      {
+        lastMapSaveTime = mapTime;
+      }
+    }
     //publishMap(mapPubContainer[2],slamProcessor->getGridMap(2), mapTime);
     //publishMap(mapPubContainer[1],slamProcessor->getGridMap(1), mapTime);
-    publishMap(mapPubContainer[0],slamProcessor->getGridMap(0), mapTime, slamProcessor->getMapMutex(0));
+    if (p_map_pub_snapshots_)
+    {
+      publishMapSnapshot(mapPubContainer[0], slamProcessor->getGridMap(0), slamProcessor->getMapSnapshot(0), mapTime);
+    }
+    else
+    {
+      publishMap(mapPubContainer[0],slamProcessor->getGridMap(0), mapTime, slamProcessor->getMapMutex(0));
+    }
 
     //ros::WallDuration t2 = ros::WallTime::now() - t1;
 
@@ -664,9 +1534,66 @@ void HectorMappingRos::publishMapLoop(double map_pub_period)
   }
 }
 
-void HectorMappingRos::staticMapCallback(const nav_msgs::msg::OccupancyGrid& map)
+bool HectorMappingRos::saveMapCallback(const std::shared_ptr<rmw_request_id_t> request_header,
+                                       const std::shared_ptr<std_srvs::srv::Trigger::Request> req,
+                                       std::shared_ptr<std_srvs::srv::Trigger::Response> resp)
 {
+  RCLCPP_INFO(node_->get_logger(), "HectorSM Save map service called");
+  resp->success = saveMap(resp->message);
+  return true;
+}
 
+bool HectorMappingRos::saveMap(std::string& message)
+{
+  boost::mutex::scoped_lock saveLock(mapSaveMutex_);
+
+  if (p_map_file_.empty())
+  {
+    message = "No map file configured, set parameter map_file";
+    return false;
+  }
+
+  if (map_save_thread_)
+  {
+    if (!map_save_thread_->try_join_for(boost::chrono::milliseconds(0)))
+    {
+      message = "Still writing the previous map";
+      return false;
+    }
+
+    delete map_save_thread_;
+    map_save_thread_ = 0;
+  }
+
+  // Copying the maps is quick, writing them to disk happens without holding any locks
+  std::shared_ptr<hectorslam::GridMapFileWriter> writer(std::make_shared<hectorslam::GridMapFileWriter>());
+  {
+    boost::mutex::scoped_lock lock(slamMutex_);
+    boost::mutex::scoped_lock update_lock(mapUpdateMutex_);
+    slamProcessor->saveMaps(*writer);
+  }
+
+  map_save_thread_ = new boost::thread(boost::bind(&HectorMappingRos::writeMapFile, this, writer));
+
+  message = "Saving map to " + p_map_file_;
+  return true;
+}
+
+void HectorMappingRos::writeMapFile(std::shared_ptr<hectorslam::GridMapFileWriter> writer)
+{
+  if (writer->write(p_map_file_))
+  {
+    RCLCPP_INFO(node_->get_logger(), "HectorSM saved map to %s", p_map_file_.c_str());
+  }
+  else
+  {
+    RCLCPP_ERROR(node_->get_logger(), "HectorSM failed to save map to %s", p_map_file_.c_str());
+  }
+}
+
+void HectorMappingRos::staticMapCallback(const nav_msgs::msg::OccupancyGrid& map)
+{
+  this->setStaticMapData(map);
 }
 
 void HectorMappingRos::initialPoseCallback(const geometry_msgs::msg::PoseWithCovarianceStamped& msg)
@@ -688,10 +1615,53 @@ void HectorMappingRos::toggleMappingPause(bool pause)
   pause_scan_processing_ = pause;
 }
 
+bool HectorMappingRos::relocalizeCallback(const std::shared_ptr<rmw_request_id_t> request_header,
+                                          const std::shared_ptr<hector_nav_msgs::srv::RelocalizeScan::Request> req,
+                                          std::shared_ptr<hector_nav_msgs::srv::RelocalizeScan::Response> resp)
+{
+  RCLCPP_INFO(node_->get_logger(), "HectorSM Relocalize service called");
+
+  resp->success = false;
+  resp->score = 0.0f;
+  resp->pose = req->initial_pose;
+
+  boost::mutex::scoped_lock lock(slamMutex_);
+
+  if ((laserScanContainer.getSize() == 0) || !slamProcessor->getGridMap().hasUpdates())
+  {
+    RCLCPP_WARN(node_->get_logger(), "[HectorSM]: Cannot relocalize without a scan and a map");
+    return true;
+  }
+
+  float linear_window = req->linear_search_window > 0.0f ? req->linear_search_window : static_cast<float>(p_relocalization_linear_window_);
+  float angular_window = req->angular_search_window > 0.0f ? req->angular_search_window : static_cast<float>(p_relocalization_angular_window_);
+
+  Eigen::Vector3f hint(req->initial_pose.position.x, req->initial_pose.position.y, getYawFromQuat(req->initial_pose.orientation));
+  Eigen::Vector3f pose;
+
+  resp->score = slamProcessor->relocalize(laserScanContainer, hint, linear_window, angular_window, pose);
+  resp->success = (resp->score > 0.0f) && (resp->score >= p_relocalization_min_score_);
+
+  if (resp->success)
+  {
+    resp->pose = geometry_msgs::msg::Pose();
+    resp->pose.position.x = pose.x();
+    resp->pose.position.y = pose.y();
+    resp->pose.orientation.w = cos(pose.z()*0.5f);
+    resp->pose.orientation.z = sin(pose.z()*0.5f);
+
+    lock.unlock();
+    this->resetPose(resp->pose);
+  }
+
+  return true;
+}
+
 void HectorMappingRos::resetPose(const geometry_msgs::msg::Pose &pose)
 {
+  boost::mutex::scoped_lock lock(slamMutex_);
   initial_pose_set_ = true;
-  initial_pose_ = Eigen::Vector3f(pose.position.x, pose.position.y, util::getYawFromQuat(pose.orientation));
+  initial_pose_ = Eigen::Vector3f(pose.position.x, pose.position.y, getYawFromQuat(pose.orientation));
   RCLCPP_INFO(node_->get_logger(), "[HectorSM]: Setting initial pose with world coords x: %f y: %f yaw: %f",
            initial_pose_[0], initial_pose_[1], initial_pose_[2]);
 }
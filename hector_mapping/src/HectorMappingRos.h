@@ -37,20 +37,27 @@
 #include "message_filters/subscriber.h"
 
 #include "sensor_msgs/msg/laser_scan.hpp"
+#include "sensor_msgs/msg/point_cloud2.hpp"
 #include "std_msgs/msg/string.hpp"
 
 #include "nav_msgs/msg/odometry.hpp"
 #include "hector_nav_msgs/srv/reset_mapping.hpp"
+#include "hector_nav_msgs/srv/relocalize_scan.hpp"
 #include "std_srvs/srv/set_bool.hpp"
 #include "std_srvs/srv/trigger.hpp"
 
 #include "laser_geometry/laser_geometry.hpp"
 #include "nav_msgs/srv/get_map.hpp"
+#include "map_msgs/msg/occupancy_grid_update.hpp"
 
 #include "slam_main/HectorSlamProcessor.h"
+#include "map/GridMapOccupancyConversion.h"
 
 #include "scan/DataPointContainer.h"
+#include "scan/LaserScanProjection.h"
+#include "scan/PointCloudConversion.h"
 #include "util/MapLockerInterface.h"
+#include "util/SpscQueue.h"
 
 #include <boost/thread.hpp>
 
@@ -59,14 +66,55 @@
 
 class HectorDrawings;
 class HectorDebugInfoProvider;
+class HectorLatencyStatsProvider;
 
 class MapPublisherContainer
 {
 public:
   rclcpp::Publisher<nav_msgs::msg::OccupancyGrid>::SharedPtr mapPublisher_;
   rclcpp::Publisher<nav_msgs::msg::MapMetaData>::SharedPtr mapMetadataPublisher_;
+  rclcpp::Publisher<map_msgs::msg::OccupancyGridUpdate>::SharedPtr mapUpdatesPublisher_;
   nav_msgs::srv::GetMap::Response map_;
   rclcpp::Service<nav_msgs::srv::GetMap>::SharedPtr dynamicMapServiceServer_;
+
+  // Cells covered by map_, and state for deciding when to publish the full map instead of updates
+  Eigen::Vector2i minCell_;
+  Eigen::Vector2i maxCell_;
+  size_t lastMapSubscriptionCount_;
+  rclcpp::Time lastFullMapPublishTime_;
+  std::shared_ptr<const hectorslam::GridMapSnapshot> snapshot_;
+};
+
+/**
+ * A scan travelling through the asynchronous scan pipeline, recycled between scans.
+ */
+class ScanJob
+{
+public:
+  hectorslam::DataContainer dataContainer;
+  rclcpp::Time stamp;
+  Eigen::Vector3f mapUpdatePose;
+  unsigned int mapGeneration;
+};
+
+/**
+ * One scan input with its conversion state. With several inputs, each converted scan waits as pending scan until it
+ * is fused with the scans of the other inputs into one frame.
+ */
+class ScanSource
+{
+public:
+  ScanSource()
+    : pending(false)
+  {}
+
+  hectorslam::LaserScanProjection laserScanProjection;
+  hectorslam::PointCloudSlicer pointCloudSlicer;
+
+  hectorslam::DataContainer convertedScan;
+  hectorslam::DataContainer pendingScan;
+  rclcpp::Time pendingStamp;
+  bool pending;
 };
 
 class HectorMappingRos
@@ -76,6 +124,9 @@ public:
     ~HectorMappingRos();
 
   void scanCallback(const sensor_msgs::msg::LaserScan& scan);
+  void pointCloudCallback(const sensor_msgs::msg::PointCloud2& cloud);
+  void fusedScanCallback(const sensor_msgs::msg::LaserScan& scan, size_t sourceIndex);
+  void fusedPointCloudCallback(const sensor_msgs::msg::PointCloud2& cloud, size_t sourceIndex);
   void sysMsgCallback(const std_msgs::msg::String& string);
 
   bool mapCallback(
@@ -94,13 +145,55 @@ public:
     const std::shared_ptr<rmw_request_id_t> request_header,
     const std::shared_ptr<std_srvs::srv::SetBool::Request> req, 
     std::shared_ptr<std_srvs::srv::SetBool::Response> resp);
+  bool relocalizeCallback(
+    const std::shared_ptr<rmw_request_id_t> request_header,
+    const std::shared_ptr<hector_nav_msgs::srv::RelocalizeScan::Request> req,
+    std::shared_ptr<hector_nav_msgs::srv::RelocalizeScan::Response> resp);
+  bool saveMapCallback(
+    const std::shared_ptr<rmw_request_id_t> request_header,
+    const std::shared_ptr<std_srvs::srv::Trigger::Request> req,
+    std::shared_ptr<std_srvs::srv::Trigger::Response> resp);
+
+  template<typename ScanMessage>
+  void processScan(const ScanMessage& scan, ScanSource& source);
+  template<typename ScanMessage>
+  bool convertScan(const ScanMessage& scan, ScanSource& source, hectorslam::DataContainer& dataContainer, rclcpp::Time& stamp);
+  bool fuseScan(ScanSource& source, const rclcpp::Time& stamp, hectorslam::DataContainer& dataContainer, rclcpp::Time& fusedStamp);
+  void collectPendingScans(hectorslam::DataContainer& dataContainer, rclcpp::Time& fusedStamp);
+  bool lookupLaserTransform(const std_msgs::msg::Header& header, geometry_msgs::msg::TransformStamped& laserTransform);
+  bool scanToDataContainer(const sensor_msgs::msg::LaserScan& scan, ScanSource& source, hectorslam::DataContainer& dataContainer);
+  bool scanToDataContainer(const sensor_msgs::msg::PointCloud2& cloud, ScanSource& source, hectorslam::DataContainer& dataContainer);
+  Eigen::Vector3f getStartEstimate(const hectorslam::DataContainer& dataContainer, const rclcpp::Time& stamp);
+  void updateMatchTimeBudget(const rclcpp::Time& stamp);
+  void publishScanMatchResults(const rclcpp::Time& stamp);
+
+  // Asynchronous scan pipeline: ingest in the scan callbacks, matching and map updates on their own threads
+  template<typename ScanMessage>
+  void enqueueScan(const ScanMessage& scan, ScanSource& source);
+  void notifyScanPipeline(boost::condition_variable& condition);
+  bool waitForScanJob(hectorslam::SpscQueue<ScanJob*>& queue, boost::condition_variable& condition, ScanJob*& job);
+  void scanMatchLoop();
+  void mapUpdateLoop();
+  void stopScanPipeline();
+  void resetMaps();
+
+  // Map persistence: maps are copied on the calling thread and written to p_map_file_ on map_save_thread_
+  bool saveMap(std::string& message);
+  void writeMapFile(std::shared_ptr<hectorslam::GridMapFileWriter> writer);
 
   void publishMap(MapPublisherContainer& map_, const hectorslam::GridMap& gridMap, rclcpp::Time timestamp, MapLockerInterface* mapMutex = 0);
+  void publishMapSnapshot(MapPublisherContainer& map_, const hectorslam::GridMap& gridMap, const std::shared_ptr<const hectorslam::GridMapSnapshot>& snapshot, rclcpp::Time timestamp);
+  bool isFullMapPublishDue(MapPublisherContainer& map_, const rclcpp::Time& timestamp);
+  void sendMapData(MapPublisherContainer& map_, const rclcpp::Time& timestamp, bool publishFullMap, bool dirty, const Eigen::Vector2i& dirtyMin, const Eigen::Vector2i& dirtyMax);
 
-  void rosLaserScanToDataContainer(const sensor_msgs::msg::LaserScan& scan, hectorslam::DataContainer& dataContainer, float scaleToMap);
-  void rosPointCloudToDataContainer(const sensor_msgs::msg::PointCloud2& pointCloud, const geometry_msgs::msg::TransformStamped& laserTransform, hectorslam::DataContainer& dataContainer, float scaleToMap);
+  void rosLaserScanToDataContainer(const sensor_msgs::msg::LaserScan& scan, hectorslam::LaserScanProjection& projection, hectorslam::DataContainer& dataContainer, float scaleToMap);
+  void rosLaserScanToDataContainer(const sensor_msgs::msg::LaserScan& scan, const geometry_msgs::msg::TransformStamped& laserTransform, hectorslam::LaserScanProjection& projection, hectorslam::DataContainer& dataContainer, float scaleToMap);
+  bool getPackedPointLayout(const sensor_msgs::msg::PointCloud2& pointCloud, hectorslam::PackedPointLayout& layout);
+  void rosPointCloudToDataContainer(const sensor_msgs::msg::PointCloud2& pointCloud, const geometry_msgs::msg::TransformStamped& laserTransform, hectorslam::PointCloudSlicer& slicer, hectorslam::DataContainer& dataContainer, float scaleToMap);
 
   void setServiceGetMapData(nav_msgs::srv::GetMap::Response& map_, const hectorslam::GridMap& gridMap);
+  void setServiceGetMapData(nav_msgs::srv::GetMap::Response& map_, const hectorslam::GridMap& gridMap, const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell);
+  void setMapDataRegion(std::vector<int8_t>& data, int dataWidth, const Eigen::Vector2i& dataMinCell, const hectorslam::GridMap& gridMap, const Eigen::Vector2i& minCell, const Eigen::Vector2i& maxCell);
 
   void publishTransformLoop(double p_transform_pub_period_);
   void publishMapLoop(double p_map_pub_period_);
@@ -113,17 +206,21 @@ public:
   void toggleMappingPause(bool pause);
   void resetPose(const geometry_msgs::msg::Pose &pose);
 
-  /*
-  void setStaticMapData(const nav_msgs::OccupancyGrid& map);
-  */
+  void setStaticMapData(const nav_msgs::msg::OccupancyGrid& map);
+
   rclcpp::Node::SharedPtr node_;
 protected:
   HectorDebugInfoProvider* debugInfoProvider;
   HectorDrawings* hectorDrawings;
+  HectorLatencyStatsProvider* latencyStatsProvider;
+  rclcpp::TimerBase::SharedPtr latencyStatsTimer_;
 
   int lastGetMapUpdateIndex;
 
   rclcpp::Subscription<sensor_msgs::msg::LaserScan>::SharedPtr scanSubscriber_;
+  rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr cloudSubscriber_;
+  std::vector<rclcpp::Subscription<sensor_msgs::msg::LaserScan>::SharedPtr> fusedScanSubscribers_;
+  std::vector<rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr> fusedCloudSubscribers_;
   rclcpp::Subscription<std_msgs::msg::String>::SharedPtr sysMsgSubscriber_;
 
   rclcpp::Subscription<nav_msgs::msg::OccupancyGrid>::SharedPtr mapSubscriber_;
@@ -140,6 +237,8 @@ protected:
   rclcpp::Service<std_srvs::srv::Trigger>::SharedPtr reset_map_service_;
   rclcpp::Service<hector_nav_msgs::srv::ResetMapping>::SharedPtr restart_hector_service_;
   rclcpp::Service<std_srvs::srv::SetBool>::SharedPtr toggle_scan_processing_service_;
+  rclcpp::Service<hector_nav_msgs::srv::RelocalizeScan>::SharedPtr relocalize_service_;
+  rclcpp::Service<std_srvs::srv::Trigger>::SharedPtr save_map_service_;
 
   std::vector<MapPublisherContainer> mapPubContainer;
 
@@ -149,12 +248,47 @@ protected:
 
   laser_geometry::LaserProjection projector_;
 
+  // The primary scan input first, then the inputs fused with it. Used by the scan callbacks only
+  std::vector<std::unique_ptr<ScanSource> > scanSources_;
+
   tf2::Transform map_to_odom_;
 
   boost::thread* map__publish_thread_;
 
+  // Converts published map regions in parallel, used by the map publish thread only
+  hectorslam::WorkerPool mapPubWorkers_;
+
   hectorslam::HectorSlamProcessor* slamProcessor;
   hectorslam::DataContainer laserScanContainer;
+  // Scan converted by the synchronous path before taking slamMutex_, so tf waits do not block service callbacks
+  hectorslam::DataContainer convertedScanContainer;
+
+  // Guards the slam processor's matching state against service callbacks
+  boost::mutex slamMutex_;
+
+  std::vector<std::unique_ptr<ScanJob> > scanJobs_;
+  std::vector<ScanJob*> freeScanJobs_;
+  hectorslam::SpscQueue<ScanJob*> scanQueue_;
+  hectorslam::SpscQueue<ScanJob*> mapUpdateQueue_;
+  hectorslam::SpscQueue<ScanJob*> matchedScanJobs_;
+  hectorslam::SpscQueue<ScanJob*> mappedScanJobs_;
+
+  boost::mutex pipelineMutex_;
+  boost::condition_variable scanAvailable_;
+  boost::condition_variable mapUpdateAvailable_;
+  bool stop_scan_pipeline_;
+
+  boost::thread* scan_match_thread_;
+  boost::thread* map_update_thread_;
+
+  // Held by the map update thread while updating, so the maps can be replaced between two map updates
+  boost::mutex mapUpdateMutex_;
+  // Increased under both slamMutex_ and mapUpdateMutex_ whenever the maps are replaced, queued map updates of scans
+  // matched against the old maps are dropped
+  unsigned int mapGeneration_;
+
+  boost::mutex mapSaveMutex_;
+  boost::thread* map_save_thread_;
 
   PoseInfoContainer poseInfoContainer_;
 
@@ -181,6 +315,10 @@ protected:
   std::string p_tf_map_scanmatch_transform_frame_name_;
 
   std::string p_scan_topic_;
+  std::string p_scan_cloud_topic_;
+  std::vector<std::string> p_fused_scan_topics_;
+  std::vector<std::string> p_fused_scan_cloud_topics_;
+  double p_scan_fusion_window_;
   std::string p_sys_msg_topic_;
 
   std::string p_pose_update_topic_;
@@ -195,8 +333,27 @@ protected:
 
   double p_update_factor_free_;
   double p_update_factor_occupied_;
+  bool p_use_probability_plane_;
+
+  double p_match_step_thresh_translation_;
+  double p_match_step_thresh_angle_;
+  double p_match_residual_thresh_;
+  bool p_match_use_levenberg_marquardt_;
+  double p_match_time_budget_;
+  bool p_match_likelihood_field_;
+  double p_match_likelihood_field_sigma_;
+
+  double p_relocalization_min_score_;
+  double p_relocalization_linear_window_;
+  double p_relocalization_angular_window_;
+  bool p_relocalize_initial_pose_;
+
   double p_map_update_distance_threshold_;
   double p_map_update_angle_threshold_;
+  int p_map_update_threads_;
+  int p_map_update_finest_level_bands_;
+  bool p_map_pool_coarse_levels_;
+  std::vector<int64_t> p_map_hash_cache_levels_;
 
   double p_map_resolution_;
   int p_map_size_;
@@ -205,16 +362,35 @@ protected:
   int p_map_multi_res_levels_;
 
   double p_map_pub_period_;
+  bool p_map_pub_incremental_;
+  double p_map_pub_full_period_;
+  bool p_map_pub_snapshots_;
+  bool p_map_pub_graded_;
+  int p_map_pub_threads_;
+
+  std::string p_map_file_;
+  double p_map_save_period_;
+
+  bool p_localization_mode_;
+  std::string p_static_map_topic_;
 
   bool p_use_tf_scan_transformation_;
   bool p_use_tf_pose_start_estimate_;
   bool p_map_with_known_poses_;
   bool p_timing_output_;
+  bool p_latency_stats_;
+  double p_latency_stats_period_;
+  bool p_async_scan_processing_;
+  bool p_scan_drop_stale_;
 
   float p_sqr_laser_min_dist_;
   float p_sqr_laser_max_dist_;
   float p_laser_z_min_value_;
   float p_laser_z_max_value_;
+
+  int p_cloud_ring_min_;
+  int p_cloud_ring_max_;
+  int p_cloud_angular_bins_;
 };
 
 #endif